@@ -0,0 +1,147 @@
+//benchmark of the zip_exec core: Open, FindFileIndexInCD, Set* and Save are timed
+// on generated archives of several sizes. every step is run a number of times,
+// the fastest run is reported (the archives are in the page cache after the
+// first run, so it is the cpu and syscall cost that is measured).
+#include "zip_gen.h"
+#include <chrono>
+
+static double GetSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct S_BenchTimes
+{
+	double fOpen, fFind, fSet, fSave;
+};
+
+static bool RunOnce(char *i_szZipFile, char *i_szOutFile, S_BenchTimes *o_pTimes)
+{
+	bool bResult = false;
+	char **pNames = NULL;
+	int iNumFiles = 0;
+	int iFound = 0;
+	double fStart = GetSeconds();
+	C_ZipFile *pclZip = new C_ZipFile();
+	if(!pclZip->Open(i_szZipFile)) goto out;
+	o_pTimes->fOpen = GetSeconds()-fStart;
+
+	//every name is looked up, copies so nothing is shared with the CD
+	iNumFiles = pclZip->GetNumFiles();
+	pNames = new char*[iNumFiles];
+	for(int i=0; i<iNumFiles; i++) {
+		pNames[i] = new char[strlen(pclZip->GetFileName(i))+1];
+		strcpy(pNames[i], pclZip->GetFileName(i));
+	}
+	fStart = GetSeconds();
+	for(int i=0; i<iNumFiles; i++) if(pclZip->FindFileIndexInCD(pNames[i]) == i) iFound++;
+	o_pTimes->fFind = GetSeconds()-fStart;
+	if(iFound != iNumFiles) {
+		LogPrintf("error: %d of %d names not found\n", iNumFiles-iFound, iNumFiles);
+		goto out;
+	}
+
+	//every entry changed once: directories stay, every 10th file is set executable
+	fStart = GetSeconds();
+	for(int i=0; i<iNumFiles; i++) {
+		if(pclZip->IsDirectory(i)) pclZip->SetDirectory(i);
+		else if(i % 10 == 0) pclZip->SetExecutable(i);
+		else pclZip->SetNormal(i);
+	}
+	o_pTimes->fSet = GetSeconds()-fStart;
+
+	fStart = GetSeconds();
+	if(!pclZip->Save(i_szOutFile)) goto out;
+	o_pTimes->fSave = GetSeconds()-fStart;
+	bResult = true;
+out:
+	for(int i=0; pNames && i<iNumFiles; i++) delete[] pNames[i];
+	delete[] pNames;
+	delete pclZip;
+	return bResult;
+}
+
+int main(int argc, char *argv[])
+{
+	S_GenOptions stGen;
+	SetDefaultGenOptions(&stGen);
+	const char *szSizes = "10,1000,100000,1000000";
+	const char *szDir = ".";
+	int iRepeat = 3;
+	bool bKeep = false;
+	int iArg = 1;
+	for(; iArg<argc; iArg++) {
+		uint64_t iValue = 0, iValue2 = 0;
+		bool bOK = iArg+1<argc && ParseSize(argv[iArg+1], &iValue);
+		if(strcmp(argv[iArg], "--sizes")==0 && iArg+1<argc) szSizes = argv[++iArg];
+		else if(strcmp(argv[iArg], "--dir")==0 && iArg+1<argc) szDir = argv[++iArg];
+		else if(strcmp(argv[iArg], "--repeat")==0 && bOK && iValue > 0) { iRepeat = (int)iValue; iArg++; }
+		else if(strcmp(argv[iArg], "--payload")==0 && bOK && iValue < 0xffffffff) { stGen.iPayloadSize = (uint32_t)iValue; iArg++; }
+		else if(strcmp(argv[iArg], "--large")==0 && bOK && iArg+2<argc && ParseSize(argv[iArg+2], &iValue2)) {
+			stGen.iNumLarge = (int)iValue;
+			stGen.iLargeSize = iValue2;
+			iArg += 2;
+		} else if(strcmp(argv[iArg], "--keep")==0) bKeep = true;
+		else {
+			LogPrintf("usage: 'zip_bench [--sizes 10,1000,100000,1000000] [--repeat 3] [--dir .] [--payload n] [--large n size] [--keep]'\n");
+			LogPrintf("       archives of each number of entries are generated in the directory, then Open,\n");
+			LogPrintf("       FindFileIndexInCD (all names), Set* (all entries) and Save are timed, the fastest run is shown\n");
+			return 1;
+		}
+	}
+
+	LogPrintf("%10s %12s %10s %10s %10s %10s %10s %12s\n", "entries", "zip bytes", "gen ms", "open ms", "find ms", "set ms", "save ms", "find ns/name");
+	bool bResult = true;
+	S_MessageLog stLog = { NULL, 0, 0 };
+	for(const char *szSize=szSizes; *szSize && bResult; ) {
+		char szValue[32];
+		int iLen = (int)strcspn(szSize, ",");
+		snprintf(szValue, sizeof(szValue), "%.*s", iLen, szSize);
+		szSize += iLen + (szSize[iLen] == ',');
+		uint64_t iNumEntries;
+		if(!ParseSize(szValue, &iNumEntries) || iNumEntries > 0x7fffffff) {
+			LogPrintf("error: invalid size (%s)\n", szValue);
+			bResult = false;
+			break;
+		}
+
+		char *szZipFile = new char[strlen(szDir)+64];
+		char *szOutFile = new char[strlen(szDir)+64];
+		sprintf(szZipFile, "%s/zip_bench_%d.zip", szDir, (int)iNumEntries);
+		sprintf(szOutFile, "%s/zip_bench_%d.out.zip", szDir, (int)iNumEntries);
+		stGen.iNumEntries = (int)iNumEntries;
+		double fStart = GetSeconds();
+		bResult = GenerateZip(szZipFile, &stGen);
+		double fGen = GetSeconds()-fStart;
+
+		//the messages of the core (from Save) are not of interest here
+		S_BenchTimes stBest = { 0, 0, 0, 0 };
+		for(int i=0; i<iRepeat && bResult; i++) {
+			S_BenchTimes stTimes = { 0, 0, 0, 0 };
+			g_pMessageLog = &stLog;
+			bResult = RunOnce(szZipFile, szOutFile, &stTimes);
+			g_pMessageLog = NULL;
+			if(!bResult && stLog.iLength) fwrite(stLog.pText, 1, stLog.iLength, stdout);
+			stLog.iLength = 0;
+			if(i == 0 || stTimes.fOpen < stBest.fOpen) stBest.fOpen = stTimes.fOpen;
+			if(i == 0 || stTimes.fFind < stBest.fFind) stBest.fFind = stTimes.fFind;
+			if(i == 0 || stTimes.fSet < stBest.fSet) stBest.fSet = stTimes.fSet;
+			if(i == 0 || stTimes.fSave < stBest.fSave) stBest.fSave = stTimes.fSave;
+		}
+		if(bResult) {
+			struct stat stInfo;
+			unsigned long long iZipSize = stat(szZipFile, &stInfo) == 0 ? (unsigned long long)stInfo.st_size : 0;
+			LogPrintf("%10d %12llu %10.2f %10.3f %10.3f %10.3f %10.3f %12.1f\n", (int)iNumEntries, iZipSize, fGen*1000,
+				stBest.fOpen*1000, stBest.fFind*1000, stBest.fSet*1000, stBest.fSave*1000,
+				iNumEntries ? stBest.fFind*1e9/iNumEntries : 0.0);
+		} else LogPrintf("error: benchmark failed (%s)\n", szZipFile);
+		if(!bKeep) {
+			remove(szZipFile);
+			remove(szOutFile);
+		}
+		delete[] szZipFile;
+		delete[] szOutFile;
+	}
+	delete[] stLog.pText;
+	return bResult ? 0 : 1;
+}
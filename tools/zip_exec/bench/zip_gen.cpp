@@ -0,0 +1,247 @@
+//synthetic zip archives, see zip_gen.h
+#include "zip_gen.h"
+
+void SetDefaultGenOptions(S_GenOptions *o_pOptions)
+{
+	o_pOptions->iNumEntries = 1000;
+	o_pOptions->iMinNameLen = 8;
+	o_pOptions->iMaxNameLen = 120;
+	o_pOptions->iPayloadSize = 64;
+	o_pOptions->iNumLarge = 0;
+	o_pOptions->iLargeSize = 64*1024*1024;
+	o_pOptions->iDirEvery = 50;
+	o_pOptions->iSeed = 1;
+}
+
+bool ParseSize(const char *i_szValue, uint64_t *o_iSize)
+{
+	char *szEnd;
+	uint64_t iSize = strtoull(i_szValue, &szEnd, 10);
+	if(szEnd == i_szValue) return false;
+	if(*szEnd == 'k' || *szEnd == 'K') { iSize <<= 10; szEnd++; }
+	else if(*szEnd == 'm' || *szEnd == 'M') { iSize <<= 20; szEnd++; }
+	else if(*szEnd == 'g' || *szEnd == 'G') { iSize <<= 30; szEnd++; }
+	if(*szEnd != 0) return false;
+	*o_iSize = iSize;
+	return true;
+}
+
+//xorshift32, the same archive for the same seed
+static uint32_t NextRandom(uint32_t *io_iState)
+{
+	uint32_t x = *io_iState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*io_iState = x;
+	return x;
+}
+
+//the CD is collected in memory and written after the local data
+struct S_GenBuffer
+{
+	uint8_t *pData;
+	uint64_t iLength, iCapacity;
+};
+
+static uint8_t *GenReserve(S_GenBuffer *io_pBuffer, uint32_t i_iLength)
+{
+	if(io_pBuffer->iLength+i_iLength > io_pBuffer->iCapacity) {
+		uint64_t iCapacity = io_pBuffer->iCapacity ? io_pBuffer->iCapacity*2 : 1024*1024;
+		while(iCapacity < io_pBuffer->iLength+i_iLength) iCapacity *= 2;
+		uint8_t *pData = new uint8_t[iCapacity];
+		if(io_pBuffer->iLength) memcpy(pData, io_pBuffer->pData, io_pBuffer->iLength);
+		delete[] io_pBuffer->pData;
+		io_pBuffer->pData = pData;
+		io_pBuffer->iCapacity = iCapacity;
+	}
+	uint8_t *pPos = io_pBuffer->pData+io_pBuffer->iLength;
+	io_pBuffer->iLength += i_iLength;
+	return pPos;
+}
+
+bool GenerateZip(const char *i_szZipFile, const S_GenOptions *i_pOptions)
+{
+	const S_GenOptions *pOpt = i_pOptions;
+	if(pOpt->iNumEntries < 0 || pOpt->iMinNameLen < 1 || pOpt->iMaxNameLen < pOpt->iMinNameLen || pOpt->iMaxNameLen > 4000) {
+		LogPrintf("error: invalid generator options\n");
+		return false;
+	}
+	C_Resource clFile;
+	clFile.SetMode(false);
+	if(!clFile.SetFilename(i_szZipFile)) {
+		LogPrintf("error: could not create zip file (%s)\n", i_szZipFile);
+		return false;
+	}
+
+	//payloads are slices of one block of random bytes
+	const uint32_t iBlockSize = 1024*1024;
+	uint8_t *pBlock = new uint8_t[iBlockSize];
+	uint32_t iRandom = pOpt->iSeed ? pOpt->iSeed : 1;
+	for(uint32_t i=0; i<iBlockSize; i+=4) {
+		uint32_t iValue = NextRandom(&iRandom);
+		memcpy(pBlock+i, &iValue, 4);
+	}
+	static const char szChars[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+	char *szName = new char[pOpt->iMaxNameLen+64];
+	uint8_t pExtra[28];
+	S_GenBuffer stCD = { NULL, 0, 0 };
+	uint64_t iPos = 0;
+	bool bResult = true;
+	int iDir = 0;
+	int iNextLarge = pOpt->iNumLarge > 0 ? pOpt->iNumEntries/(pOpt->iNumLarge+1) : -1;
+	int iNumLarge = 0;
+
+	for(int i=0; i<pOpt->iNumEntries && bResult; i++) {
+		//a directory, or a file in the last directory with a name of random length
+		// (the index keeps the names unique)
+		bool bDirectory = pOpt->iDirEvery > 0 && i % pOpt->iDirEvery == 0;
+		int iNameLen;
+		if(bDirectory) iNameLen = sprintf(szName, "dir%05d/", ++iDir);
+		else {
+			int iTarget = pOpt->iMinNameLen + (int)(NextRandom(&iRandom) % (uint32_t)(pOpt->iMaxNameLen-pOpt->iMinNameLen+1));
+			iNameLen = iDir ? sprintf(szName, "dir%05d/f%d_", iDir, i) : sprintf(szName, "f%d_", i);
+			while(iNameLen < iTarget) szName[iNameLen++] = szChars[NextRandom(&iRandom) % (sizeof(szChars)-1)];
+			szName[iNameLen] = 0;
+		}
+		uint64_t iSize = bDirectory ? 0 : pOpt->iPayloadSize;
+		if(!bDirectory && i >= iNextLarge && iNumLarge < pOpt->iNumLarge) {
+			iSize = pOpt->iLargeSize;
+			iNumLarge++;
+			iNextLarge = (int)((int64_t)pOpt->iNumEntries*(iNumLarge+1)/(pOpt->iNumLarge+1));
+		}
+		uint32_t iStart = NextRandom(&iRandom) % iBlockSize;
+
+		//crc first, the local header is written before the data
+		uint32_t iCrc = 0;
+		for(uint64_t iDone=0; iDone<iSize; ) {
+			uint32_t iOffset = (uint32_t)((iStart+iDone) % iBlockSize);
+			uint32_t iLength = iBlockSize-iOffset;
+			if(iSize-iDone < iLength) iLength = (uint32_t)(iSize-iDone);
+			iCrc = Crc32Update(iCrc, pBlock+iOffset, iLength);
+			iDone += iLength;
+		}
+
+		//sizes and offset which do not fit are in zip64 extra fields, the local one
+		// has both sizes
+		uint64_t iOffset = iPos;
+		bool bLocal64 = iSize >= 0xffffffff;
+		uint16_t iExtraLen = 0;
+		if(bLocal64) iExtraLen += 16;
+		if(iOffset >= 0xffffffff) iExtraLen += 8;
+		S_LocalFileHeader stLocal;
+		stLocal.sign = 0x04034b50;
+		stLocal.ver_needed = iExtraLen ? 45 : 10;
+		stLocal.gp_flag = 0;
+		stLocal.c_method = 0;
+		stLocal.lm_time = 0x6000; //12:00
+		stLocal.lm_date = 0x5821; //2024-01-01
+		stLocal.crc32 = iCrc;
+		stLocal.c_size = stLocal.u_size = bLocal64 ? 0xffffffff : (uint32_t)iSize;
+		stLocal.name_len = (uint16_t)iNameLen;
+		stLocal.extra_len = bLocal64 ? 20 : 0;
+		uint8_t pHeader[sizeof(S_LocalFileHeader)];
+		EncodeRecord(&stLocal, pHeader);
+		if(bLocal64) {
+			StoreLittleEndian<uint16_t>(pExtra, 0x0001);
+			StoreLittleEndian<uint16_t>(pExtra+2, 16);
+			StoreLittleEndian<uint64_t>(pExtra+4, iSize);
+			StoreLittleEndian<uint64_t>(pExtra+12, iSize);
+		}
+		S_WriteBuffer stBuffers[3] = {
+			{ pHeader, (uint32_t)sizeof(pHeader) },
+			{ szName, (uint32_t)iNameLen },
+			{ pExtra, stLocal.extra_len } };
+		bResult = clFile.WriteGather(stBuffers, 3);
+		iPos += sizeof(pHeader)+iNameLen+stLocal.extra_len;
+		for(uint64_t iDone=0; iDone<iSize && bResult; ) {
+			uint32_t iBlockPos = (uint32_t)((iStart+iDone) % iBlockSize);
+			uint32_t iLength = iBlockSize-iBlockPos;
+			if(iSize-iDone < iLength) iLength = (uint32_t)(iSize-iDone);
+			bResult = clFile.Write(pBlock+iBlockPos, iLength);
+			iDone += iLength;
+		}
+		iPos += iSize;
+
+		S_CentralDirectoryEntry stEntry;
+		stEntry.sign = 0x02014b50;
+		stEntry.ver = 20; //made by fat (windows)
+		stEntry.ver_needed = stLocal.ver_needed;
+		stEntry.gp_flag = 0;
+		stEntry.c_method = 0;
+		stEntry.lm_time = stLocal.lm_time;
+		stEntry.lm_date = stLocal.lm_date;
+		stEntry.crc32 = iCrc;
+		stEntry.c_size = stEntry.u_size = iSize >= 0xffffffff ? 0xffffffff : (uint32_t)iSize;
+		stEntry.name_len = (uint16_t)iNameLen;
+		stEntry.extra_len = iExtraLen ? iExtraLen+4 : 0;
+		stEntry.comment_len = 0;
+		stEntry.dn_start = 0;
+		stEntry.int_attr = 0;
+		stEntry.ext_attrib = bDirectory ? 0x10 : 0x20; //fat directory / archive
+		stEntry.offset = iOffset >= 0xffffffff ? 0xffffffff : (uint32_t)iOffset;
+		uint8_t *pRecord = GenReserve(&stCD, sizeof(S_CentralDirectoryEntry)+iNameLen+stEntry.extra_len);
+		EncodeRecord(&stEntry, pRecord);
+		memcpy(pRecord+sizeof(S_CentralDirectoryEntry), szName, iNameLen);
+		if(iExtraLen) {
+			uint8_t *pCDExtra = pRecord+sizeof(S_CentralDirectoryEntry)+iNameLen;
+			StoreLittleEndian<uint16_t>(pCDExtra, 0x0001);
+			StoreLittleEndian<uint16_t>(pCDExtra+2, iExtraLen);
+			int iField = 4;
+			if(iSize >= 0xffffffff) {
+				StoreLittleEndian<uint64_t>(pCDExtra+iField, iSize);
+				StoreLittleEndian<uint64_t>(pCDExtra+iField+8, iSize);
+				iField += 16;
+			}
+			if(iOffset >= 0xffffffff) StoreLittleEndian<uint64_t>(pCDExtra+iField, iOffset);
+		}
+	}
+
+	//CD, then the zip64 end records if anything does not fit, then the end record
+	uint64_t iCDStart = iPos;
+	for(uint64_t iDone=0; iDone<stCD.iLength && bResult; ) {
+		uint32_t iLength = stCD.iLength-iDone < iBlockSize ? (uint32_t)(stCD.iLength-iDone) : iBlockSize;
+		bResult = clFile.Write(stCD.pData+iDone, iLength);
+		iDone += iLength;
+	}
+	bool bZip64 = pOpt->iNumEntries >= 0xffff || stCD.iLength >= 0xffffffff || iCDStart >= 0xffffffff;
+	if(bResult && bZip64) {
+		S_Zip64CentralDirectoryEnd stEnd64;
+		memset(&stEnd64, 0, sizeof(stEnd64));
+		stEnd64.sign = 0x06064b50;
+		stEnd64.rec_size = sizeof(S_Zip64CentralDirectoryEnd)-12;
+		stEnd64.ver = 45;
+		stEnd64.ver_needed = 45;
+		stEnd64.cd_num = pOpt->iNumEntries;
+		stEnd64.cd_tot_num = pOpt->iNumEntries;
+		stEnd64.cd_size = stCD.iLength;
+		stEnd64.cd_start = iCDStart;
+		S_Zip64CentralDirectoryLocator stLocator;
+		memset(&stLocator, 0, sizeof(stLocator));
+		stLocator.sign = 0x07064b50;
+		stLocator.cd_end_start = iCDStart+stCD.iLength;
+		stLocator.num_discs = 1;
+		uint8_t pRecords[sizeof(S_Zip64CentralDirectoryEnd)+sizeof(S_Zip64CentralDirectoryLocator)];
+		EncodeRecord(&stEnd64, pRecords);
+		EncodeRecord(&stLocator, pRecords+sizeof(S_Zip64CentralDirectoryEnd));
+		bResult = clFile.Write(pRecords, sizeof(pRecords));
+	}
+	if(bResult) {
+		S_CentralDirectoryEnd stEnd;
+		memset(&stEnd, 0, sizeof(stEnd));
+		stEnd.sign = 0x06054b50;
+		stEnd.cd_num = stEnd.cd_tot_num = pOpt->iNumEntries >= 0xffff ? 0xffff : (uint16_t)pOpt->iNumEntries;
+		stEnd.cd_size = stCD.iLength >= 0xffffffff ? 0xffffffff : (uint32_t)stCD.iLength;
+		stEnd.cd_start = iCDStart >= 0xffffffff ? 0xffffffff : (uint32_t)iCDStart;
+		uint8_t pRecord[sizeof(S_CentralDirectoryEnd)];
+		EncodeRecord(&stEnd, pRecord);
+		bResult = clFile.Write(pRecord, sizeof(pRecord));
+	}
+	if(bResult) bResult = clFile.Sync();
+	if(!bResult) LogPrintf("error: could not write zip file (%s)\n", i_szZipFile);
+
+	delete[] stCD.pData;
+	delete[] szName;
+	delete[] pBlock;
+	return bResult;
+}
@@ -0,0 +1,24 @@
+//synthetic zip archives for measuring zip_exec: any number of entries (zip64 from
+// 65535 entries or 4GB on), names of varied lengths and stored payloads, some of
+// them large. the entries look like those of a zip made on windows (fat
+// attributes), so zip_exec has something to change in every one of them.
+#pragma once
+#include "zip_exec.h"
+
+struct S_GenOptions
+{
+	int iNumEntries;       //including the directory entries
+	int iMinNameLen;       //file names get a random length in this range
+	int iMaxNameLen;
+	uint32_t iPayloadSize; //bytes stored in every file entry
+	int iNumLarge;         //files with a large payload, spread over the archive
+	uint64_t iLargeSize;
+	int iDirEvery;         //one directory entry for every n entries, 0 for none
+	uint32_t iSeed;
+};
+
+void SetDefaultGenOptions(S_GenOptions *o_pOptions);
+bool GenerateZip(const char *i_szZipFile, const S_GenOptions *i_pOptions);
+
+//sizes as a number with an optional k, m or g (1024 based)
+bool ParseSize(const char *i_szValue, uint64_t *o_iSize);
@@ -0,0 +1,45 @@
+//commandline for the synthetic zip generator
+#include "zip_gen.h"
+
+int main(int argc, char *argv[])
+{
+	S_GenOptions stOptions;
+	SetDefaultGenOptions(&stOptions);
+	int iArg = 1;
+	for(; iArg<argc && strncmp(argv[iArg], "--", 2)==0; iArg++) {
+		uint64_t iValue = 0, iValue2 = 0;
+		bool bOK = iArg+1<argc && ParseSize(argv[iArg+1], &iValue);
+		if(strcmp(argv[iArg], "--names")==0 && iArg+1<argc) {
+			//min-max
+			const char *szMax = strchr(argv[iArg+1], '-');
+			bOK = szMax && sscanf(argv[iArg+1], "%d-%d", &stOptions.iMinNameLen, &stOptions.iMaxNameLen) == 2;
+		} else if(strcmp(argv[iArg], "--payload")==0 && bOK && iValue < 0xffffffff) stOptions.iPayloadSize = (uint32_t)iValue;
+		else if(strcmp(argv[iArg], "--large")==0 && bOK && iArg+2<argc && ParseSize(argv[iArg+2], &iValue2)) {
+			stOptions.iNumLarge = (int)iValue;
+			stOptions.iLargeSize = iValue2;
+			iArg++;
+		} else if(strcmp(argv[iArg], "--dirs")==0 && bOK) stOptions.iDirEvery = (int)iValue;
+		else if(strcmp(argv[iArg], "--seed")==0 && bOK) stOptions.iSeed = (uint32_t)iValue;
+		else bOK = false;
+		if(!bOK) {
+			LogPrintf("error: unknown or invalid option (%s)\n", argv[iArg]);
+			return 1;
+		}
+		iArg++;
+	}
+	uint64_t iNumEntries = 0;
+	if(argc-iArg != 2 || !ParseSize(argv[iArg+1], &iNumEntries) || iNumEntries > 0x7fffffff) {
+		LogPrintf("usage: 'zip_gen [options] \"out.zip\" entries'\n");
+		LogPrintf("options:\n");
+		LogPrintf("  --names min-max   length range of the file names (default 8-120)\n");
+		LogPrintf("  --payload n       bytes stored in every file (default 64, k/m/g allowed)\n");
+		LogPrintf("  --large n size    n files with a payload of size instead, spread over the archive\n");
+		LogPrintf("  --dirs n          one directory entry for every n entries, 0 for none (default 50)\n");
+		LogPrintf("  --seed n          seed of the names and payloads (default 1)\n");
+		return 1;
+	}
+	stOptions.iNumEntries = (int)iNumEntries;
+	if(!GenerateZip(argv[iArg], &stOptions)) return 1;
+	LogPrintf("generated \"%s\" (%d entries)\n", argv[iArg], stOptions.iNumEntries);
+	return 0;
+}
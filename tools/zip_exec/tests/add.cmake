@@ -0,0 +1,30 @@
+#--add of a new file and of one replacing an entry, rewriting the zip and in
+# place, then --compact: every step verifies and the result extracts to the tree
+# with the changes
+#-DZIP_EXEC=path -DLEVEL=0..9 -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+run_ok(${ZIP_EXEC} --level ${LEVEL} --create ${WORK}/a.zip ${WORK}/src)
+configure_file(${WORK}/a.zip ${WORK}/b.zip COPYONLY)
+
+run_ok(${CMAKE_COMMAND} -E copy_directory ${WORK}/src ${WORK}/expected)
+file(WRITE ${WORK}/expected/plugins/new.txt "a file added later\n")
+file(WRITE ${WORK}/expected/doc/readme.txt "replaced\n")
+set(pAdd --add plugins/new.txt ${WORK}/expected/plugins/new.txt --add doc/readme.txt ${WORK}/expected/doc/readme.txt)
+run_ok(${ZIP_EXEC} --level ${LEVEL} ${WORK}/a.zip ${pAdd})
+run_ok(${ZIP_EXEC} --level ${LEVEL} --in-place ${WORK}/b.zip ${pAdd})
+
+foreach(szZip a b)
+	run_ok(${ZIP_EXEC} --verify ${WORK}/${szZip}.zip)
+	file(SIZE ${WORK}/${szZip}.zip iBefore)
+	run_ok(${ZIP_EXEC} --compact ${WORK}/${szZip}.zip)
+	file(SIZE ${WORK}/${szZip}.zip iAfter)
+	if(NOT iAfter LESS iBefore)
+		message(FATAL_ERROR "--compact left ${szZip}.zip at ${iAfter} bytes (${iBefore} before)")
+	endif()
+	run_ok(${ZIP_EXEC} --verify ${WORK}/${szZip}.zip)
+	run_ok(${ZIP_EXEC} --extract ${WORK}/${szZip}.zip ${WORK}/out_${szZip})
+	compare_trees(${WORK}/expected ${WORK}/out_${szZip})
+endforeach()
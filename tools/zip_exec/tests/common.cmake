@@ -0,0 +1,57 @@
+#helpers of the test scripts, which are run with cmake -P by ctest
+
+#runs a command, which must succeed (run_ok) or fail (run_fail). its output is
+# in RUN_OUTPUT
+function(run_ok)
+	execute_process(COMMAND ${ARGN} RESULT_VARIABLE iResult OUTPUT_VARIABLE szOutput ERROR_VARIABLE szOutput)
+	if(NOT iResult EQUAL 0)
+		message(FATAL_ERROR "failed (${iResult}): ${ARGN}\n${szOutput}")
+	endif()
+	set(RUN_OUTPUT "${szOutput}" PARENT_SCOPE)
+endfunction()
+
+function(run_fail)
+	execute_process(COMMAND ${ARGN} RESULT_VARIABLE iResult OUTPUT_VARIABLE szOutput ERROR_VARIABLE szOutput)
+	if(iResult EQUAL 0)
+		message(FATAL_ERROR "did not fail: ${ARGN}\n${szOutput}")
+	endif()
+	set(RUN_OUTPUT "${szOutput}" PARENT_SCOPE)
+endfunction()
+
+#a tree with what the deflater and inflater have to handle: empty files and
+# directories, text that compresses well, random text over several 1MB chunks
+# (the unit --create deflates in parallel) and a binary (the tool itself)
+function(make_tree szDir)
+	file(REMOVE_RECURSE ${szDir})
+	file(MAKE_DIRECTORY ${szDir}/empty_dir ${szDir}/a/b/c/d)
+	file(WRITE ${szDir}/bin/run.sh "#!/bin/sh\necho ok\n")
+	file(WRITE ${szDir}/empty.txt "")
+	file(WRITE ${szDir}/a/b/c/d/deep.txt "deep\n")
+	set(szLines "")
+	foreach(i RANGE 1 2000)
+		string(APPEND szLines "line ${i} of a text which repeats itself a lot\n")
+	endforeach()
+	file(WRITE ${szDir}/doc/readme.txt "${szLines}")
+	file(WRITE ${szDir}/data/random.txt "")
+	foreach(i RANGE 1 40)
+		string(RANDOM LENGTH 65536 RANDOM_SEED ${i} szRandom)
+		file(APPEND ${szDir}/data/random.txt "${szRandom}")
+	endforeach()
+	configure_file(${ZIP_EXEC} ${szDir}/data/tool.bin COPYONLY)
+endfunction()
+
+#same names, the files with the same contents
+function(compare_trees szExpected szActual)
+	file(GLOB_RECURSE pExpected LIST_DIRECTORIES true RELATIVE ${szExpected} ${szExpected}/*)
+	file(GLOB_RECURSE pActual LIST_DIRECTORIES true RELATIVE ${szActual} ${szActual}/*)
+	list(SORT pExpected)
+	list(SORT pActual)
+	if(NOT "${pExpected}" STREQUAL "${pActual}")
+		message(FATAL_ERROR "different names in ${szActual}:\n${pActual}\nexpected:\n${pExpected}")
+	endif()
+	foreach(szName ${pExpected})
+		if(NOT IS_DIRECTORY ${szExpected}/${szName})
+			run_ok(${CMAKE_COMMAND} -E compare_files ${szExpected}/${szName} ${szActual}/${szName})
+		endif()
+	endforeach()
+endfunction()
@@ -0,0 +1,17 @@
+#a zip with one changed byte in the data of an entry fails --verify and
+# --extract, which writes nothing
+#-DZIP_EXEC=path -DZIP_CORRUPT=path -DLEVEL=0..9 -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+run_ok(${ZIP_EXEC} --level ${LEVEL} --create ${WORK}/a.zip ${WORK}/src)
+run_ok(${ZIP_CORRUPT} ${WORK}/a.zip data/random.txt)
+run_fail(${ZIP_EXEC} --verify ${WORK}/a.zip)
+if(NOT RUN_OUTPUT MATCHES "data/random.txt")
+	message(FATAL_ERROR "the corrupted entry is not reported:\n${RUN_OUTPUT}")
+endif()
+run_fail(${ZIP_EXEC} --extract ${WORK}/a.zip ${WORK}/out)
+if(EXISTS ${WORK}/out OR EXISTS ${WORK}/out.zip_exec.tmp)
+	message(FATAL_ERROR "a failed extraction left files behind")
+endif()
@@ -0,0 +1,53 @@
+#--diff reports an attribute change only where the unix mode or file type
+# differs: setting a file executable shows for that file alone, not for the
+# others whose version needed or dos bits were rewritten with it (in a zip made
+# by zip, -DZIP=path, otherwise by --create). added, removed and changed files
+# and identical zips are checked with the exit code
+#-DZIP_EXEC=path [-DZIP=path] -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+#runs zip_exec --diff, which must exit with iExpected, the output is in RUN_OUTPUT
+function(run_diff iExpected)
+	execute_process(COMMAND ${ZIP_EXEC} --diff ${ARGN} RESULT_VARIABLE iResult OUTPUT_VARIABLE szOutput ERROR_VARIABLE szOutput)
+	if(NOT iResult EQUAL iExpected)
+		message(FATAL_ERROR "exited with ${iResult} instead of ${iExpected}: ${ARGN}\n${szOutput}")
+	endif()
+	set(RUN_OUTPUT "${szOutput}" PARENT_SCOPE)
+endfunction()
+
+function(make_zip szZip szDir)
+	if(ZIP)
+		execute_process(COMMAND ${ZIP} -qr9 ${szZip} . WORKING_DIRECTORY ${szDir})
+	else()
+		run_ok(${ZIP_EXEC} --create ${szZip} ${szDir})
+	endif()
+endfunction()
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+make_zip(${WORK}/a.zip ${WORK}/src)
+run_diff(0 ${WORK}/a.zip ${WORK}/a.zip)
+
+configure_file(${WORK}/a.zip ${WORK}/b.zip COPYONLY)
+#tool.bin is a copy of zip_exec, so executable too
+run_ok(${ZIP_EXEC} ${WORK}/b.zip bin/run.sh data/tool.bin)
+run_diff(2 ${WORK}/a.zip ${WORK}/b.zip)
+if(NOT RUN_OUTPUT MATCHES "attributes: \"bin/run.sh\" 0644 file -> 0755 file\n")
+	message(FATAL_ERROR "the executable bit of bin/run.sh is not reported:\n${RUN_OUTPUT}")
+endif()
+if(NOT RUN_OUTPUT MATCHES "diff: 0 added, 0 removed, 0 changed, 1 with other attributes, ")
+	message(FATAL_ERROR "other differences reported:\n${RUN_OUTPUT}")
+endif()
+
+file(WRITE ${WORK}/src/new.txt "new\n")
+file(REMOVE ${WORK}/src/empty.txt)
+file(WRITE ${WORK}/src/a/b/c/d/deep.txt "deeper\n")
+make_zip(${WORK}/c.zip ${WORK}/src)
+run_diff(2 ${WORK}/a.zip ${WORK}/c.zip)
+foreach(szLine "removed: \"empty.txt\"" "changed: \"a/b/c/d/deep.txt\" size 5 -> 7" "added: \"new.txt\" size 4, 0644 file"
+	"diff: 1 added, 1 removed, 1 changed, 0 with other attributes, ")
+	string(FIND "${RUN_OUTPUT}" "${szLine}" iFound)
+	if(iFound LESS 0)
+		message(FATAL_ERROR "\"${szLine}\" missing:\n${RUN_OUTPUT}")
+	endif()
+endforeach()
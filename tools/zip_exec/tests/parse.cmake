@@ -0,0 +1,26 @@
+#the central directory is parsed in chunks of 16384 entries on several threads:
+# --list gives the same as with one thread, and with broken records in two
+# chunks the first of them in CD order is the one reported
+#-DZIP_EXEC=path -DZIP_GEN=path -DZIP_CORRUPT=path -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+file(REMOVE_RECURSE ${WORK})
+file(MAKE_DIRECTORY ${WORK})
+run_ok(${ZIP_GEN} --payload 1 ${WORK}/a.zip 70000)
+run_ok(${ZIP_EXEC} --threads 1 --list ${WORK}/a.zip)
+set(szOne "${RUN_OUTPUT}")
+run_ok(${ZIP_EXEC} --threads 4 --list ${WORK}/a.zip)
+if(NOT RUN_OUTPUT STREQUAL szOne)
+	message(FATAL_ERROR "--list differs with 4 threads")
+endif()
+
+configure_file(${WORK}/a.zip ${WORK}/bad.zip COPYONLY)
+run_ok(${ZIP_CORRUPT} --cd ${WORK}/bad.zip 20001 50001)
+string(REGEX MATCH "^[^\n]+" szFirst "${RUN_OUTPUT}")
+foreach(iThreads 1 4)
+	run_fail(${ZIP_EXEC} --threads ${iThreads} --list ${WORK}/bad.zip)
+	string(FIND "${RUN_OUTPUT}" "invalid zip64 extra field (${szFirst})" iFound)
+	if(iFound LESS 0)
+		message(FATAL_ERROR "the first broken entry (${szFirst}) is not reported with ${iThreads} threads:\n${RUN_OUTPUT}")
+	endif()
+endforeach()
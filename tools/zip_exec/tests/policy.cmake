@@ -0,0 +1,31 @@
+#a policy sets the modes of what is below a directory, not of the directory
+# itself, and a rule without a type keeps the directories it matches searchable.
+# checked when creating and when modifying a zip
+#-DZIP_EXEC=path -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+#the mode --list shows for an entry
+function(expect_mode szList szName szMode)
+	if(NOT szList MATCHES "\t${szName}\t[^\n]*\t${szMode}\t")
+		message(FATAL_ERROR "${szName} is not ${szMode}:\n${szList}")
+	endif()
+endfunction()
+
+function(check_modes szZip)
+	run_ok(${ZIP_EXEC} --list ${szZip})
+	expect_mode("${RUN_OUTPUT}" "a/" "0755")
+	expect_mode("${RUN_OUTPUT}" "a/b/" "0750")
+	expect_mode("${RUN_OUTPUT}" "a/b/c/d/" "0750")
+	expect_mode("${RUN_OUTPUT}" "a/b/c/d/deep.txt" "0640")
+	expect_mode("${RUN_OUTPUT}" "doc/" "0755")
+	expect_mode("${RUN_OUTPUT}" "doc/readme.txt" "0600")
+endfunction()
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+file(WRITE ${WORK}/policy.txt "a/** 0640\ndoc/** 0600 file\n")
+run_ok(${ZIP_EXEC} --policy ${WORK}/policy.txt --create ${WORK}/a.zip ${WORK}/src)
+check_modes(${WORK}/a.zip)
+run_ok(${ZIP_EXEC} --create ${WORK}/b.zip ${WORK}/src)
+run_ok(${ZIP_EXEC} --policy ${WORK}/policy.txt ${WORK}/b.zip)
+check_modes(${WORK}/b.zip)
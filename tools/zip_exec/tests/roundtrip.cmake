@@ -0,0 +1,22 @@
+#--create at LEVEL, --verify, --list of the executables, extracted again by
+# cmake -E tar (libarchive, an inflater which is not ours) and by --extract into
+# a new directory and over it (with --verify, where stored data is copied file
+# to file)
+#-DZIP_EXEC=path -DLEVEL=0..9 -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+run_ok(${ZIP_EXEC} --level ${LEVEL} --create ${WORK}/a.zip ${WORK}/src bin/run.sh)
+run_ok(${ZIP_EXEC} --verify ${WORK}/a.zip)
+run_ok(${ZIP_EXEC} --list --kind exec ${WORK}/a.zip)
+if(NOT RUN_OUTPUT MATCHES "bin/run.sh")
+	message(FATAL_ERROR "bin/run.sh is not executable in the zip:\n${RUN_OUTPUT}")
+endif()
+file(MAKE_DIRECTORY ${WORK}/tar)
+run_ok(${CMAKE_COMMAND} -E chdir ${WORK}/tar ${CMAKE_COMMAND} -E tar xf ${WORK}/a.zip)
+compare_trees(${WORK}/src ${WORK}/tar)
+run_ok(${ZIP_EXEC} --extract ${WORK}/a.zip ${WORK}/out)
+compare_trees(${WORK}/src ${WORK}/out)
+run_ok(${ZIP_EXEC} --verify --extract ${WORK}/a.zip ${WORK}/out)
+compare_trees(${WORK}/src ${WORK}/out)
@@ -0,0 +1,27 @@
+#setting a file executable in a zip made by zip leaves its local headers with
+# another version needed than the central directory, --sync-local patches them,
+# when rewriting the zip and in place
+#-DZIP_EXEC=path -DZIP=path -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+execute_process(COMMAND ${ZIP} -qr9 ${WORK}/a.zip . WORKING_DIRECTORY ${WORK}/src)
+run_ok(${ZIP_EXEC} ${WORK}/a.zip bin/run.sh)
+run_ok(${ZIP_EXEC} --verify ${WORK}/a.zip)
+if(NOT RUN_OUTPUT MATCHES "\"bin/run.sh\" local version needed differs")
+	message(FATAL_ERROR "the local header of bin/run.sh is not reported:\n${RUN_OUTPUT}")
+endif()
+configure_file(${WORK}/a.zip ${WORK}/b.zip COPYONLY)
+
+run_ok(${ZIP_EXEC} --sync-local ${WORK}/a.zip)
+run_ok(${ZIP_EXEC} --in-place --sync-local ${WORK}/b.zip)
+foreach(szZip a b)
+	run_ok(${ZIP_EXEC} --verify ${WORK}/${szZip}.zip)
+	if(NOT RUN_OUTPUT MATCHES " 0 warnings")
+		message(FATAL_ERROR "local headers left out of sync in ${szZip}.zip:\n${RUN_OUTPUT}")
+	endif()
+	run_ok(${ZIP_EXEC} --extract ${WORK}/${szZip}.zip ${WORK}/out_${szZip})
+	compare_trees(${WORK}/src ${WORK}/out_${szZip})
+endforeach()
+run_ok(${CMAKE_COMMAND} -E compare_files ${WORK}/a.zip ${WORK}/b.zip)
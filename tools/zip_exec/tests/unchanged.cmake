@@ -0,0 +1,30 @@
+#an archive that already has the attributes is not written again: with
+# --exit-unchanged the second run exits with 3, rewriting or in place, leaves the
+# zip as it was and prints the same --digest as the run that wrote it
+#-DZIP_EXEC=path -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+#runs zip_exec, which must exit with iExpected, and gives the digest it printed
+function(run_digest iExpected szDigestVar)
+	execute_process(COMMAND ${ZIP_EXEC} --digest --exit-unchanged ${ARGN} RESULT_VARIABLE iResult OUTPUT_VARIABLE szOutput ERROR_VARIABLE szOutput)
+	if(NOT iResult EQUAL iExpected)
+		message(FATAL_ERROR "exited with ${iResult} instead of ${iExpected}: ${ARGN}\n${szOutput}")
+	endif()
+	if(NOT szOutput MATCHES "cd digest ([0-9a-f]+)")
+		message(FATAL_ERROR "no digest printed: ${ARGN}\n${szOutput}")
+	endif()
+	set(${szDigestVar} ${CMAKE_MATCH_1} PARENT_SCOPE)
+endfunction()
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+run_ok(${ZIP_EXEC} --create ${WORK}/a.zip ${WORK}/src)
+run_digest(0 szWritten ${WORK}/a.zip bin/run.sh)
+configure_file(${WORK}/a.zip ${WORK}/written.zip COPYONLY)
+
+run_digest(3 szAgain ${WORK}/a.zip bin/run.sh)
+run_digest(3 szInPlace --in-place ${WORK}/a.zip bin/run.sh)
+if(NOT szAgain STREQUAL szWritten OR NOT szInPlace STREQUAL szWritten)
+	message(FATAL_ERROR "the digest changed: ${szWritten}, ${szAgain}, ${szInPlace}")
+endif()
+run_ok(${CMAKE_COMMAND} -E compare_files ${WORK}/a.zip ${WORK}/written.zip)
@@ -0,0 +1,25 @@
+#archives made by zip: stored and deflated ones verify and extract, and one
+# written to a pipe (data descriptors) passes through --stream
+#-DZIP_EXEC=path -DZIP=path -DWORK=directory
+include(${CMAKE_CURRENT_LIST_DIR}/common.cmake)
+
+file(REMOVE_RECURSE ${WORK})
+make_tree(${WORK}/src)
+execute_process(COMMAND ${ZIP} -qr0 ${WORK}/stored.zip . WORKING_DIRECTORY ${WORK}/src)
+execute_process(COMMAND ${ZIP} -qr9 ${WORK}/deflated.zip . WORKING_DIRECTORY ${WORK}/src)
+foreach(szZip stored deflated)
+	run_ok(${ZIP_EXEC} --verify ${WORK}/${szZip}.zip)
+	run_ok(${ZIP_EXEC} --extract ${WORK}/${szZip}.zip ${WORK}/out_${szZip})
+	compare_trees(${WORK}/src ${WORK}/out_${szZip})
+endforeach()
+
+execute_process(COMMAND ${ZIP} -qr - . COMMAND ${ZIP_EXEC} --stream bin/run.sh
+	OUTPUT_FILE ${WORK}/streamed.zip ERROR_VARIABLE szOutput RESULTS_VARIABLE pResults WORKING_DIRECTORY ${WORK}/src)
+if(NOT "${pResults}" STREQUAL "0;0")
+	message(FATAL_ERROR "zip | zip_exec --stream failed (${pResults}):\n${szOutput}")
+endif()
+run_ok(${ZIP_EXEC} --verify ${WORK}/streamed.zip)
+run_ok(${ZIP_EXEC} --list --kind exec ${WORK}/streamed.zip)
+if(NOT RUN_OUTPUT MATCHES "bin/run.sh")
+	message(FATAL_ERROR "bin/run.sh is not executable in the streamed zip:\n${RUN_OUTPUT}")
+endif()
@@ -0,0 +1,93 @@
+//flips one byte in the middle of the data of an entry, for the tests of --verify
+// and --extract on corrupted archives. with --cd it breaks the central directory
+// records of entries instead (by index, for the tests of the parallel parsing)
+#include "zip_exec.h"
+
+//the last 4 bytes of the name become a zip64 extra field without data and the
+// uncompressed size 0xffffffff, which needs one: the record keeps its size and
+// the zip no longer opens
+static int BreakRecord(C_ZipFile *i_pclZip, const char *i_szZipFile, int i_iIdx)
+{
+	S_CentralDirectoryEntry stEntry;
+	uint64_t iPos = i_pclZip->GetCDStart();
+	for(int i=0; i<i_iIdx; i++) {
+		i_pclZip->GetEntry(i, &stEntry);
+		iPos += sizeof(S_CentralDirectoryEntry) + stEntry.name_len + stEntry.extra_len + stEntry.comment_len;
+	}
+	i_pclZip->GetEntry(i_iIdx, &stEntry);
+	if(stEntry.name_len <= 4) {
+		LogPrintf("error: name too short (%s)\n", i_pclZip->GetFileName(i_iIdx));
+		return 1;
+	}
+	uint8_t pRecord[sizeof(S_CentralDirectoryEntry)];
+	bool bOK = i_pclZip->ReadLocalData(iPos, pRecord, sizeof(pRecord));
+	StoreLittleEndian(pRecord+offsetof(S_CentralDirectoryEntry, u_size), (uint32_t)0xffffffff);
+	StoreLittleEndian(pRecord+offsetof(S_CentralDirectoryEntry, name_len), (uint16_t)(stEntry.name_len-4));
+	StoreLittleEndian(pRecord+offsetof(S_CentralDirectoryEntry, extra_len), (uint16_t)(stEntry.extra_len+4));
+	const uint8_t pExtra[4] = { 0x01, 0x00, 0x00, 0x00 };
+
+	FILE *pFile = bOK ? fopen(i_szZipFile, "r+b") : NULL;
+	bOK = pFile && fseek64(pFile, (int64_t)iPos, SEEK_SET) == 0 && fwrite(pRecord, sizeof(pRecord), 1, pFile) == 1
+		&& fseek64(pFile, (int64_t)(iPos + sizeof(pRecord) + stEntry.name_len - 4), SEEK_SET) == 0 && fwrite(pExtra, 4, 1, pFile) == 1;
+	if(pFile && fclose(pFile) != 0) bOK = false;
+	if(!bOK) {
+		LogPrintf("error: could not change %s\n", i_szZipFile);
+		return 1;
+	}
+	//the name the record has now
+	printf("%.*s\n", stEntry.name_len-4, i_pclZip->GetFileName(i_iIdx));
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	bool bCD = argc >= 4 && strcmp(argv[1], "--cd")==0;
+	if(argc != 3 && !bCD) {
+		LogPrintf("usage: 'zip_corrupt \"a.zip\" \"name_in_archive\"'\n");
+		LogPrintf("       'zip_corrupt --cd \"a.zip\" index [more indices...]'\n");
+		return 1;
+	}
+	char *szZipFile = argv[bCD ? 2 : 1];
+	C_ZipFile clZip;
+	if(!clZip.Open(szZipFile)) {
+		LogPrintf("error: could not open zip file (%s)\n", szZipFile);
+		return 1;
+	}
+	//all at once, the zip does not open after the first
+	for(int i=3; bCD && i<argc; i++) {
+		int iIdx = atoi(argv[i]);
+		if(iIdx < 0 || iIdx >= clZip.GetNumFiles()) {
+			LogPrintf("error: no entry %d\n", iIdx);
+			return 1;
+		}
+		if(BreakRecord(&clZip, szZipFile, iIdx) != 0) return 1;
+	}
+	if(bCD) return 0;
+	int iIdx = clZip.FindFileIndexInCD(argv[2]);
+	if(iIdx < 0 || clZip.GetEntry64(iIdx)->c_size == 0) {
+		LogPrintf("error: no data to corrupt (%s)\n", argv[2]);
+		return 1;
+	}
+	//the data follows the local header with its name and extra field
+	const S_Zip64Values *pValues = clZip.GetEntry64(iIdx);
+	uint8_t pHeader[sizeof(S_LocalFileHeader)];
+	S_LocalFileHeader stLocal;
+	if(!clZip.ReadLocalData(pValues->offset, pHeader, sizeof(pHeader))) {
+		LogPrintf("error: could not read local header\n");
+		return 1;
+	}
+	DecodeRecord(pHeader, &stLocal);
+	uint64_t iPos = pValues->offset + sizeof(S_LocalFileHeader) + stLocal.name_len + stLocal.extra_len + pValues->c_size/2;
+
+	FILE *pFile = fopen(szZipFile, "r+b");
+	int iByte = EOF;
+	if(pFile && fseek64(pFile, (int64_t)iPos, SEEK_SET) == 0) iByte = fgetc(pFile);
+	bool bOK = iByte != EOF && fseek64(pFile, (int64_t)iPos, SEEK_SET) == 0 && fputc(iByte ^ 0x55, pFile) != EOF;
+	if(pFile && fclose(pFile) != 0) bOK = false;
+	if(!bOK) {
+		LogPrintf("error: could not change %s\n", szZipFile);
+		return 1;
+	}
+	LogPrintf("flipped the byte at %llu (\"%s\")\n", (unsigned long long)iPos, argv[2]);
+	return 0;
+}
@@ -47,53 +47,212 @@
 // no known problems...?
 
 //2021 July 7, remove non standard dependencies by including file handling code here
+//v1.30:
+//any number of files can be given (also as a list file or on stdin), they are
+// all set on the same loaded zip which is then saved once.
 //#include "common.h"
 //#include "fileresource.h"
+#include "zip_exec.h"
 
 //////////////////////////////////////////////
-//file handling partly from fileresource.cpp and common.h
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+//file handling
 
-class C_Resource
+thread_local S_MessageLog *g_pMessageLog = NULL;
+
+int LogPrintf(const char *i_szFormat, ...)
 {
-public:
-	C_Resource();
-	~C_Resource();
+	va_list pArgs;
+	va_start(pArgs, i_szFormat);
+	int iLen;
+	if(g_pMessageLog == NULL) iLen = vprintf(i_szFormat, pArgs);
+	else {
+		va_list pArgsCopy;
+		va_copy(pArgsCopy, pArgs);
+		iLen = vsnprintf(NULL, 0, i_szFormat, pArgsCopy);
+		va_end(pArgsCopy);
+		S_MessageLog *pLog = g_pMessageLog;
+		if(iLen > 0 && pLog->iLength+iLen+1 > pLog->iCapacity) {
+			size_t iCapacity = pLog->iCapacity ? pLog->iCapacity : 256;
+			while(iCapacity < pLog->iLength+iLen+1) iCapacity *= 2;
+			char *pText = new char[iCapacity];
+			if(pLog->iLength) memcpy(pText, pLog->pText, pLog->iLength);
+			delete[] pLog->pText;
+			pLog->pText = pText;
+			pLog->iCapacity = iCapacity;
+		}
+		if(iLen > 0) {
+			vsnprintf(pLog->pText+pLog->iLength, iLen+1, i_szFormat, pArgs);
+			pLog->iLength += iLen;
+		}
+	}
+	va_end(pArgs);
+	return iLen;
+}
 
-	void SetMode(bool i_bReading); //default reading (resets filenames)
-	bool SetFilename(const char* i_szFilename);
+//////////////////////////////////////////////
+//statistics
 
-	bool   Read(void* i_pData, uint32_t i_iLength); //length==0xffffffff means entire resource
-	void   Seek(uint32_t i_iPos, int i_iMode);
-	uint32_t GetSize() { return m_iFileSize; };
+S_Stats g_stStats;
 
-	bool Write(void* i_pData, uint32_t i_iLength);
+static const char *g_szStatsPhases[STATS_NUM_PHASES] = {
+	"eocd_scan", "cd_read", "cd_parse", "name_index", "modify", "save_data", "append", "save_cd", "sync",
+	"stream", "create_scan", "create_write", "verify", "list", "diff", "extract" };
 
-private:
-	void Reset();
-	bool     m_bReading;
-	uint32_t m_iFileSize;
-	uint32_t m_iFileStart;
-	FILE* m_pFileHandle;
-};
+static uint64_t GetWallNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t GetCpuNs(bool i_bThread)
+{
+#ifdef _WIN32
+	FILETIME stCreation, stExit, stKernel, stUser;
+	BOOL bOK = i_bThread ? GetThreadTimes(GetCurrentThread(), &stCreation, &stExit, &stKernel, &stUser)
+		: GetProcessTimes(GetCurrentProcess(), &stCreation, &stExit, &stKernel, &stUser);
+	if(!bOK) return 0;
+	uint64_t iKernel = ((uint64_t)stKernel.dwHighDateTime << 32) | stKernel.dwLowDateTime;
+	uint64_t iUser = ((uint64_t)stUser.dwHighDateTime << 32) | stUser.dwLowDateTime;
+	return (iKernel+iUser)*100;
+#else
+	struct timespec stTime;
+	if(clock_gettime(i_bThread ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID, &stTime) != 0) return 0;
+	return (uint64_t)stTime.tv_sec*1000000000 + (uint64_t)stTime.tv_nsec;
+#endif
+}
+
+static uint64_t GetPeakResident()
+{
+#ifdef _WIN32
+	return 0; //would need psapi
+#else
+	struct rusage stUsage;
+	if(getrusage(RUSAGE_SELF, &stUsage) != 0) return 0;
+#ifdef __APPLE__
+	return (uint64_t)stUsage.ru_maxrss;
+#else
+	return (uint64_t)stUsage.ru_maxrss*1024;
+#endif
+#endif
+}
+
+static inline void CountRead(uint64_t i_iBytes)
+{
+	if(!g_stStats.bEnabled) return;
+	g_stStats.iReadCalls.fetch_add(1, std::memory_order_relaxed);
+	g_stStats.iBytesRead.fetch_add(i_iBytes, std::memory_order_relaxed);
+}
+
+static inline void CountWrite(uint64_t i_iBytes)
+{
+	if(!g_stStats.bEnabled) return;
+	g_stStats.iWriteCalls.fetch_add(1, std::memory_order_relaxed);
+	g_stStats.iBytesWritten.fetch_add(i_iBytes, std::memory_order_relaxed);
+}
+
+void EnableStats()
+{
+	g_stStats.bEnabled = true;
+	g_stStats.iStartNs = GetWallNs();
+}
+
+void C_StatsPhase::Start(E_StatsPhase i_ePhase)
+{
+	if(!g_stStats.bEnabled) return;
+	m_iPhase = i_ePhase;
+	m_iWallStart = GetWallNs();
+	m_iCpuStart = GetCpuNs(true);
+}
+
+void C_StatsPhase::End()
+{
+	if(m_iPhase < 0) return;
+	g_stStats.pWallNs[m_iPhase].fetch_add(GetWallNs()-m_iWallStart, std::memory_order_relaxed);
+	g_stStats.pCpuNs[m_iPhase].fetch_add(GetCpuNs(true)-m_iCpuStart, std::memory_order_relaxed);
+	g_stStats.pCount[m_iPhase].fetch_add(1, std::memory_order_relaxed);
+	m_iPhase = -1;
+}
+
+static void StatsPrintf(FILE *i_pFile, const char *i_szFormat, ...)
+{
+	char szLine[512];
+	va_list pArgs;
+	va_start(pArgs, i_szFormat);
+	vsnprintf(szLine, sizeof(szLine), i_szFormat, pArgs);
+	va_end(pArgs);
+	if(i_pFile) fputs(szLine, i_pFile);
+	else LogPrintf("%s", szLine);
+}
+
+void PrintStats(bool i_bJson, FILE *i_pFile)
+{
+	S_Stats *pStats = &g_stStats;
+	double fWall = (GetWallNs()-pStats->iStartNs)/1e6;
+	double fCpu = GetCpuNs(false)/1e6;
+	unsigned long long iPeakResident = GetPeakResident();
+	if(!i_bJson) {
+		StatsPrintf(i_pFile, "statistics:\n");
+		StatsPrintf(i_pFile, "  %-14s %8s %12s %12s\n", "phase", "count", "wall ms", "cpu ms");
+		for(int i=0; i<STATS_NUM_PHASES; i++) {
+			if(pStats->pCount[i] == 0) continue;
+			StatsPrintf(i_pFile, "  %-14s %8llu %12.3f %12.3f\n", g_szStatsPhases[i], (unsigned long long)pStats->pCount[i],
+				pStats->pWallNs[i]/1e6, pStats->pCpuNs[i]/1e6);
+		}
+		StatsPrintf(i_pFile, "  %-14s %8s %12.3f %12.3f\n", "total", "", fWall, fCpu);
+		StatsPrintf(i_pFile, "  read             %llu bytes in %llu calls\n", (unsigned long long)pStats->iBytesRead, (unsigned long long)pStats->iReadCalls);
+		StatsPrintf(i_pFile, "  written          %llu bytes in %llu calls\n", (unsigned long long)pStats->iBytesWritten, (unsigned long long)pStats->iWriteCalls);
+		StatsPrintf(i_pFile, "  seeks            %llu\n", (unsigned long long)pStats->iSeekCalls);
+		StatsPrintf(i_pFile, "  entries scanned  %llu\n", (unsigned long long)pStats->iEntriesScanned);
+		StatsPrintf(i_pFile, "  peak allocated   %lld bytes\n", (long long)pStats->iPeakAllocated);
+		StatsPrintf(i_pFile, "  peak resident    %llu bytes\n", iPeakResident);
+		return;
+	}
+	//one object, phases which did not run are left out
+	StatsPrintf(i_pFile, "{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"phases\":{", fWall, fCpu);
+	bool bFirst = true;
+	for(int i=0; i<STATS_NUM_PHASES; i++) {
+		if(pStats->pCount[i] == 0) continue;
+		StatsPrintf(i_pFile, "%s\"%s\":{\"count\":%llu,\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", bFirst ? "" : ",", g_szStatsPhases[i],
+			(unsigned long long)pStats->pCount[i], pStats->pWallNs[i]/1e6, pStats->pCpuNs[i]/1e6);
+		bFirst = false;
+	}
+	StatsPrintf(i_pFile, "},\"bytes_read\":%llu,\"read_calls\":%llu,\"bytes_written\":%llu,\"write_calls\":%llu,\"seek_calls\":%llu,",
+		(unsigned long long)pStats->iBytesRead, (unsigned long long)pStats->iReadCalls,
+		(unsigned long long)pStats->iBytesWritten, (unsigned long long)pStats->iWriteCalls, (unsigned long long)pStats->iSeekCalls);
+	StatsPrintf(i_pFile, "\"entries_scanned\":%llu,\"peak_allocated\":%lld,\"peak_resident\":%llu}\n",
+		(unsigned long long)pStats->iEntriesScanned, (long long)pStats->iPeakAllocated, iPeakResident);
+}
+
+//////////////////////////////////////////////
+//file resource
 
 C_Resource::C_Resource()
 {
 	m_bReading = true;
+	m_bUpdate = false;
 	m_pFileHandle = NULL;
+	m_bOwnHandle = true;
+	m_pMemory = NULL;
+	m_iMemoryPos = 0;
 	m_iFileSize = 0;
 	m_iFileStart = 0;
+	m_pPending = NULL;
+	m_iPendingPos = 0;
+	m_iPendingLength = 0;
 }
 
 void C_Resource::Reset()
 {
-	if (m_pFileHandle) fclose(m_pFileHandle);
+	if (m_pFileHandle && m_bOwnHandle) fclose(m_pFileHandle);
 	m_pFileHandle = NULL;
+	m_bOwnHandle = true;
+	m_pMemory = NULL;
+	m_iMemoryPos = 0;
 	m_iFileSize = 0;
 	m_iFileStart = 0;
+	delete[] m_pPending;
+	m_pPending = NULL;
+	m_iPendingPos = 0;
+	m_iPendingLength = 0;
 }
 
 C_Resource::~C_Resource()
@@ -101,9 +260,10 @@ C_Resource::~C_Resource()
 	Reset();
 }
 
-void C_Resource::SetMode(bool i_bReading)
+void C_Resource::SetMode(bool i_bReading, bool i_bUpdate)
 {
 	m_bReading = i_bReading;
+	m_bUpdate = i_bUpdate;
 	Reset();
 }
 
@@ -111,24 +271,136 @@ bool C_Resource::SetFilename(const char* i_szFilename)
 {
 	if (m_pFileHandle) Reset();
 
-	m_pFileHandle = fopen(i_szFilename, m_bReading ? "rb" : "wb");
+	m_pFileHandle = fopen(i_szFilename, m_bUpdate ? "r+b" : (m_bReading ? "rb" : "wb"));
 	if (m_pFileHandle == NULL) return false; //error opening
 
-	fseek(m_pFileHandle, 0, SEEK_END);
-	m_iFileSize = (uint32_t)ftell(m_pFileHandle); //we will never handle more than 4GB
-	fseek(m_pFileHandle, 0, SEEK_SET);
+	fseek64(m_pFileHandle, 0, SEEK_END);
+	m_iFileSize = (uint64_t)ftell64(m_pFileHandle);
+	fseek64(m_pFileHandle, 0, SEEK_SET);
 
 	return true;
 }
 
+bool C_Resource::SetTempFilename(const char* i_szNextTo, char* o_szName)
+{
+	//created exclusively, so a file or link already at the name is never followed or
+	// overwritten and runs at the same time each get their own file
+	static std::atomic<uint32_t> s_iCounter(0);
+	Reset();
+	for (int i = 0; i < 100; i++) {
+		uint32_t iCount = s_iCounter.fetch_add(1);
+#ifdef _WIN32
+		sprintf(o_szName, "%s.zip_exec.%lu.%u.tmp", i_szNextTo, (unsigned long)GetCurrentProcessId(), iCount);
+		int iFd = _open(o_szName, _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		sprintf(o_szName, "%s.zip_exec.%ld.%u.tmp", i_szNextTo, (long)getpid(), iCount);
+		int iFd = open(o_szName, O_CREAT | O_EXCL | O_WRONLY, 0666);
+#endif
+		if (iFd < 0) {
+			if (errno == EEXIST) continue; //left behind by an earlier run
+			break;
+		}
+#ifdef _WIN32
+		m_pFileHandle = _fdopen(iFd, "wb");
+		if (m_pFileHandle == NULL) _close(iFd);
+#else
+		m_pFileHandle = fdopen(iFd, "wb");
+		if (m_pFileHandle == NULL) close(iFd);
+#endif
+		if (m_pFileHandle == NULL) {
+			remove(o_szName);
+			break;
+		}
+		return true;
+	}
+	o_szName[0] = 0;
+	return false;
+}
+
+void C_Resource::SetHandle(FILE* i_pFileHandle)
+{
+	Reset();
+	m_pFileHandle = i_pFileHandle;
+	m_bOwnHandle = false;
+#ifdef _WIN32
+	_setmode(_fileno(i_pFileHandle), _O_BINARY);
+#endif
+}
+
+void C_Resource::SetMemory(const uint8_t* i_pData, uint64_t i_iLength, uint64_t i_iStart)
+{
+	Reset();
+	m_bReading = true;
+	m_bUpdate = false;
+	m_pMemory = i_pData;
+	m_iFileStart = i_iStart;
+	m_iFileSize = i_iStart + i_iLength;
+	m_iMemoryPos = 0;
+}
+
+void C_Resource::Unread(const void* i_pData, uint32_t i_iLength)
+{
+	//in front of what is still pending
+	if (i_iLength == 0) return;
+	uint32_t iLeft = m_iPendingLength - m_iPendingPos;
+	uint8_t* pPending = new uint8_t[i_iLength + iLeft];
+	memcpy(pPending, i_pData, i_iLength);
+	if (iLeft) memcpy(pPending + i_iLength, m_pPending + m_iPendingPos, iLeft);
+	delete[] m_pPending;
+	m_pPending = pPending;
+	m_iPendingPos = 0;
+	m_iPendingLength = i_iLength + iLeft;
+}
+
+uint32_t C_Resource::TakePending(void* o_pData, uint32_t i_iLength)
+{
+	//these were counted when first read
+	uint32_t iLeft = m_iPendingLength - m_iPendingPos;
+	uint32_t iTake = i_iLength < iLeft ? i_iLength : iLeft;
+	if (iTake) memcpy(o_pData, m_pPending + m_iPendingPos, iTake);
+	m_iPendingPos += iTake;
+	if (m_iPendingPos == m_iPendingLength) {
+		delete[] m_pPending;
+		m_pPending = NULL;
+		m_iPendingPos = m_iPendingLength = 0;
+	}
+	return iTake;
+}
+
+uint32_t C_Resource::ReadSome(void* i_pData, uint32_t i_iLength)
+{
+	if (m_pFileHandle && (m_bReading || m_bUpdate)) {
+		uint32_t iPending = m_pPending ? TakePending(i_pData, i_iLength) : 0;
+		uint32_t iRead = (uint32_t)fread((uint8_t*)i_pData + iPending, 1, i_iLength - iPending, m_pFileHandle);
+		CountRead(iRead);
+		return iPending + iRead;
+	}
+	return 0;
+}
+
 bool C_Resource::Read(void* i_pData, uint32_t i_iLength)
 {
 	bool bResult = false;
-	if (m_pFileHandle && m_bReading) {
+	if (m_pMemory) {
+		//m_iMemoryPos is relative to the resource, the data starts at m_iFileStart
+		if (i_iLength == 0xffffffff) i_iLength = (uint32_t)(m_iFileSize - m_iMemoryPos);
+		if (m_iMemoryPos >= m_iFileStart && m_iMemoryPos <= m_iFileSize && i_iLength <= m_iFileSize - m_iMemoryPos) {
+			memcpy(i_pData, m_pMemory + (m_iMemoryPos - m_iFileStart), i_iLength);
+			m_iMemoryPos += i_iLength;
+			bResult = true;
+		}
+	} else if (m_pFileHandle && (m_bReading || m_bUpdate)) {
 		if (i_iLength == 0) return true;
-		if (i_iLength == 0xffffffff) i_iLength = (m_iFileStart + m_iFileSize)
-			- (uint32_t)ftell(m_pFileHandle); //we will never handle more than 4GB
+		if (i_iLength == 0xffffffff) i_iLength = (uint32_t)((m_iFileStart + m_iFileSize)
+			- (uint64_t)ftell64(m_pFileHandle)); //a single read is never more than 4GB
+		if (m_pPending) {
+			uint32_t iPending = TakePending(i_pData, i_iLength);
+			i_pData = (uint8_t*)i_pData + iPending;
+			i_iLength -= iPending;
+			if (i_iLength == 0) return true;
+		}
 		if (fread(i_pData, i_iLength, 1, m_pFileHandle) == 1) bResult = true;
+		CountRead(bResult ? i_iLength : 0);
 	}
 	return bResult;
 }
@@ -136,113 +408,239 @@ bool C_Resource::Read(void* i_pData, uint32_t i_iLength)
 bool C_Resource::Write(void* i_pData, uint32_t i_iLength)
 {
 	bool bResult = false;
-	if (m_pFileHandle && !m_bReading) {
+	if (m_pFileHandle && (!m_bReading || m_bUpdate)) {
 		if (i_iLength == 0) return true;
 		if (fwrite(i_pData, i_iLength, 1, m_pFileHandle) == 1) bResult = true;
+		CountWrite(bResult ? i_iLength : 0);
 	}
 	return bResult;
 }
 
-void C_Resource::Seek(uint32_t i_iPos, int i_iMode)
+bool C_Resource::WriteGather(const S_WriteBuffer* i_pBuffers, int i_iNumBuffers)
 {
-	if (m_pFileHandle) {
-		switch (i_iMode) {
-		case SEEK_SET: fseek(m_pFileHandle, m_iFileStart + i_iPos, i_iMode); break;
-		case SEEK_CUR: fseek(m_pFileHandle, i_iPos, i_iMode); break;
-		case SEEK_END: fseek(m_pFileHandle, (m_iFileStart + m_iFileSize) - i_iPos, SEEK_SET); break;
+	if (!m_pFileHandle || (m_bReading && !m_bUpdate)) return false;
+#ifdef _WIN32
+	for (int i = 0; i < i_iNumBuffers; i++) {
+		if (!Write((void*)i_pBuffers[i].pData, i_pBuffers[i].iLength)) return false;
+	}
+	return true;
+#else
+	//writev on the descriptor, stdio is flushed before and repositioned after (unless it is a pipe)
+	if (fflush(m_pFileHandle) != 0) return false;
+	int iFd = fileno(m_pFileHandle);
+	int64_t iTell = (int64_t)ftell64(m_pFileHandle);
+	bool bSeekable = iTell >= 0;
+	uint64_t iPos = bSeekable ? (uint64_t)iTell : 0;
+	if (bSeekable && lseek(iFd, (off_t)iPos, SEEK_SET) == (off_t)-1) return false;
+
+	struct iovec stIov[64];
+	int iIdx = 0;
+	size_t iDone = 0; //of the buffer at iIdx
+	while (iIdx < i_iNumBuffers) {
+		int iNum = 0;
+		for (int i = iIdx; i < i_iNumBuffers && iNum < 64 && iNum < IOV_MAX; i++, iNum++) {
+			size_t iSkip = (i == iIdx) ? iDone : 0;
+			stIov[iNum].iov_base = (char*)i_pBuffers[i].pData + iSkip;
+			stIov[iNum].iov_len = i_pBuffers[i].iLength - iSkip;
 		}
+		ssize_t iWritten = writev(iFd, stIov, iNum);
+		if (iWritten < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		CountWrite((uint64_t)iWritten);
+		iPos += (uint64_t)iWritten;
+		//advance past what was written (a write may be partial)
+		size_t iLeft = (size_t)iWritten;
+		while (iIdx < i_iNumBuffers && iLeft >= i_pBuffers[iIdx].iLength - iDone) {
+			iLeft -= i_pBuffers[iIdx].iLength - iDone;
+			iIdx++;
+			iDone = 0;
+		}
+		iDone += iLeft;
 	}
+	return !bSeekable || fseek64(m_pFileHandle, (off_t)iPos, SEEK_SET) == 0;
+#endif
 }
-//////////////////////////////////////////////
-//zip handling
 
-#pragma pack(2)
-struct S_CentralDirectoryEntry
-{
-	uint32_t sign;        // 0  4 Central directory file header signature = 0x02014b50
-	uint16_t ver;         // 4  2 Version made by
-	uint16_t ver_needed;  // 6  2 Version needed to extract (minimum)
-	uint16_t gp_flag;     // 8  2 General purpose bit flag
-	uint16_t c_method;    //10  2 Compression method
-	uint16_t lm_time;     //12  2 File last modification time
-	uint16_t lm_date;     //14  2 File last modification date
-	uint32_t crc32;       //16  4 CRC-32
-	uint32_t c_size;      //20  4 Compressed size
-	uint32_t u_size;      //24  4 Uncompressed size
-	uint16_t name_len;    //28  2 File name length (n)
-	uint16_t extra_len;   //30  2 Extra field length (m)
-	uint16_t comment_len; //32  2 File comment length (k)
-	uint16_t dn_start;    //34  2 Disk number where file starts
-	uint16_t int_attr;    //36  2 Internal file attributes
-	uint32_t ext_attrib;  //38  4 External file attributes
-	uint32_t offset;      //42  4 Relative offset of local file header. This is the number of bytes between the start of the first disk on which the file occurs, and the start of the local file header. This allows software reading the central directory to locate the position of the file inside the ZIP file.
-	//46      n File name
-	//46+n    m Extra field
-	//46+n+m  k File comment
-};
+bool C_Resource::Sync()
+{
+	if (!m_pFileHandle) return false;
+	if (fflush(m_pFileHandle) != 0) return false;
+#ifdef _WIN32
+	return _commit(_fileno(m_pFileHandle)) == 0;
+#else
+	return fsync(fileno(m_pFileHandle)) == 0;
+#endif
+}
 
-struct S_CentralDirectoryEnd
-{
-	uint8_t  sign[4];     // 0  4 End of central directory signature = 0x06054b50
-	uint16_t num_discs;   // 4  2 Number of this disk
-	uint16_t cd_disc;     // 6  2 Disk where central directory starts
-	uint16_t cd_num;      // 8  2 Number of central directory records on this disk
-	uint16_t cd_tot_num;  //10  2 Total number of central directory records
-	uint32_t cd_size;     //12  4 Size of central directory (bytes)
-	uint32_t cd_start;    //16  4 Offset of start of central directory, relative to start of archive
-	uint16_t comment_len; //20  2 Comment length (n)
-	//22  n  Comment
-};
-#pragma pack()
+bool C_Resource::Truncate(uint64_t i_iSize)
+{
+	if (!m_pFileHandle) return false;
+	if (fflush(m_pFileHandle) != 0) return false;
+#ifdef _WIN32
+	if (_chsize_s(_fileno(m_pFileHandle), (int64_t)i_iSize) != 0) return false;
+#else
+	if (ftruncate(fileno(m_pFileHandle), (off_t)i_iSize) != 0) return false;
+#endif
+	m_iFileSize = i_iSize;
+	return true;
+}
 
-class C_ZipFile
+bool C_Resource::CopyFrom(C_Resource* i_pclSource, uint64_t i_iPos, uint64_t i_iLength)
 {
-public:
-	C_ZipFile();
-	~C_ZipFile();
+	if (!m_pFileHandle || (m_bReading && !m_bUpdate)) return false;
+#ifdef __linux__
+	//by the offsets, the position of the source is not used. a file system (or kernel)
+	// without it fails at once, the rest is then copied the next way
+	if (i_pclSource->m_pFileHandle && i_iLength > 0) {
+		if (fflush(m_pFileHandle) != 0) return false;
+		int64_t iTell = (int64_t)ftell64(m_pFileHandle);
+		if (iTell >= 0) {
+			int iInFd = fileno(i_pclSource->m_pFileHandle), iOutFd = fileno(m_pFileHandle);
+			loff_t iIn = (loff_t)(i_pclSource->m_iFileStart + i_iPos), iOut = (loff_t)iTell;
+			uint64_t iLeft = i_iLength;
+			//cloning needs both offsets and the length on block boundaries, the
+			// unaligned tail is copied
+			struct stat stStat;
+			uint64_t iBlock = fstat(iOutFd, &stStat) == 0 && stStat.st_blksize > 0 ? (uint64_t)stStat.st_blksize : 4096;
+			uint64_t iClone = iLeft - iLeft % iBlock;
+			if (iClone > 0 && (uint64_t)iIn % iBlock == 0 && (uint64_t)iOut % iBlock == 0) {
+				struct file_clone_range stRange;
+				stRange.src_fd = iInFd;
+				stRange.src_offset = (uint64_t)iIn;
+				stRange.src_length = iClone;
+				stRange.dest_offset = (uint64_t)iOut;
+				if (ioctl(iOutFd, FICLONERANGE, &stRange) == 0) {
+					CountRead(iClone);
+					CountWrite(iClone);
+					iIn += (loff_t)iClone;
+					iOut += (loff_t)iClone;
+					iLeft -= iClone;
+				}
+			}
+			while (iLeft > 0) {
+				ssize_t iCopied = copy_file_range(iInFd, &iIn, iOutFd, &iOut,
+					(size_t)(iLeft < (1u<<30) ? iLeft : (1u<<30)), 0);
+				if (iCopied < 0 && errno == EINTR) continue;
+				if (iCopied <= 0) break;
+				CountRead((uint64_t)iCopied);
+				CountWrite((uint64_t)iCopied);
+				iLeft -= (uint64_t)iCopied;
+			}
+			if (fseek64(m_pFileHandle, (int64_t)iOut, SEEK_SET) != 0) return false;
+			if (iLeft == 0) return true;
+			i_iPos += i_iLength - iLeft;
+			i_iLength = iLeft;
+		}
+	}
+#endif
+	const uint32_t iBufferSize = 1024*1024;
+	uint8_t* pBuffer = new uint8_t[iBufferSize];
+	bool bResult = true;
+	i_pclSource->Seek(i_iPos, SEEK_SET);
+	while (i_iLength > 0 && bResult) {
+		uint32_t iLength = i_iLength < iBufferSize ? (uint32_t)i_iLength : iBufferSize;
+		bResult = i_pclSource->Read(pBuffer, iLength) && Write(pBuffer, iLength);
+		i_iLength -= iLength;
+	}
+	delete[] pBuffer;
+	return bResult;
+}
 
-	bool Open(char *i_szZipFile);
-	bool Save(char *i_szZipFile);
+bool C_Resource::Rename(const char* i_szFrom, const char* i_szTo)
+{
+#ifdef _WIN32
+	return MoveFileExA(i_szFrom, i_szTo, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	//keep the permissions of the file that is replaced
+	struct stat stStat;
+	if (stat(i_szTo, &stStat) == 0) chmod(i_szFrom, stStat.st_mode & 07777);
+	return rename(i_szFrom, i_szTo) == 0;
+#endif
+}
 
-	bool IsDirectory(char *i_szFullFileName);
-	bool IsNormal(char *i_szFullFileName);
-	bool IsExecutable(char *i_szFullFileName);
+void C_Resource::SyncDirectoryOf(const char* i_szFilename)
+{
+#ifndef _WIN32
+	//make the rename itself durable
+	char szDir[4096];
+	const char* szSlash = strrchr(i_szFilename, '/');
+	if (szSlash == NULL) strcpy(szDir, ".");
+	else {
+		size_t iLen = szSlash == i_szFilename ? 1 : (size_t)(szSlash - i_szFilename);
+		if (iLen >= sizeof(szDir)) return;
+		memcpy(szDir, i_szFilename, iLen);
+		szDir[iLen] = 0;
+	}
+	int iFd = open(szDir, O_RDONLY);
+	if (iFd >= 0) {
+		fsync(iFd);
+		close(iFd);
+	}
+#endif
+}
 
-	bool SetDirectory(char *i_szFullFileName);
-	bool SetNormal(char *i_szFullFileName);
-	bool SetExecutable(char *i_szFullFileName);
+void C_Resource::Seek(uint64_t i_iPos, int i_iMode)
+{
+	if (m_pMemory) {
+		switch (i_iMode) {
+		case SEEK_SET: m_iMemoryPos = i_iPos; break;
+		case SEEK_CUR: m_iMemoryPos += i_iPos; break;
+		case SEEK_END: m_iMemoryPos = m_iFileSize - i_iPos; break;
+		}
+	} else if (m_pFileHandle) {
+		if (g_stStats.bEnabled) g_stStats.iSeekCalls.fetch_add(1, std::memory_order_relaxed);
+		switch (i_iMode) {
+		case SEEK_SET: fseek64(m_pFileHandle, (int64_t)(m_iFileStart + i_iPos), i_iMode); break;
+		case SEEK_CUR: fseek64(m_pFileHandle, (int64_t)i_iPos, i_iMode); break;
+		case SEEK_END: fseek64(m_pFileHandle, (int64_t)((m_iFileStart + m_iFileSize) - i_iPos), SEEK_SET); break;
+		}
+	}
+}
 
-	//helpers
-	static void SwapFromLittleEndian(void *i_pData, int i_iNumBytes);
-	static void SwapToLittleEndian(void *i_pData, int i_iNumBytes);
-private:
-	void Free();
-	int FindFileIndexInCD(char *i_szFile);
-
-	bool m_bOpenOK;
-
-	uint8_t *m_pZipMem;
-	//local copy of zip header data
-	S_CentralDirectoryEnd m_stCDEnd, m_stCDEndReadable;
-	char *m_szZipComment;
-	int m_iNumFiles;
-	S_CentralDirectoryEntry *m_pCDEntries, *m_pCDEntriesReadable;
-	char **m_szFilenames;
-	char **m_szExtra;
-	char **m_szComments;
-};
+//////////////////////////////////////////////
+//zip handling
 
 C_ZipFile::C_ZipFile()
 {
-	m_pCDEntriesReadable = NULL;
-	m_pCDEntries   = NULL;
-	m_pZipMem      = NULL;
+	m_pCDMem       = NULL;
+	m_pCD          = NULL;
+	m_iCDUsed      = 0;
+	m_pEntryPos    = NULL;
+	m_pVer         = NULL;
+	m_pVerNeeded   = NULL;
+	m_pExtAttrib   = NULL;
+	m_pAttribSet   = NULL;
+	m_pNames       = NULL;
+	m_pNameOffsets = NULL;
+	m_pNameLens    = NULL;
+	m_pclZipRes    = NULL;
+	m_szZipFileName = NULL;
+	m_iZipSize     = 0;
+	m_iCDEndPos    = 0;
+	m_bZip64       = false;
+	m_pZip64Extensible = NULL;
+	m_iCDStart     = 0;
+	m_iCDSize      = 0;
+	m_pCDEntries64 = NULL;
+	m_pNameIndex   = NULL;
+	m_pNameHashes  = NULL;
+	m_iNameIndexMask = 0;
 	m_iNumFiles    = 0;
 	m_szZipComment = NULL;
-	m_szFilenames  = NULL;
-	m_szExtra      = NULL;
-	m_szComments   = NULL;
 	m_bOpenOK      = false;
+	m_bSyncLocal   = false;
+	m_pLocalPatches = NULL;
+	m_iNumLocalPatches = 0;
+	m_iNumCDChanges = 0;
+	m_bSaveSkipped = false;
+	m_pclAdded     = NULL;
+	m_pReplacedBy  = NULL;
+	m_iAddLevel    = 9;
+	m_iAddThreads  = 0;
+	m_bCompact     = false;
+	m_iParseThreads = 0;
 }
 
 C_ZipFile::~C_ZipFile()
@@ -252,366 +650,5636 @@ C_ZipFile::~C_ZipFile()
 
 void C_ZipFile::Free()
 {
-	delete[] m_pCDEntriesReadable; m_pCDEntriesReadable = NULL;
-	delete[] m_pCDEntries;   m_pCDEntries   = NULL;
-	delete[] m_pZipMem;      m_pZipMem      = NULL;
+	delete[] m_pCDMem;       m_pCDMem       = NULL;
+	m_pCD = NULL;
+	m_iCDUsed = 0;
+	delete[] m_pEntryPos;    m_pEntryPos    = NULL;
+	delete[] m_pVer;         m_pVer         = NULL;
+	delete[] m_pVerNeeded;   m_pVerNeeded   = NULL;
+	delete[] m_pExtAttrib;   m_pExtAttrib   = NULL;
+	delete[] m_pAttribSet;   m_pAttribSet   = NULL;
+	delete[] m_pNames;       m_pNames       = NULL;
+	delete[] m_pNameOffsets; m_pNameOffsets = NULL;
+	delete[] m_pNameLens;    m_pNameLens    = NULL;
+	delete[] m_pCDEntries64; m_pCDEntries64 = NULL;
+	delete[] m_pNameIndex;   m_pNameIndex   = NULL;
+	delete[] m_pNameHashes;  m_pNameHashes  = NULL;
+	m_iNameIndexMask = 0;
+	delete[] m_pZip64Extensible; m_pZip64Extensible = NULL;
+	delete m_pclZipRes;      m_pclZipRes    = NULL;
+	delete[] m_szZipFileName; m_szZipFileName = NULL;
 	delete[] m_szZipComment; m_szZipComment = NULL;
-	for(int i=0; i<m_iNumFiles; i++) {
-		delete[] m_szFilenames[i];
-		delete[] m_szExtra[i];
-		delete[] m_szComments[i];
-	}
-	delete[] m_szFilenames;  m_szFilenames  = NULL;
-	delete[] m_szExtra;      m_szExtra      = NULL;
-	delete[] m_szComments;   m_szComments   = NULL;
+	delete[] m_pLocalPatches; m_pLocalPatches = NULL;
+	m_iNumLocalPatches = 0;
+	m_iNumCDChanges = 0;
+	m_bSaveSkipped = false;
+	FreeAdded();
 
 	m_iNumFiles = 0;
+	m_iZipSize = 0;
+	m_iCDEndPos = 0;
+	m_bZip64 = false;
+	m_iCDStart = 0;
+	m_iCDSize = 0;
 	m_bOpenOK = false;
 }
 
 bool C_ZipFile::Open(char *i_szZipFile)
 {
 	Free();
-	bool bResult = false;
 	C_Resource *pclRes = new C_Resource();
-	if(pclRes->SetFilename(i_szZipFile)) {
-		int iLen, iExtraOffset;
-		uint32_t iSize = pclRes->GetSize();
-		m_pZipMem = new uint8_t[iSize];
-		pclRes->Read(m_pZipMem, iSize); //read the entire file to memory
+	if(!pclRes->SetFilename(i_szZipFile)) {
+		delete pclRes;
+		return false;
+	}
+	return Open(pclRes, i_szZipFile);
+}
+
+bool C_ZipFile::OpenMemory(const uint8_t *i_pData, uint64_t i_iLength, uint64_t i_iStart)
+{
+	Free();
+	C_Resource *pclRes = new C_Resource();
+	pclRes->SetMemory(i_pData, i_iLength, i_iStart);
+	return Open(pclRes, "-");
+}
+
+bool C_ZipFile::Open(C_Resource *i_pclRes, const char *i_szName)
+{
+	Free();
+	bool bResult = false;
+	uint8_t *pTail = NULL;
+	C_Resource *pclRes = i_pclRes;
+	C_StatsPhase clPhase;
+	if(pclRes->IsOpen()) {
+		int iLen;
+		m_szZipFileName = new char[strlen(i_szName)+1];
+		strcpy(m_szZipFileName, i_szName);
+		uint64_t iSize = pclRes->GetSize();
+		uint64_t iAvailable = iSize - pclRes->GetDataStart();
+		m_iZipSize = iSize;
 
-		//scan for CD marker (50 4b 05 06)
+		if(iAvailable < sizeof(S_CentralDirectoryEnd)) {
+			LogPrintf("error: no central directory found in file\n");
+			goto out;
+		}
+
+		//only the tail of the file is read, the CD end record with its comment
+		// is always within the last 22+65535 bytes, the zip64 locator just before it
+		clPhase.Start(STATS_EOCD_SCAN);
+		uint32_t iTailSize = iAvailable < 20+22+0xffff ? (uint32_t)iAvailable : 20+22+0xffff;
+		uint64_t iTailStart = iSize - iTailSize;
+		pTail = new uint8_t[iTailSize];
+		pclRes->Seek(iTailSize, SEEK_END);
+		if(!pclRes->Read(pTail, iTailSize)) {
+			LogPrintf("error: could not read file\n");
+			goto out;
+		}
+
+		//scan for CD marker (50 4b 05 06), not further back than the maximum comment length
+		static const uint8_t iCDEndSign[4] = { 0x50, 0x4b, 0x05, 0x06 };
 		bool bFound = false;
-		int iPos = iSize-22;
-		while(iPos>0) {
-			if(m_pZipMem[iPos]==0x50 && m_pZipMem[iPos+1]==0x4b && m_pZipMem[iPos+2]==0x05 && m_pZipMem[iPos+3]==0x06) {
-				//marker found, copy it
-				memcpy(&m_stCDEnd,         m_pZipMem+iPos, sizeof(m_stCDEnd));
-				memcpy(&m_stCDEndReadable, m_pZipMem+iPos, sizeof(m_stCDEnd));
-				SwapFromLittleEndian(&m_stCDEndReadable.sign, 4);
-				SwapFromLittleEndian(&m_stCDEndReadable.num_discs, 2);
-				SwapFromLittleEndian(&m_stCDEndReadable.cd_disc, 2);
-				SwapFromLittleEndian(&m_stCDEndReadable.cd_num, 2);
-				SwapFromLittleEndian(&m_stCDEndReadable.cd_tot_num, 2);
-				SwapFromLittleEndian(&m_stCDEndReadable.cd_size, 4);
-				SwapFromLittleEndian(&m_stCDEndReadable.cd_start, 4);
-				SwapFromLittleEndian(&m_stCDEndReadable.comment_len, 2);
-				//validate that we are at the correct position
-				iLen = m_stCDEndReadable.comment_len;
-				if(iPos+22+iLen==iSize) {
-					m_szZipComment = new char[iLen+1];
-					memcpy(m_szZipComment, m_pZipMem+iPos+22, iLen);
-					m_szZipComment[iLen] = 0;
-					bFound = true;
-					break;
-				}
+		int iMinPos = iTailSize > 22+0xffff ? (int)iTailSize-(22+0xffff) : 0;
+		int iPos = (int)iTailSize-22;
+		while((iPos = FindSignatureReverse(pTail, iPos, iMinPos, iCDEndSign)) >= 0) {
+			//marker found, copy it
+			DecodeRecord(pTail+iPos, &m_stCDEnd);
+			//validate that we are at the correct position
+			iLen = m_stCDEnd.comment_len;
+			if(iPos+22+iLen==(int)iTailSize) {
+				m_szZipComment = new char[iLen+1];
+				memcpy(m_szZipComment, pTail+iPos+22, iLen);
+				m_szZipComment[iLen] = 0;
+				m_iCDEndPos = iTailStart+iPos;
+				bFound = true;
+				break;
 			}
 			iPos--;
 		}
 		if(!bFound) {
-			printf("error: no central directory found in file\n");
+			LogPrintf("error: no central directory found in file\n");
 			goto out;
 		}
 
-		//validate that we support this zip file
-		if(m_stCDEndReadable.num_discs != 0 || m_stCDEndReadable.cd_disc != 0
-			|| m_stCDEndReadable.cd_num != m_stCDEndReadable.cd_tot_num)
+		uint64_t iNumFiles = m_stCDEnd.cd_num;
+		uint64_t iCDLimit = m_iCDEndPos; //the CD ends before this
+		m_iCDStart = m_stCDEnd.cd_start;
+		m_iCDSize = m_stCDEnd.cd_size;
+
+		//zip64, the locator is right before the CD end record and points to the zip64 end record
+		if(iPos >= 20) {
+			S_Zip64CentralDirectoryLocator stLocator;
+			DecodeRecord(pTail+iPos-20, &stLocator);
+			if(stLocator.sign == 0x07064b50) {
+				if(stLocator.cd_end_disc != 0 || stLocator.num_discs > 1) {
+					LogPrintf("error: multiple volume files not supported\n");
+					goto out;
+				}
+				S_Zip64CentralDirectoryEnd *pEnd = &m_stZip64CDEndReadable;
+				if(stLocator.cd_end_start > m_iCDEndPos-20 || m_iCDEndPos-20-stLocator.cd_end_start < sizeof(*pEnd)) {
+					LogPrintf("error: zip64 end of central directory out of range\n");
+					goto out;
+				}
+				uint8_t pEndRecord[sizeof(*pEnd)];
+				pclRes->Seek(stLocator.cd_end_start, SEEK_SET);
+				if(!pclRes->Read(pEndRecord, sizeof(pEndRecord))) {
+					LogPrintf("error: could not read zip64 end of central directory\n");
+					goto out;
+				}
+				DecodeRecord(pEndRecord, pEnd);
+				//the record (with its extensible data) must end at the locator
+				if(pEnd->sign != 0x06064b50 || pEnd->rec_size < sizeof(*pEnd)-12
+					|| stLocator.cd_end_start+12+pEnd->rec_size != m_iCDEndPos-20)
+				{
+					LogPrintf("error: invalid zip64 end of central directory\n");
+					goto out;
+				}
+				if(pEnd->num_discs != 0 || pEnd->cd_disc != 0 || pEnd->cd_num != pEnd->cd_tot_num) {
+					LogPrintf("error: multiple volume files not supported\n");
+					goto out;
+				}
+				//keep the extensible data sector so it can be written back
+				uint32_t iExtLen = (uint32_t)(pEnd->rec_size-(sizeof(*pEnd)-12));
+				m_pZip64Extensible = new uint8_t[iExtLen+1];
+				if(!pclRes->Read(m_pZip64Extensible, iExtLen)) {
+					LogPrintf("error: could not read zip64 end of central directory\n");
+					goto out;
+				}
+				m_bZip64 = true;
+				iNumFiles = pEnd->cd_num;
+				m_iCDStart = pEnd->cd_start;
+				m_iCDSize = pEnd->cd_size;
+				iCDLimit = stLocator.cd_end_start;
+			}
+		}
+
+		//validate that we support this zip file (with zip64 the values may be 0xffff and are checked above)
+		if(!m_bZip64 && (m_stCDEnd.num_discs != 0 || m_stCDEnd.cd_disc != 0
+			|| m_stCDEnd.cd_num != m_stCDEnd.cd_tot_num))
 		{
-			printf("error: multiple volume files not supported\n");
+			LogPrintf("error: multiple volume files not supported\n");
+			goto out;
+		}
+		if(m_iCDStart > iCDLimit || m_iCDSize > iCDLimit-m_iCDStart) {
+			LogPrintf("error: central directory out of range\n");
 			goto out;
 		}
+		if(m_iCDSize >= 0xffffffff || iNumFiles > m_iCDSize/sizeof(S_CentralDirectoryEntry)) {
+			LogPrintf("error: invalid number of central directory entries\n");
+			goto out;
+		}
+
+		//get the CD, it is usually already within the tail (which is then kept), otherwise read only the CD
+		clPhase.Next(STATS_CD_READ);
+		uint32_t iCDSize = (uint32_t)m_iCDSize;
+		if(m_iCDStart >= iTailStart) {
+			m_pCDMem = pTail;
+			m_pCD = pTail + (m_iCDStart-iTailStart);
+			pTail = NULL;
+		} else {
+			m_pCDMem = new uint8_t[iCDSize];
+			m_pCD = m_pCDMem;
+			pclRes->Seek(m_iCDStart, SEEK_SET);
+			if(!pclRes->Read(m_pCD, iCDSize)) {
+				LogPrintf("error: could not read central directory\n");
+				goto out;
+			}
+		}
 
-		//read all CD entries
-		m_iNumFiles = m_stCDEndReadable.cd_num;
-		m_pCDEntries = new S_CentralDirectoryEntry[m_iNumFiles];
-		m_pCDEntriesReadable = new S_CentralDirectoryEntry[m_iNumFiles];
-		m_szFilenames = new char*[m_iNumFiles];
-		m_szExtra     = new char*[m_iNumFiles];
-		m_szComments  = new char*[m_iNumFiles];
-		iPos = m_stCDEndReadable.cd_start;
-		for(int i=0; i<m_iNumFiles; i++) {
-			memcpy(&m_pCDEntries[i],         m_pZipMem+iPos, sizeof(S_CentralDirectoryEntry));
-			memcpy(&m_pCDEntriesReadable[i], m_pZipMem+iPos, sizeof(S_CentralDirectoryEntry));
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].sign, 4);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].ver, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].ver_needed, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].gp_flag, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].c_method, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].lm_time, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].lm_date, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].crc32, 4);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].c_size, 4);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].u_size, 4);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].name_len, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].extra_len, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].comment_len, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].dn_start, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].int_attr, 2);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].ext_attrib, 4);
-			SwapFromLittleEndian(&m_pCDEntriesReadable[i].offset, 4);
-
-			//read filename, extra, comment
+		//index all CD entries, names are copied to one block (they are a part of the CD so
+		// that block never needs more than the CD size), everything else stays in the CD.
+		// the start of a record depends on the lengths in the one before it, so first only
+		// these are followed to find all records and name offsets, then the records are
+		// decoded in chunks, in parallel when there are many
+		clPhase.Next(STATS_CD_PARSE);
+		m_iNumFiles = (int)iNumFiles;
+		m_pEntryPos    = new uint32_t[m_iNumFiles];
+		m_pVer         = new uint16_t[m_iNumFiles];
+		m_pVerNeeded   = new uint16_t[m_iNumFiles];
+		m_pExtAttrib   = new uint32_t[m_iNumFiles];
+		m_pAttribSet   = new uint8_t[m_iNumFiles];
+		memset(m_pAttribSet, 0, m_iNumFiles);
+		m_pCDEntries64 = new S_Zip64Values[m_iNumFiles];
+		m_pNameOffsets = new uint32_t[m_iNumFiles];
+		m_pNameLens    = new uint16_t[m_iNumFiles];
+		m_pNames       = new char[iCDSize+m_iNumFiles+1];
+		m_pNameHashes  = new uint32_t[m_iNumFiles];
+		uint32_t iCDPos = 0, iNamePos = 0;
+		int iNumFound = 0;
+		while(iNumFound < m_iNumFiles) {
 			//46      n File name
-			iExtraOffset = 0;
-			iLen = m_pCDEntriesReadable[i].name_len;
-			m_szFilenames[i] = new char[iLen+1];
-			memcpy(m_szFilenames[i], m_pZipMem+iPos+46+iExtraOffset, iLen);
-			m_szFilenames[i][iLen] = 0;
-			iExtraOffset += iLen;
 			//46+n    m Extra field
-			iLen = m_pCDEntriesReadable[i].extra_len;
-			m_szExtra[i] = new char[iLen+1];
-			memcpy(m_szExtra[i], m_pZipMem+iPos+46+iExtraOffset, iLen);
-			m_szExtra[i][iLen] = 0; //may not be a string, but null terminate anyway
-			iExtraOffset += iLen;
 			//46+n+m  k File comment
-			iLen = m_pCDEntriesReadable[i].comment_len;
-			m_szComments[i] = new char[iLen+1];
-			memcpy(m_szComments[i], m_pZipMem+iPos+46+iExtraOffset, iLen);
-			m_szComments[i][iLen] = 0;
-			iExtraOffset += iLen;
-
-			iPos += sizeof(S_CentralDirectoryEntry) + iExtraOffset;
+			if(iCDSize-iCDPos < sizeof(S_CentralDirectoryEntry)) break;
+			const uint8_t *pRecord = m_pCD+iCDPos;
+			uint16_t iNameLen = LoadLittleEndian<uint16_t>(pRecord+28);
+			uint32_t iRecordSize = sizeof(S_CentralDirectoryEntry) + iNameLen
+				+ LoadLittleEndian<uint16_t>(pRecord+30) + LoadLittleEndian<uint16_t>(pRecord+32);
+			if(iCDSize-iCDPos < iRecordSize) break;
+			m_pEntryPos[iNumFound] = iCDPos;
+			m_pNameOffsets[iNumFound] = iNamePos;
+			m_pNameLens[iNumFound] = iNameLen;
+			iNamePos += iNameLen+1;
+			iCDPos += iRecordSize;
+			iNumFound++;
+		}
+		//the entries before a truncated record are decoded too, so the error reported is
+		// the one for the first entry in CD order
+		int iBad = DecodeEntriesParallel(iNumFound);
+		if(iBad >= 0) {
+			LogPrintf("error: invalid zip64 extra field (%s)\n", GetFileName(iBad));
+			goto out;
 		}
+		if(iNumFound < m_iNumFiles) {
+			LogPrintf("error: central directory is truncated\n");
+			goto out;
+		}
+		m_iCDUsed = iCDPos;
+		if(g_stStats.bEnabled) g_stStats.iEntriesScanned += m_iNumFiles;
 
+		clPhase.Next(STATS_NAME_INDEX);
+		BuildNameIndex();
+		clPhase.End();
+
+		//keep the file open, local data is only read when needed
+		m_pclZipRes = pclRes;
+		pclRes = NULL;
 		m_bOpenOK = true;
 		bResult = true;
 	}
 out:
+	delete[] pTail;
 	delete pclRes;
+	if(!bResult) Free();
 	return bResult;
 }
 
-bool C_ZipFile::Save(char *i_szZipFile)
+void C_ZipFile::GetEntry(int i_iIdx, S_CentralDirectoryEntry *o_pEntry)
 {
-	bool bResult = false;
-	if(!m_bOpenOK) return false;
-
-	C_Resource *pclFile = new C_Resource();
-	pclFile->SetMode(false);
-	if(pclFile->SetFilename(i_szZipFile)) {
-		bResult = pclFile->Write(m_pZipMem, m_stCDEndReadable.cd_start); //write all up until the CD (same as source)
-		//CD entries
-		for(int i=0; i<m_iNumFiles; i++) {
-			//set unix normal for all non executable files.
-			//this is needed for the mac 'finder' problem mentioned above...
-			//it seems it cannot handle windows attributes mixed with unix attributes
-			// in a zip correctly, so we need to change all files to unix attributes.
-			if(IsDirectory(m_szFilenames[i])) SetDirectory(m_szFilenames[i]);
-			else if(!IsExecutable(m_szFilenames[i])) SetNormal(m_szFilenames[i]);
-
-			if(bResult) bResult = pclFile->Write(&m_pCDEntries[i], sizeof(S_CentralDirectoryEntry));
-			if(bResult) bResult = pclFile->Write(m_szFilenames[i], m_pCDEntriesReadable[i].name_len);
-			if(bResult) bResult = pclFile->Write(m_szExtra[i], m_pCDEntriesReadable[i].extra_len);
-			if(bResult) bResult = pclFile->Write(m_szComments[i], m_pCDEntriesReadable[i].comment_len);
-			if(!bResult) break;
-		}
-		//CD end + zip comment
-		if(bResult) bResult = pclFile->Write(&m_stCDEnd, sizeof(m_stCDEnd));
-		if(bResult) bResult = pclFile->Write(m_szZipComment, m_stCDEndReadable.comment_len);
-	}
-	delete pclFile; //closes file
-
-	return bResult;
+	DecodeRecord(m_pCD+m_pEntryPos[i_iIdx], o_pEntry);
 }
 
-bool C_ZipFile::IsExecutable(char *i_szFullFileName)
+int C_ZipFile::DecodeEntries(int i_iFirst, int i_iEnd)
 {
-	int iIdx = FindFileIndexInCD(i_szFullFileName);
-	if(iIdx>=0) {
-		bool bIsExec = (m_pCDEntriesReadable[iIdx].ver&0xff00)==0x0300;
-		if(bIsExec) bIsExec = (m_pCDEntriesReadable[iIdx].ver_needed&0xff00)==0x0300;
-		if(bIsExec) bIsExec = (m_pCDEntriesReadable[iIdx].ext_attrib&0xffff0000)==0x81ed0000; //this should represent rwx r-x r-x?
-		return bIsExec;
+	//every entry only writes its own slots, the records and name offsets are known
+	S_CentralDirectoryEntry stEntry;
+	for(int i=i_iFirst; i<i_iEnd; i++) {
+		GetEntry(i, &stEntry);
+		m_pVer[i] = stEntry.ver;
+		m_pVerNeeded[i] = stEntry.ver_needed;
+		m_pExtAttrib[i] = stEntry.ext_attrib;
+		const uint8_t *pRecord = m_pCD+m_pEntryPos[i];
+		char *pName = m_pNames+m_pNameOffsets[i];
+		memcpy(pName, pRecord+46, stEntry.name_len);
+		pName[stEntry.name_len] = 0;
+		m_pNameHashes[i] = HashName(pName, stEntry.name_len);
+		if(!ReadZip64Extra(i, &stEntry, pRecord+46+stEntry.name_len)) return i;
 	}
-	return false;
+	return -1;
 }
 
-bool C_ZipFile::IsNormal(char *i_szFullFileName)
+bool C_ZipFile::ReadZip64Extra(int i_iIdx, S_CentralDirectoryEntry *i_pEntry, const uint8_t *i_pExtra)
 {
-	int iIdx = FindFileIndexInCD(i_szFullFileName);
-	if(iIdx>=0) {
-		bool bIsNorm = (m_pCDEntriesReadable[iIdx].ver&0xff00)==0x0300;
-		if(bIsNorm) bIsNorm = (m_pCDEntriesReadable[iIdx].ver_needed&0xff00)==0x0300;
-		if(bIsNorm) bIsNorm = ((m_pCDEntriesReadable[iIdx].ext_attrib&0xffff0000)!=0x41ed0000 && (m_pCDEntriesReadable[iIdx].ext_attrib&0xffff0000)!=0x81ed0000); //mac
-		if(!bIsNorm) bIsNorm = (m_pCDEntriesReadable[iIdx].ext_attrib&0x00000020)==0x00000020; //win
-		return bIsNorm;
-	}
-	return false;
-}
+	S_CentralDirectoryEntry *pEntry = i_pEntry;
+	S_Zip64Values *pValues = &m_pCDEntries64[i_iIdx];
+	pValues->u_size = pEntry->u_size;
+	pValues->c_size = pEntry->c_size;
+	pValues->offset = pEntry->offset;
 
-bool C_ZipFile::IsDirectory(char *i_szFullFileName)
-{
-	int iIdx = FindFileIndexInCD(i_szFullFileName);
-	if(iIdx>=0) {
-		bool bIsDir = i_szFullFileName[strlen(i_szFullFileName)-1] == '/'; //test that should cover all different flags
-		//but in case it does not
-		if(!bIsDir) bIsDir = (m_pCDEntriesReadable[iIdx].ext_attrib&0x00000010)==0x00000010; //win
-		if(!bIsDir) bIsDir = (m_pCDEntriesReadable[iIdx].ext_attrib&0xffff0000)==0x41ed0000; //mac
-		return bIsDir;
+	//the extra field is a list of (id, size, data) blocks, the zip64 block (0x0001)
+	// contains the values that are 0xffffffff in the entry, in this order
+	const uint8_t *pExtra = i_pExtra;
+	int iPos = 0;
+	while(iPos+4 <= pEntry->extra_len) {
+		uint16_t iId  = LoadLittleEndian<uint16_t>(pExtra+iPos);
+		uint16_t iLen = LoadLittleEndian<uint16_t>(pExtra+iPos+2);
+		iPos += 4;
+		if(iPos+iLen > pEntry->extra_len) break; //not well formed, leave it as it is
+		if(iId == 0x0001) {
+			uint64_t *pValue[3] = { &pValues->u_size, &pValues->c_size, &pValues->offset };
+			int iField = 0;
+			for(int j=0; j<3; j++) {
+				if(*pValue[j] != 0xffffffff) continue;
+				if(iField+8 > iLen) return false;
+				*pValue[j] = LoadLittleEndian<uint64_t>(pExtra+iPos+iField);
+				iField += 8;
+			}
+			break;
+		}
+		iPos += iLen;
 	}
-	return false;
+	return true;
 }
 
-bool C_ZipFile::SetExecutable(char *i_szFullFileName)
+bool C_ZipFile::ReadLocalData(uint64_t i_iPos, void *o_pData, uint32_t i_iLength)
 {
-	int iIdx = FindFileIndexInCD(i_szFullFileName);
-	if(iIdx>=0) {
-		m_pCDEntriesReadable[iIdx].ver &= 0x00ff; //keep lower byte
-		m_pCDEntriesReadable[iIdx].ver |= 0x0300; //set unix
-		m_pCDEntries[iIdx].ver = m_pCDEntriesReadable[iIdx].ver;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ver, 2);
-		m_pCDEntriesReadable[iIdx].ver_needed &= 0x00ff; //keep lower byte
-		m_pCDEntriesReadable[iIdx].ver_needed |= 0x0300; //set unix
-		m_pCDEntries[iIdx].ver_needed = m_pCDEntriesReadable[iIdx].ver_needed;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ver_needed, 2);
-
-//		m_pCDEntriesReadable[iIdx].ext_attrib = 0x81ed4000; //this should represent rwx r-x r-x?
-//		^from zip file packed with mac finder. if unpacked with windows explorer all files are displayed with green, indicating encrypted files.
-//		the bit 0x00004000 should not be there according to tests i done, still have no spec
-		m_pCDEntriesReadable[iIdx].ext_attrib = 0x81ed0020; //this should represent rwx r-x r-x for both unix and windows?
-		m_pCDEntries[iIdx].ext_attrib = m_pCDEntriesReadable[iIdx].ext_attrib;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ext_attrib, 4);
-		return true;
-	}
-	return false;
+	if(!m_bOpenOK || i_iPos > m_iZipSize || i_iLength > m_iZipSize-i_iPos) return false;
+	m_pclZipRes->Seek(i_iPos, SEEK_SET);
+	return m_pclZipRes->Read(o_pData, i_iLength);
 }
 
-bool C_ZipFile::SetNormal(char *i_szFullFileName)
+bool C_ZipFile::Save(char *i_szZipFile)
 {
-	int iIdx = FindFileIndexInCD(i_szFullFileName);
-	if(iIdx>=0) {
-		m_pCDEntriesReadable[iIdx].ver &= 0x00ff; //keep lower byte
-		m_pCDEntriesReadable[iIdx].ver |= 0x0300; //set unix
-		m_pCDEntries[iIdx].ver = m_pCDEntriesReadable[iIdx].ver;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ver, 2);
-		m_pCDEntriesReadable[iIdx].ver_needed &= 0x00ff; //keep lower byte
-		m_pCDEntriesReadable[iIdx].ver_needed |= 0x0300; //set unix
-		m_pCDEntries[iIdx].ver_needed = m_pCDEntriesReadable[iIdx].ver_needed;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ver_needed, 2);
-
-//		m_pCDEntriesReadable[iIdx].ext_attrib = 0x81a44000; //this should represent rw- r-- r--?
-//		^from zip file packed with mac finder. if unpacked with windows explorer all files are displayed with green, indicating encrypted files.
-//		the bit 0x00004000 should not be there according to tests i done, still have no spec
-		m_pCDEntriesReadable[iIdx].ext_attrib = 0x81a40020; //this should represent rw- r-- r-- for both unix and windows?
-		m_pCDEntries[iIdx].ext_attrib = m_pCDEntriesReadable[iIdx].ext_attrib;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ext_attrib, 4);
-		return true;
-	}
-	return false;
-}
+	bool bResult = false;
+	if(!m_bOpenOK) return false;
 
-bool C_ZipFile::SetDirectory(char *i_szFullFileName)
-{
-	int iIdx = FindFileIndexInCD(i_szFullFileName);
-	if(iIdx>=0) {
-		m_pCDEntriesReadable[iIdx].ver &= 0x00ff; //keep lower byte
-		m_pCDEntriesReadable[iIdx].ver |= 0x0300; //set unix
-		m_pCDEntries[iIdx].ver = m_pCDEntriesReadable[iIdx].ver;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ver, 2);
-		m_pCDEntriesReadable[iIdx].ver_needed &= 0x00ff; //keep lower byte
-		m_pCDEntriesReadable[iIdx].ver_needed |= 0x0300; //set unix
-		m_pCDEntries[iIdx].ver_needed = m_pCDEntriesReadable[iIdx].ver_needed;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ver_needed, 2);
-
-//		m_pCDEntriesReadable[iIdx].ext_attrib = 0x41ed4000; //this should represent drw- r-- r--?
-//		^from zip file packed with mac finder. if unpacked with windows explorer all files are displayed with green, indicating encrypted files.
-//		the bit 0x00004000 should not be there according to tests i done, still have no spec
-		m_pCDEntriesReadable[iIdx].ext_attrib = 0x41ed0010; //this should represent drw- r-- r-- for both unix and windows?
-		m_pCDEntries[iIdx].ext_attrib = m_pCDEntriesReadable[iIdx].ext_attrib;
-		SwapToLittleEndian(&m_pCDEntries[iIdx].ext_attrib, 4);
+	//the zip is written to a temporary file next to the target which then replaces
+	// it, so the target is never left half written. this also allows saving over
+	// the file that was opened, the local data is read from it while writing.
+	m_bSaveSkipped = false;
+	if(m_bSyncLocal && !BuildLocalPatches()) return false;
+	//the records which are kept, NULL when nothing would be left out
+	S_Extent *pExtents = NULL;
+	int iNumExtents = 0;
+	if(m_bCompact && !BuildExtents(&pExtents, &iNumExtents)) return false;
+	bool bSameFile = IsSameFile(m_szZipFileName, i_szZipFile);
+	if(bSameFile && pExtents == NULL && IsFileUnchanged()) {
+		m_bSaveSkipped = true;
 		return true;
 	}
-	return false;
-}
+	char *szTempFile = new char[strlen(i_szZipFile)+C_Resource::TEMP_NAME_EXTRA];
 
-int C_ZipFile::FindFileIndexInCD(char *i_szFile)
-{
-	if(m_bOpenOK) {
-		for(int i=0; i<m_iNumFiles; i++) {
-			if(strcmp(m_szFilenames[i], i_szFile) ==0) return i;
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_SAVE_DATA);
+	C_Resource *pclFile = new C_Resource();
+	pclFile->SetMode(false);
+	if(pclFile->SetTempFilename(i_szZipFile, szTempFile)) {
+		//write all up until the CD (same as source), or when compacting the data
+		// before the first record and the kept records one after the other
+		uint8_t *pChunk = new uint8_t[1024*1024];
+		uint64_t iPos = m_iCDStart;
+		int iNextPatch = 0;
+		if(pExtents) {
+			bResult = CopyLocalData(pclFile, 0, pExtents[0].iPos, pChunk, &iNextPatch);
+			iPos = pExtents[0].iPos;
+			for(int i=0; i<iNumExtents && bResult; i++) {
+				bResult = CopyLocalData(pclFile, pExtents[i].iPos, pExtents[i].iEnd, pChunk, &iNextPatch);
+				SetEntryOffset(pExtents[i].iIdx, iPos);
+				iPos += pExtents[i].iEnd-pExtents[i].iPos;
+			}
+			LogPrintf("compacted, %llu bytes of local data left out\n", (unsigned long long)(m_iCDStart-iPos));
+		} else {
+			bResult = CopyLocalData(pclFile, 0, m_iCDStart, pChunk, &iNextPatch);
 		}
+		delete[] pChunk;
+		//the added files after that, then the CD with them
+		clPhase.Next(STATS_APPEND);
+		if(bResult && m_pclAdded) bResult = WriteAdded(pclFile, &iPos);
+		clPhase.Next(STATS_SAVE_CD);
+		uint64_t iEnd;
+		if(bResult) bResult = m_pclAdded ? WriteMergedCD(pclFile, iPos, &iEnd) : WriteCD(pclFile, iPos);
+		clPhase.Next(STATS_SYNC);
+		if(bResult) bResult = pclFile->Sync();
 	}
-	return -1;
-}
+	delete pclFile; //closes file
 
-void C_ZipFile::SwapToLittleEndian(void *i_pData, int i_iNumBytes)
-{
-	//do nothing on intel (therefore commented)
-	/*uint8_t *dst = (uint8_t *)i_pData;
-	uint8_t bytes[4];
-	memcpy(bytes, i_pData, i_iNumBytes);
-	switch(i_iNumBytes) {
-		case 4:
-			*dst++ = bytes[0]; *dst++ = bytes[1]; *dst++ = bytes[2]; *dst++ = bytes[3];
-			break;
-		case 2:
-			*dst++ = bytes[0]; *dst++ = bytes[1];
-			break;
-	}*/
-}
+	if(bResult) {
+		//the opened file must be closed before it can be replaced on windows
+		if(bSameFile) m_pclZipRes->SetMode(true);
+		bResult = C_Resource::Rename(szTempFile, i_szZipFile);
+		if(bResult) C_Resource::SyncDirectoryOf(i_szZipFile);
+		//the local data is unchanged, so the saved file can be used for it from now on
+		if(bSameFile) m_pclZipRes->SetFilename(bResult ? i_szZipFile : m_szZipFileName);
+	}
+	if(!bResult && szTempFile[0]) remove(szTempFile);
+	delete[] szTempFile;
+	//the zip is opened again when its layout changed, so it is the one saved
+	if(bResult && (m_pclAdded || pExtents)) bResult = Open(i_szZipFile);
+	delete[] pExtents;
 
-void C_ZipFile::SwapFromLittleEndian(void *i_pData, int i_iNumBytes)
-{
-	//do nothing on intel (therefore commented)
-	/*uint8_t *dst = (uint8_t *)i_pData;
-	uint8_t bytes[4];
-	memcpy(bytes, i_pData, i_iNumBytes);
-	switch(i_iNumBytes) {
-		case 4:
-			*dst++ = bytes[3]; *dst++ = bytes[2]; *dst++ = bytes[1]; *dst++ = bytes[0];
-			break;
-		case 2:
-			*dst++ = bytes[1]; *dst++ = bytes[0];
-			break;
-	}*/
+	return bResult;
 }
 
-/////////////
-
-bool FixZipFlags(char *i_szZipFile, char *i_szNewZipFile, char *i_szFileToFix)
+bool C_ZipFile::SaveInPlace(char *i_szZipFile)
 {
-	bool bResult = false; //assume error
+	bool bResult = false;
+	m_bSaveSkipped = false;
+	if(!m_bOpenOK) return false;
 
-	C_ZipFile *pclZip = new C_ZipFile();
-	//open zip
-	if(pclZip->Open(i_szZipFile)) {
-		//change the given file to unix executable, other files and directories will
-		// be set to unix attributes as well.
-		if(!pclZip->SetExecutable(i_szFileToFix)) {
-			printf("error: could not set \"%s\" executable\n", i_szFileToFix);
+	//the attribute changes never change the size of any record, so everything up
+	// until the CD is byte identical and the CD keeps its size. only the CD region
+	// needs to be overwritten. added files and the new CD are appended after the
+	// end of the zip instead, so the old CD stays intact until the new end record
+	// is on disk (it is left as unused data, which --compact drops).
+	if(m_bSyncLocal && !BuildLocalPatches()) return false;
+	if(IsSameFile(m_szZipFileName, i_szZipFile) && IsFileUnchanged()) {
+		m_bSaveSkipped = true;
+		return true;
+	}
+	uint64_t iPos = m_iZipSize, iEnd = 0;
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_SAVE_DATA);
+	C_Resource *pclFile = new C_Resource();
+	pclFile->SetMode(false, true);
+	if(pclFile->SetFilename(i_szZipFile)) {
+		//make sure it is still the same file that was opened
+		uint8_t pCDEndRecord[sizeof(S_CentralDirectoryEnd)];
+		S_CentralDirectoryEnd stCDEnd;
+		if(pclFile->GetSize() != m_iZipSize) {
+			LogPrintf("error: %s changed size since it was opened\n", i_szZipFile);
+			goto out;
+		}
+		pclFile->Seek(m_iCDEndPos, SEEK_SET);
+		if(!pclFile->Read(pCDEndRecord, sizeof(pCDEndRecord))) {
+			LogPrintf("error: could not read end of central directory\n");
+			goto out;
+		}
+		DecodeRecord(pCDEndRecord, &stCDEnd);
+		if(memcmp(&stCDEnd, &m_stCDEnd, sizeof(stCDEnd)) != 0) {
+			LogPrintf("error: end of central directory of %s changed since it was opened\n", i_szZipFile);
+			goto out;
+		}
+		//and that the CD will be written with exactly the same size (unless it is
+		// appended with the added files)
+		if(!m_pclAdded && GetCDWriteSize() != m_iZipSize-m_iCDStart) {
+			LogPrintf("error: central directory would change size (%llu bytes instead of %llu), can not save in place\n",
+				(unsigned long long)GetCDWriteSize(), (unsigned long long)(m_iZipSize-m_iCDStart));
 			goto out;
 		}
 
-		//save changed zip
-		if(!pclZip->Save(i_szNewZipFile)) {
-			printf("error: could not save output zip file (%s)\n", i_szNewZipFile);
-			goto out;
+		//the local headers to sync, in one forward pass
+		for(int i=0; i<m_iNumLocalPatches; i++) {
+			uint8_t pValue[2];
+			StoreLittleEndian(pValue, m_pLocalPatches[i].iValue);
+			pclFile->Seek(m_pLocalPatches[i].iPos, SEEK_SET);
+			if(!pclFile->Write(pValue, 2)) goto out;
+		}
+
+		if(m_pclAdded) {
+			pclFile->Seek(m_iZipSize, SEEK_SET);
+			clPhase.Next(STATS_APPEND);
+			bResult = WriteAdded(pclFile, &iPos);
+			clPhase.Next(STATS_SAVE_CD);
+			if(bResult) bResult = WriteMergedCD(pclFile, iPos, &iEnd);
+			//the zip as it was
+			if(!bResult) pclFile->Truncate(m_iZipSize);
+		} else {
+			pclFile->Seek(m_iCDStart, SEEK_SET);
+			clPhase.Next(STATS_SAVE_CD);
+			bResult = WriteCD(pclFile, m_iCDStart);
+		}
+		clPhase.Next(STATS_SYNC);
+		if(bResult) bResult = pclFile->Sync();
+	}
+out:
+	delete pclFile; //closes file
+	if(bResult && m_pclAdded) bResult = Open(i_szZipFile);
+
+	return bResult;
+}
+
+int C_ZipFile::ComparePatches(const void *i_pA, const void *i_pB)
+{
+	const S_LocalPatch *pA = (const S_LocalPatch *)i_pA;
+	const S_LocalPatch *pB = (const S_LocalPatch *)i_pB;
+	return pA->iPos < pB->iPos ? -1 : (pA->iPos > pB->iPos ? 1 : 0);
+}
+
+bool C_ZipFile::BuildLocalPatches()
+{
+	NormalizeAttributes(); //the values WriteCD will write
+	delete[] m_pLocalPatches;
+	m_pLocalPatches = new S_LocalPatch[m_iNumFiles > 0 ? m_iNumFiles : 1];
+	m_iNumLocalPatches = 0;
+	for(int i=0; i<m_iNumFiles; i++) {
+		m_pLocalPatches[i].iPos = m_pCDEntries64[i].offset;
+		m_pLocalPatches[i].iIdx = i;
+	}
+	qsort(m_pLocalPatches, m_iNumFiles, sizeof(S_LocalPatch), ComparePatches);
+
+	//the headers are read in file order through a window, so headers close
+	// together take one read. only the ones which differ are kept.
+	const uint32_t iWindowSize = 64*1024;
+	uint8_t *pWindow = new uint8_t[iWindowSize];
+	uint64_t iWindowPos = 0;
+	uint32_t iWindowLen = 0;
+	int iNumMissing = 0;
+	bool bResult = true;
+	for(int i=0; i<m_iNumFiles; i++) {
+		S_LocalPatch stPatch = m_pLocalPatches[i];
+		if(stPatch.iPos > m_iCDStart || m_iCDStart-stPatch.iPos < sizeof(S_LocalFileHeader)) {
+			iNumMissing++;
+			continue;
+		}
+		if(stPatch.iPos < iWindowPos || stPatch.iPos+sizeof(S_LocalFileHeader) > iWindowPos+iWindowLen) {
+			iWindowPos = stPatch.iPos;
+			iWindowLen = m_iCDStart-iWindowPos < iWindowSize ? (uint32_t)(m_iCDStart-iWindowPos) : iWindowSize;
+			if(!ReadLocalData(iWindowPos, pWindow, iWindowLen)) {
+				LogPrintf("error: could not read local header (%s)\n", GetFileName(stPatch.iIdx));
+				bResult = false;
+				break;
+			}
+		}
+		S_LocalFileHeader stLocal;
+		DecodeRecord(pWindow+(stPatch.iPos-iWindowPos), &stLocal);
+		if(stLocal.sign != 0x04034b50) {
+			iNumMissing++;
+			continue;
+		}
+		if(stLocal.ver_needed == m_pVerNeeded[stPatch.iIdx]) continue;
+		stPatch.iPos += offsetof(S_LocalFileHeader, ver_needed);
+		stPatch.iValue = m_pVerNeeded[stPatch.iIdx];
+		m_pLocalPatches[m_iNumLocalPatches++] = stPatch;
+	}
+	delete[] pWindow;
+	if(!bResult) {
+		m_iNumLocalPatches = 0;
+		return false;
+	}
+	if(iNumMissing) LogPrintf("warning: %d entries without a local header, not synced\n", iNumMissing);
+	LogPrintf("synced version needed of %d local headers\n", m_iNumLocalPatches);
+	return true;
+}
+
+int C_ZipFile::CompareExtents(const void *i_pA, const void *i_pB)
+{
+	const S_Extent *pA = (const S_Extent *)i_pA;
+	const S_Extent *pB = (const S_Extent *)i_pB;
+	return pA->iPos < pB->iPos ? -1 : (pA->iPos > pB->iPos ? 1 : 0);
+}
+
+bool C_ZipFile::BuildExtents(S_Extent **o_pExtents, int *o_iNumExtents)
+{
+	//the local record of every entry which is kept (not replaced by an added file),
+	// from the local header (name and extra field can differ from the CD) to the
+	// end of the data and the data descriptor. the rest is left out.
+	*o_pExtents = NULL;
+	*o_iNumExtents = 0;
+	S_Extent *pExtents = new S_Extent[m_iNumFiles > 0 ? m_iNumFiles : 1];
+	int iNum = 0;
+	for(int i=0; i<m_iNumFiles; i++) {
+		if(m_pReplacedBy && m_pReplacedBy[i] >= 0) continue;
+		pExtents[iNum].iPos = m_pCDEntries64[i].offset;
+		pExtents[iNum++].iIdx = i;
+	}
+	qsort(pExtents, iNum, sizeof(S_Extent), CompareExtents);
+
+	bool bResult = true;
+	uint64_t iKept = 0;
+	for(int i=0; i<iNum && bResult; i++) {
+		S_Extent *pExtent = &pExtents[i];
+		const char *szName = GetFileName(pExtent->iIdx);
+		uint8_t pHeader[sizeof(S_LocalFileHeader)];
+		S_LocalFileHeader stLocal;
+		bResult = pExtent->iPos < m_iCDStart && m_iCDStart-pExtent->iPos >= sizeof(pHeader) && ReadLocalData(pExtent->iPos, pHeader, sizeof(pHeader));
+		if(bResult) {
+			DecodeRecord(pHeader, &stLocal);
+			bResult = stLocal.sign == 0x04034b50;
+		}
+		if(!bResult) {
+			LogPrintf("error: no local header, can not compact (%s)\n", szName);
+			break;
+		}
+		uint64_t iExtraPos = pExtent->iPos+sizeof(pHeader)+stLocal.name_len;
+		uint64_t iEnd = iExtraPos+stLocal.extra_len+m_pCDEntries64[pExtent->iIdx].c_size;
+		if(stLocal.gp_flag & 0x0008) {
+			//data descriptor, crc and sizes (8 bytes each with a local zip64 extra field),
+			// optionally after a signature
+			bool bZip64 = false;
+			uint8_t *pExtra = new uint8_t[stLocal.extra_len+1];
+			if(ReadLocalData(iExtraPos, pExtra, stLocal.extra_len)) {
+				for(int iPos = 0; iPos+4 <= stLocal.extra_len; iPos += 4+LoadLittleEndian<uint16_t>(pExtra+iPos+2)) {
+					if(LoadLittleEndian<uint16_t>(pExtra+iPos) == 0x0001) bZip64 = true;
+				}
+			}
+			delete[] pExtra;
+			uint8_t pSign[4];
+			uint32_t iLen = bZip64 ? 20 : 12;
+			if(iEnd+4 <= m_iCDStart && ReadLocalData(iEnd, pSign, 4) && LoadLittleEndian<uint32_t>(pSign) == 0x08074b50) iLen += 4;
+			iEnd += iLen;
+		}
+		if(iEnd > m_iCDStart || (i+1 < iNum && iEnd > pExtents[i+1].iPos)) {
+			LogPrintf("error: local records overlap, can not compact (%s)\n", szName);
+			bResult = false;
+			break;
+		}
+		pExtent->iEnd = iEnd;
+		iKept += iEnd-pExtent->iPos;
+	}
+	if(bResult && iNum > 0 && pExtents[0].iPos+iKept < m_iCDStart) {
+		*o_pExtents = pExtents;
+		*o_iNumExtents = iNum;
+		return true;
+	}
+	delete[] pExtents;
+	if(bResult) LogPrintf("nothing to compact\n");
+	return bResult;
+}
+
+void C_ZipFile::SetEntryOffset(int i_iIdx, uint64_t i_iOffset)
+{
+	if(m_pCDEntries64[i_iIdx].offset == i_iOffset) return;
+	//records only move forward, an offset in the record stays there and one in the
+	// zip64 extra field (after the sizes which are in it) stays there
+	uint8_t *pRecord = m_pCD+m_pEntryPos[i_iIdx];
+	S_CentralDirectoryEntry stEntry;
+	DecodeRecord(pRecord, &stEntry);
+	if(stEntry.offset != 0xffffffff) {
+		StoreLittleEndian<uint32_t>(pRecord+offsetof(S_CentralDirectoryEntry, offset), (uint32_t)i_iOffset);
+	} else {
+		uint8_t *pExtra = pRecord+sizeof(S_CentralDirectoryEntry)+stEntry.name_len;
+		for(int iPos = 0; iPos+4 <= stEntry.extra_len; iPos += 4+LoadLittleEndian<uint16_t>(pExtra+iPos+2)) {
+			if(LoadLittleEndian<uint16_t>(pExtra+iPos) != 0x0001) continue;
+			int iField = (stEntry.u_size == 0xffffffff ? 8 : 0) + (stEntry.c_size == 0xffffffff ? 8 : 0);
+			StoreLittleEndian<uint64_t>(pExtra+iPos+4+iField, i_iOffset);
+			break;
+		}
+	}
+	m_pCDEntries64[i_iIdx].offset = i_iOffset;
+	m_iNumCDChanges++;
+}
+
+bool C_ZipFile::CopyLocalData(C_Resource *i_pclFile, uint64_t i_iFrom, uint64_t i_iTo, uint8_t *i_pChunk, int *io_iNextPatch)
+{
+	//up to the next local header to sync the data is copied file to file (shared
+	// blocks or in the kernel, see C_Resource::CopyFrom). near one it goes through
+	// memory in chunks of 1MB, the headers are edited in the chunks on the way
+	const uint32_t iChunkSize = 1024*1024;
+	for(uint64_t iPos = i_iFrom; iPos < i_iTo; ) {
+		uint64_t iPatch = *io_iNextPatch < m_iNumLocalPatches ? m_pLocalPatches[*io_iNextPatch].iPos : i_iTo;
+		if(iPatch > iPos && iPatch-iPos >= iChunkSize) {
+			uint64_t iEnd = iPatch < i_iTo ? iPatch : i_iTo;
+			if(!i_pclFile->CopyFrom(m_pclZipRes, iPos, iEnd-iPos)) return false;
+			iPos = iEnd;
+			continue;
+		}
+		uint32_t iLen = iChunkSize;
+		if(i_iTo-iPos < iLen) iLen = (uint32_t)(i_iTo-iPos);
+		if(!ReadLocalData(iPos, i_pChunk, iLen)) return false;
+		ApplyLocalPatches(i_pChunk, iPos, iLen, io_iNextPatch);
+		if(!i_pclFile->Write(i_pChunk, iLen)) return false;
+		iPos += iLen;
+	}
+	return true;
+}
+
+void C_ZipFile::ApplyLocalPatches(uint8_t *io_pData, uint64_t i_iPos, uint32_t i_iLength, int *io_iNext)
+{
+	//the patches are sorted, those before the end of this part are applied (a
+	// field can be split over two parts, so byte by byte)
+	int iNext = *io_iNext;
+	uint64_t iEnd = i_iPos+i_iLength;
+	for(; iNext<m_iNumLocalPatches && m_pLocalPatches[iNext].iPos < iEnd; iNext++) {
+		uint8_t pValue[2];
+		StoreLittleEndian(pValue, m_pLocalPatches[iNext].iValue);
+		for(int j=0; j<2; j++) {
+			uint64_t iPos = m_pLocalPatches[iNext].iPos+j;
+			if(iPos >= i_iPos && iPos < iEnd) io_pData[iPos-i_iPos] = pValue[j];
+		}
+		if(m_pLocalPatches[iNext].iPos+2 > iEnd) break; //the rest in the next part
+	}
+	*io_iNext = iNext;
+}
+
+void C_ZipFile::NormalizeAttributes()
+{
+	for(int i=0; i<m_iNumFiles; i++) {
+		if(m_pAttribSet[i]) continue;
+		//set unix normal for all non executable files.
+		//this is needed for the mac 'finder' problem mentioned above...
+		//it seems it cannot handle windows attributes mixed with unix attributes
+		// in a zip correctly, so we need to change all files to unix attributes.
+		if(IsDirectory(i)) SetDirectory(i);
+		else if(!IsExecutable(i)) SetNormal(i);
+	}
+}
+
+uint64_t C_ZipFile::GetCDWriteSize()
+{
+	//size of everything WriteCD writes
+	uint64_t iCDSize = m_iCDUsed;
+	bool bZip64 = m_bZip64 || m_iNumFiles >= 0xffff || iCDSize >= 0xffffffff || m_iCDStart >= 0xffffffff;
+	if(bZip64) iCDSize += sizeof(S_Zip64CentralDirectoryEnd) + (m_bZip64 ? m_stZip64CDEndReadable.rec_size-(sizeof(S_Zip64CentralDirectoryEnd)-12) : 0)
+		+ sizeof(S_Zip64CentralDirectoryLocator);
+	return iCDSize + sizeof(S_CentralDirectoryEnd) + m_stCDEnd.comment_len;
+}
+
+bool C_ZipFile::IsFileUnchanged()
+{
+	//the CD records are the ones read unless a value was changed, the end records
+	// are built again and compared with the file
+	NormalizeAttributes();
+	if(m_iNumCDChanges || m_iNumLocalPatches || m_pclAdded) return false;
+	if(GetCDWriteSize() != m_iZipSize-m_iCDStart) return false;
+
+	S_WriteBuffer stBuffers[6];
+	S_EndRecords stRecords;
+	int iNumBuffers = BuildCDBuffers(stBuffers, &stRecords, m_pCD, m_iCDUsed, m_iNumFiles, m_iCDStart);
+	uint32_t iEndLen = (uint32_t)(m_iZipSize-m_iCDStart-m_iCDUsed);
+	uint8_t *pEnd = new uint8_t[iEndLen+1];
+	bool bResult = ReadLocalData(m_iCDStart+m_iCDUsed, pEnd, iEndLen);
+	uint32_t iPos = 0;
+	for(int i=1; i<iNumBuffers && bResult; i++) {
+		bResult = memcmp(pEnd+iPos, stBuffers[i].pData, stBuffers[i].iLength) == 0;
+		iPos += stBuffers[i].iLength;
+	}
+	delete[] pEnd;
+	return bResult;
+}
+
+void C_ZipFile::GetCDDigest(uint8_t o_pDigest[32])
+{
+	NormalizeAttributes();
+	S_WriteBuffer stBuffers[6];
+	S_EndRecords stRecords;
+	int iNumBuffers = BuildCDBuffers(stBuffers, &stRecords, m_pCD, m_iCDUsed, m_iNumFiles, m_iCDStart);
+	Sha256(stBuffers, iNumBuffers, o_pDigest);
+}
+
+bool C_ZipFile::WriteCD(C_Resource *i_pclFile, uint64_t i_iCDStart)
+{
+	NormalizeAttributes();
+	S_WriteBuffer stBuffers[6];
+	S_EndRecords stRecords;
+	int iNumBuffers = BuildCDBuffers(stBuffers, &stRecords, m_pCD, m_iCDUsed, m_iNumFiles, i_iCDStart);
+	return i_pclFile->WriteGather(stBuffers, iNumBuffers);
+}
+
+int C_ZipFile::BuildCDBuffers(S_WriteBuffer *o_pBuffers, S_EndRecords *o_pRecords, const uint8_t *i_pCD, uint32_t i_iCDSize, uint64_t i_iNumFiles, uint64_t i_iCDStart)
+{
+	//the buffers of everything WriteCD writes, in one gathered write:
+	//CD entries (they are all edited in place so it is one block), zip64 end
+	// record + extensible data + locator, CD end + zip comment
+	int iNumBuffers = 0;
+	uint64_t iCDSize = i_iCDSize;
+	o_pBuffers[iNumBuffers].pData = i_pCD; o_pBuffers[iNumBuffers++].iLength = i_iCDSize;
+
+	//zip64 end record + locator when the values do not fit in the CD end record
+	// (or when the source zip had them, to keep the layout)
+	bool bZip64 = m_bZip64 || i_iNumFiles >= 0xffff || iCDSize >= 0xffffffff || i_iCDStart >= 0xffffffff;
+	uint8_t *pEnd64Record = o_pRecords->pEnd64;
+	uint8_t *pLocatorRecord = o_pRecords->pLocator;
+	if(bZip64) {
+		S_Zip64CentralDirectoryEnd stEnd64;
+		uint32_t iExtLen = m_bZip64 ? (uint32_t)(m_stZip64CDEndReadable.rec_size-(sizeof(stEnd64)-12)) : 0;
+		stEnd64.sign       = 0x06064b50;
+		stEnd64.rec_size   = sizeof(stEnd64)-12 + iExtLen;
+		stEnd64.ver        = m_bZip64 ? m_stZip64CDEndReadable.ver : 45;
+		stEnd64.ver_needed = m_bZip64 ? m_stZip64CDEndReadable.ver_needed : 45;
+		stEnd64.num_discs  = 0;
+		stEnd64.cd_disc    = 0;
+		stEnd64.cd_num     = i_iNumFiles;
+		stEnd64.cd_tot_num = i_iNumFiles;
+		stEnd64.cd_size    = iCDSize;
+		stEnd64.cd_start   = i_iCDStart;
+		EncodeRecord(&stEnd64, pEnd64Record);
+		o_pBuffers[iNumBuffers].pData = pEnd64Record;       o_pBuffers[iNumBuffers++].iLength = sizeof(o_pRecords->pEnd64);
+		o_pBuffers[iNumBuffers].pData = m_pZip64Extensible; o_pBuffers[iNumBuffers++].iLength = iExtLen;
+
+		S_Zip64CentralDirectoryLocator stLocator;
+		stLocator.sign         = 0x07064b50;
+		stLocator.cd_end_disc  = 0;
+		stLocator.cd_end_start = i_iCDStart + iCDSize;
+		stLocator.num_discs    = 1;
+		EncodeRecord(&stLocator, pLocatorRecord);
+		o_pBuffers[iNumBuffers].pData = pLocatorRecord;     o_pBuffers[iNumBuffers++].iLength = sizeof(o_pRecords->pLocator);
+	}
+
+	//CD end + zip comment, values that do not fit are set to 0xffff(ffff) and are in the zip64 record
+	S_CentralDirectoryEnd stCDEnd;
+	stCDEnd.sign        = 0x06054b50;
+	stCDEnd.num_discs   = 0;
+	stCDEnd.cd_disc     = 0;
+	stCDEnd.cd_num      = i_iNumFiles >= 0xffff ? 0xffff : (uint16_t)i_iNumFiles;
+	stCDEnd.cd_tot_num  = stCDEnd.cd_num;
+	stCDEnd.cd_size     = iCDSize >= 0xffffffff ? 0xffffffff : (uint32_t)iCDSize;
+	stCDEnd.cd_start    = i_iCDStart >= 0xffffffff ? 0xffffffff : (uint32_t)i_iCDStart;
+	stCDEnd.comment_len = m_stCDEnd.comment_len;
+	EncodeRecord(&stCDEnd, o_pRecords->pCDEnd);
+	o_pBuffers[iNumBuffers].pData = o_pRecords->pCDEnd; o_pBuffers[iNumBuffers++].iLength = sizeof(o_pRecords->pCDEnd);
+	o_pBuffers[iNumBuffers].pData = m_szZipComment;     o_pBuffers[iNumBuffers++].iLength = m_stCDEnd.comment_len;
+	return iNumBuffers;
+}
+
+bool C_ZipFile::IsExecutable(char *i_szFullFileName)
+{
+	return IsExecutable(FindFileIndexInCD(i_szFullFileName));
+}
+
+bool C_ZipFile::IsExecutable(int i_iIdx)
+{
+	if(i_iIdx>=0 && i_iIdx<m_iNumFiles) {
+		bool bIsExec = (m_pVer[i_iIdx]&0xff00)==0x0300;
+		if(bIsExec) bIsExec = (m_pVerNeeded[i_iIdx]&0xff00)==0x0300;
+		if(bIsExec) bIsExec = (m_pExtAttrib[i_iIdx]&0xffff0000)==0x81ed0000; //this should represent rwx r-x r-x?
+		return bIsExec;
+	}
+	return false;
+}
+
+bool C_ZipFile::IsNormal(char *i_szFullFileName)
+{
+	return IsNormal(FindFileIndexInCD(i_szFullFileName));
+}
+
+bool C_ZipFile::IsNormal(int i_iIdx)
+{
+	if(i_iIdx>=0 && i_iIdx<m_iNumFiles) {
+		bool bIsNorm = (m_pVer[i_iIdx]&0xff00)==0x0300;
+		if(bIsNorm) bIsNorm = (m_pVerNeeded[i_iIdx]&0xff00)==0x0300;
+		if(bIsNorm) bIsNorm = ((m_pExtAttrib[i_iIdx]&0xffff0000)!=0x41ed0000 && (m_pExtAttrib[i_iIdx]&0xffff0000)!=0x81ed0000); //mac
+		if(!bIsNorm) bIsNorm = (m_pExtAttrib[i_iIdx]&0x00000020)==0x00000020; //win
+		return bIsNorm;
+	}
+	return false;
+}
+
+bool C_ZipFile::IsDirectory(char *i_szFullFileName)
+{
+	return IsDirectory(FindFileIndexInCD(i_szFullFileName));
+}
+
+bool C_ZipFile::IsDirectory(int i_iIdx)
+{
+	if(i_iIdx>=0 && i_iIdx<m_iNumFiles) {
+		bool bIsDir = m_pNameLens[i_iIdx]>0 && GetFileName(i_iIdx)[m_pNameLens[i_iIdx]-1] == '/'; //test that should cover all different flags
+		//but in case it does not
+		if(!bIsDir) bIsDir = (m_pExtAttrib[i_iIdx]&0x00000010)==0x00000010; //win
+		if(!bIsDir) bIsDir = (m_pExtAttrib[i_iIdx]&0xffff0000)==0x41ed0000; //mac
+		return bIsDir;
+	}
+	return false;
+}
+
+void C_ZipFile::SetUnixAttributes(int i_iIdx, uint32_t i_iExtAttrib)
+{
+	uint16_t iVer = m_pVer[i_iIdx], iVerNeeded = m_pVerNeeded[i_iIdx];
+	uint32_t iExtAttrib = m_pExtAttrib[i_iIdx];
+	m_pVer[i_iIdx] &= 0x00ff; //keep lower byte
+	m_pVer[i_iIdx] |= 0x0300; //set unix
+	m_pVerNeeded[i_iIdx] &= 0x00ff; //keep lower byte
+	m_pVerNeeded[i_iIdx] |= 0x0300; //set unix
+	m_pExtAttrib[i_iIdx] = i_iExtAttrib;
+	m_pAttribSet[i_iIdx] = 1;
+	//setting what an entry already has does not change the CD
+	if(iVer == m_pVer[i_iIdx] && iVerNeeded == m_pVerNeeded[i_iIdx] && iExtAttrib == i_iExtAttrib) return;
+	m_iNumCDChanges++;
+
+	//and in the CD record
+	uint8_t *pRecord = m_pCD+m_pEntryPos[i_iIdx];
+	StoreLittleEndian(pRecord+offsetof(S_CentralDirectoryEntry, ver),        m_pVer[i_iIdx]);
+	StoreLittleEndian(pRecord+offsetof(S_CentralDirectoryEntry, ver_needed), m_pVerNeeded[i_iIdx]);
+	StoreLittleEndian(pRecord+offsetof(S_CentralDirectoryEntry, ext_attrib), m_pExtAttrib[i_iIdx]);
+}
+
+bool C_ZipFile::SetExecutable(char *i_szFullFileName)
+{
+	return SetExecutable(FindFileIndexInCD(i_szFullFileName));
+}
+
+bool C_ZipFile::SetExecutable(int i_iIdx)
+{
+	if(i_iIdx>=0 && i_iIdx<m_iNumFiles) {
+//		m_pExtAttrib[i_iIdx] = 0x81ed4000; //this should represent rwx r-x r-x?
+//		^from zip file packed with mac finder. if unpacked with windows explorer all files are displayed with green, indicating encrypted files.
+//		the bit 0x00004000 should not be there according to tests i done, still have no spec
+		SetUnixAttributes(i_iIdx, 0x81ed0020); //this should represent rwx r-x r-x for both unix and windows?
+		return true;
+	}
+	return false;
+}
+
+bool C_ZipFile::SetNormal(char *i_szFullFileName)
+{
+	return SetNormal(FindFileIndexInCD(i_szFullFileName));
+}
+
+bool C_ZipFile::SetNormal(int i_iIdx)
+{
+	if(i_iIdx>=0 && i_iIdx<m_iNumFiles) {
+//		m_pExtAttrib[i_iIdx] = 0x81a44000; //this should represent rw- r-- r--?
+//		^from zip file packed with mac finder. if unpacked with windows explorer all files are displayed with green, indicating encrypted files.
+//		the bit 0x00004000 should not be there according to tests i done, still have no spec
+		SetUnixAttributes(i_iIdx, 0x81a40020); //this should represent rw- r-- r-- for both unix and windows?
+		return true;
+	}
+	return false;
+}
+
+bool C_ZipFile::SetDirectory(char *i_szFullFileName)
+{
+	return SetDirectory(FindFileIndexInCD(i_szFullFileName));
+}
+
+bool C_ZipFile::SetDirectory(int i_iIdx)
+{
+	if(i_iIdx>=0 && i_iIdx<m_iNumFiles) {
+//		m_pExtAttrib[i_iIdx] = 0x41ed4000; //this should represent drw- r-- r--?
+//		^from zip file packed with mac finder. if unpacked with windows explorer all files are displayed with green, indicating encrypted files.
+//		the bit 0x00004000 should not be there according to tests i done, still have no spec
+		SetUnixAttributes(i_iIdx, 0x41ed0010); //this should represent drw- r-- r-- for both unix and windows?
+		return true;
+	}
+	return false;
+}
+
+bool C_ZipFile::SetUnixMode(int i_iIdx, uint32_t i_iMode)
+{
+	if(i_iIdx>=0 && i_iIdx<m_iNumFiles && i_iMode<=07777) {
+		SetUnixAttributes(i_iIdx, MakeUnixAttributes(i_iMode, IsDirectory(i_iIdx)));
+		return true;
+	}
+	return false;
+}
+
+uint32_t C_ZipFile::MakeUnixAttributes(uint32_t i_iMode, bool i_bDirectory)
+{
+	//unix type and mode in the upper 2 bytes, the same windows flags as above
+	// in the lower, read only if there is no owner write
+	uint32_t iExtAttrib = i_bDirectory ? ((0040000|i_iMode)<<16) | 0x10 : ((0100000|i_iMode)<<16) | 0x20;
+	if(!(i_iMode&0200)) iExtAttrib |= 0x01;
+	return iExtAttrib;
+}
+
+uint32_t C_ZipFile::HashName(const char *i_szName, int i_iLen)
+{
+	//FNV-1a
+	uint32_t iHash = 2166136261u;
+	for(int i=0; i<i_iLen; i++) {
+		iHash ^= (uint8_t)i_szName[i];
+		iHash *= 16777619u;
+	}
+	return iHash;
+}
+
+void C_ZipFile::BuildNameIndex()
+{
+	//table size is a power of two with at most 50% load
+	uint32_t iSize = 16;
+	while(iSize < (uint32_t)m_iNumFiles*2) iSize *= 2;
+	m_iNameIndexMask = iSize-1;
+	m_pNameIndex = new int[iSize];
+	memset(m_pNameIndex, 0, iSize*sizeof(int));
+
+	//the hashes are already made while decoding, inserting in CD order keeps the first
+	// of duplicate names
+	for(int i=0; i<m_iNumFiles; i++) {
+		uint32_t iHash = m_pNameHashes[i];
+		uint32_t iSlot = iHash & m_iNameIndexMask;
+		while(m_pNameIndex[iSlot]) {
+			//duplicate names, the first entry is found (as with the linear search)
+			int iOther = m_pNameIndex[iSlot]-1;
+			if(m_pNameHashes[iOther]==iHash && strcmp(GetFileName(iOther), GetFileName(i))==0) break;
+			iSlot = (iSlot+1) & m_iNameIndexMask;
+		}
+		if(!m_pNameIndex[iSlot]) m_pNameIndex[iSlot] = i+1;
+	}
+}
+
+int C_ZipFile::FindFileIndexInCD(const char *i_szFile)
+{
+	return FindFileIndexInCD(i_szFile, HashName(i_szFile, (int)strlen(i_szFile)));
+}
+
+int C_ZipFile::FindFileIndexInCD(const char *i_szFile, uint32_t i_iHash)
+{
+	if(m_bOpenOK) {
+		uint32_t iHash = i_iHash;
+		uint32_t iSlot = iHash & m_iNameIndexMask;
+		while(m_pNameIndex[iSlot]) {
+			int iIdx = m_pNameIndex[iSlot]-1;
+			if(m_pNameHashes[iIdx]==iHash && strcmp(GetFileName(iIdx), i_szFile)==0) return iIdx;
+			iSlot = (iSlot+1) & m_iNameIndexMask;
+		}
+	}
+	return -1;
+}
+
+int C_ZipFile::FindSignatureReverse(const uint8_t *i_pData, int i_iFrom, int i_iTo, const uint8_t *i_pSign)
+{
+	//returns the highest position in [i_iTo, i_iFrom] where the 4 byte signature starts, or -1.
+	// i_pData must be readable up to i_iFrom+3.
+	int iPos = i_iFrom;
+#ifdef ZIP_EXEC_SSE2
+	//16 positions at a time, each of the 4 signature bytes compared at its offset
+	const __m128i v0 = _mm_set1_epi8((char)i_pSign[0]);
+	const __m128i v1 = _mm_set1_epi8((char)i_pSign[1]);
+	const __m128i v2 = _mm_set1_epi8((char)i_pSign[2]);
+	const __m128i v3 = _mm_set1_epi8((char)i_pSign[3]);
+	while(iPos-15 >= i_iTo) {
+		const uint8_t *p = i_pData+iPos-15;
+		__m128i vMatch = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), v0);
+		vMatch = _mm_and_si128(vMatch, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+1)), v1));
+		vMatch = _mm_and_si128(vMatch, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+2)), v2));
+		vMatch = _mm_and_si128(vMatch, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+3)), v3));
+		int iMask = _mm_movemask_epi8(vMatch);
+		if(iMask) {
+			int iBit = 15;
+			while(!(iMask & (1<<iBit))) iBit--;
+			return iPos-15+iBit;
+		}
+		iPos -= 16;
+	}
+#endif
+	//one 32 bit compare per position
+	uint32_t iSign;
+	memcpy(&iSign, i_pSign, 4);
+	for(; iPos >= i_iTo; iPos--) {
+		uint32_t iWord;
+		memcpy(&iWord, i_pData+iPos, 4);
+		if(iWord == iSign) return iPos;
+	}
+	return -1;
+}
+
+bool C_ZipFile::IsSameFile(const char *i_szFile1, const char *i_szFile2)
+{
+	if(strcmp(i_szFile1, i_szFile2)==0) return true;
+#ifdef _WIN32
+	char szFull1[_MAX_PATH], szFull2[_MAX_PATH];
+	if(_fullpath(szFull1, i_szFile1, _MAX_PATH)==NULL || _fullpath(szFull2, i_szFile2, _MAX_PATH)==NULL) return false;
+	return _stricmp(szFull1, szFull2)==0;
+#else
+	struct stat stStat1, stStat2;
+	if(stat(i_szFile1, &stStat1)!=0 || stat(i_szFile2, &stStat2)!=0) return false;
+	return stStat1.st_dev==stStat2.st_dev && stStat1.st_ino==stStat2.st_ino;
+#endif
+}
+
+//////////////////////////////////////////////
+//crc-32 as used in zip (reflected, polynomial 0xedb88320)
+//slicing-by-8 (8 bytes per step with 8 tables), and when the cpu has carry-less
+// multiply (pclmulqdq), folding of 64 bytes per step for the bulk of the data.
+
+struct S_CrcTable
+{
+	uint32_t pTable[8][256];
+	bool bPclmul;
+	S_CrcTable()
+	{
+		for(uint32_t i=0; i<256; i++) {
+			uint32_t iCrc = i;
+			for(int j=0; j<8; j++) iCrc = (iCrc & 1) ? (iCrc >> 1) ^ 0xedb88320 : iCrc >> 1;
+			pTable[0][i] = iCrc;
+		}
+		//table k is the crc of a byte followed by k zero bytes
+		for(uint32_t i=0; i<256; i++) {
+			for(int k=1; k<8; k++) pTable[k][i] = (pTable[k-1][i] >> 8) ^ pTable[0][pTable[k-1][i] & 0xff];
+		}
+		bPclmul = false;
+#ifdef ZIP_EXEC_PCLMUL
+		//cpuid 1, ecx: bit 1 pclmulqdq, bit 19 sse4.1
+#ifdef _MSC_VER
+		int pInfo[4];
+		__cpuid(pInfo, 1);
+		bPclmul = (pInfo[2] & (1<<1)) && (pInfo[2] & (1<<19));
+#else
+		unsigned int iEax, iEbx, iEcx, iEdx;
+		if(__get_cpuid(1, &iEax, &iEbx, &iEcx, &iEdx)) bPclmul = (iEcx & (1<<1)) && (iEcx & (1<<19));
+#endif
+#endif
+	}
+};
+static const S_CrcTable g_stCrcTable;
+
+static uint32_t Crc32Slice8(uint32_t i_iCrc, const uint8_t *i_pData, size_t i_iLength)
+{
+	//i_iCrc is the inverted state
+	const uint32_t (*pTable)[256] = g_stCrcTable.pTable;
+	uint32_t iCrc = i_iCrc;
+	for(; i_iLength >= 8; i_iLength -= 8, i_pData += 8) {
+		uint32_t iLow = iCrc ^ LoadLittleEndian<uint32_t>(i_pData);
+		uint32_t iHigh = LoadLittleEndian<uint32_t>(i_pData+4);
+		iCrc = pTable[7][iLow & 0xff] ^ pTable[6][(iLow >> 8) & 0xff] ^ pTable[5][(iLow >> 16) & 0xff] ^ pTable[4][iLow >> 24]
+			^ pTable[3][iHigh & 0xff] ^ pTable[2][(iHigh >> 8) & 0xff] ^ pTable[1][(iHigh >> 16) & 0xff] ^ pTable[0][iHigh >> 24];
+	}
+	for(; i_iLength; i_iLength--) iCrc = pTable[0][(iCrc ^ *i_pData++) & 0xff] ^ (iCrc >> 8);
+	return iCrc;
+}
+
+#ifdef ZIP_EXEC_PCLMUL
+//folding with carry-less multiply (intel, "fast crc computation for generic
+// polynomials using pclmulqdq"), constants for the reflected zip polynomial.
+//i_iLength is at least 64 and a multiple of 16, i_iCrc is the inverted state.
+ZIP_EXEC_PCLMUL_TARGET static uint32_t Crc32Pclmul(uint32_t i_iCrc, const uint8_t *i_pData, size_t i_iLength)
+{
+	static const uint64_t pK1K2[2] = { 0x0154442bd4ull, 0x01c6e41596ull };
+	static const uint64_t pK3K4[2] = { 0x01751997d0ull, 0x00ccaa009eull };
+	static const uint64_t pK5K0[2] = { 0x0163cd6124ull, 0x0000000000ull };
+	static const uint64_t pPoly[2] = { 0x01db710641ull, 0x01f7011641ull };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+	x1 = _mm_loadu_si128((const __m128i *)(i_pData+0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(i_pData+0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(i_pData+0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(i_pData+0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)i_iCrc));
+	x0 = _mm_loadu_si128((const __m128i *)pK1K2);
+	i_pData += 64;
+	i_iLength -= 64;
+
+	//four lanes of 128 bits folded 64 bytes ahead
+	while(i_iLength >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i *)(i_pData+0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(i_pData+0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(i_pData+0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(i_pData+0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		i_pData += 64;
+		i_iLength -= 64;
+	}
+
+	//the four lanes into one
+	x0 = _mm_loadu_si128((const __m128i *)pK3K4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	//the rest, 16 bytes per step
+	while(i_iLength >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)i_pData);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		i_pData += 16;
+		i_iLength -= 16;
+	}
+
+	//128 bits to 64, then barrett reduction to 32
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)pK5K0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadu_si128((const __m128i *)pPoly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+uint32_t Crc32Update(uint32_t i_iCrc, const uint8_t *i_pData, size_t i_iLength)
+{
+	uint32_t iCrc = ~i_iCrc;
+#ifdef ZIP_EXEC_PCLMUL
+	if(g_stCrcTable.bPclmul && i_iLength >= 64) {
+		size_t iBulk = i_iLength & ~(size_t)15;
+		iCrc = Crc32Pclmul(iCrc, i_pData, iBulk);
+		i_pData += iBulk;
+		i_iLength -= iBulk;
+	}
+#endif
+	return ~Crc32Slice8(iCrc, i_pData, i_iLength);
+}
+
+static uint32_t Gf2MatrixTimes(const uint32_t *i_pMatrix, uint32_t i_iVector)
+{
+	uint32_t iSum = 0;
+	for(; i_iVector; i_iVector >>= 1, i_pMatrix++) {
+		if(i_iVector & 1) iSum ^= *i_pMatrix;
+	}
+	return iSum;
+}
+
+static void Gf2MatrixSquare(uint32_t *o_pSquare, const uint32_t *i_pMatrix)
+{
+	for(int i=0; i<32; i++) o_pSquare[i] = Gf2MatrixTimes(i_pMatrix, i_pMatrix[i]);
+}
+
+//crc of two consecutive parts from the crc of each part, so parts can be summed
+// independently
+uint32_t Crc32Combine(uint32_t i_iCrc1, uint32_t i_iCrc2, uint64_t i_iLength2)
+{
+	if(i_iLength2 == 0) return i_iCrc1;
+	//operator for one zero bit, then squared to two and four zero bits
+	uint32_t pEven[32], pOdd[32];
+	pOdd[0] = 0xedb88320;
+	for(int i=1; i<32; i++) pOdd[i] = 1u << (i-1);
+	Gf2MatrixSquare(pEven, pOdd);
+	Gf2MatrixSquare(pOdd, pEven);
+	//apply length zero bytes to the first crc
+	do {
+		Gf2MatrixSquare(pEven, pOdd);
+		if(i_iLength2 & 1) i_iCrc1 = Gf2MatrixTimes(pEven, i_iCrc1);
+		i_iLength2 >>= 1;
+		if(i_iLength2 == 0) break;
+		Gf2MatrixSquare(pOdd, pEven);
+		if(i_iLength2 & 1) i_iCrc1 = Gf2MatrixTimes(pOdd, i_iCrc1);
+		i_iLength2 >>= 1;
+	} while(i_iLength2);
+	return i_iCrc1 ^ i_iCrc2;
+}
+
+//////////////////////////////////////////////
+//sha-256 (fips 180-4), for the --digest of the CD. crc-32 is too short to tell
+// archives apart when results are cached by it.
+
+static const uint32_t g_pSha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t Rotr32(uint32_t i_iValue, int i_iBits)
+{
+	return (i_iValue >> i_iBits) | (i_iValue << (32-i_iBits));
+}
+
+static void Sha256Block(uint32_t *io_pState, const uint8_t *i_pBlock)
+{
+	uint32_t w[64];
+	for(int i=0; i<16; i++) {
+		w[i] = ((uint32_t)i_pBlock[i*4]<<24) | ((uint32_t)i_pBlock[i*4+1]<<16) | ((uint32_t)i_pBlock[i*4+2]<<8) | i_pBlock[i*4+3];
+	}
+	for(int i=16; i<64; i++) {
+		uint32_t s0 = Rotr32(w[i-15], 7) ^ Rotr32(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = Rotr32(w[i-2], 17) ^ Rotr32(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	uint32_t a = io_pState[0], b = io_pState[1], c = io_pState[2], d = io_pState[3];
+	uint32_t e = io_pState[4], f = io_pState[5], g = io_pState[6], h = io_pState[7];
+	for(int i=0; i<64; i++) {
+		uint32_t t1 = h + (Rotr32(e, 6) ^ Rotr32(e, 11) ^ Rotr32(e, 25)) + ((e & f) ^ (~e & g)) + g_pSha256K[i] + w[i];
+		uint32_t t2 = (Rotr32(a, 2) ^ Rotr32(a, 13) ^ Rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	io_pState[0] += a; io_pState[1] += b; io_pState[2] += c; io_pState[3] += d;
+	io_pState[4] += e; io_pState[5] += f; io_pState[6] += g; io_pState[7] += h;
+}
+
+void Sha256(const S_WriteBuffer *i_pBuffers, int i_iNumBuffers, uint8_t o_pDigest[32])
+{
+	uint32_t pState[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	uint8_t pBlock[64];
+	uint32_t iBlockLen = 0;
+	uint64_t iTotal = 0;
+	for(int i=0; i<i_iNumBuffers; i++) {
+		const uint8_t *pData = (const uint8_t *)i_pBuffers[i].pData;
+		uint32_t iLength = i_pBuffers[i].iLength;
+		iTotal += iLength;
+		//whole blocks directly from the buffer, the parts between buffers collected
+		while(iLength > 0) {
+			if(iBlockLen == 0 && iLength >= 64) {
+				Sha256Block(pState, pData);
+				pData += 64;
+				iLength -= 64;
+				continue;
+			}
+			uint32_t iLen = 64-iBlockLen < iLength ? 64-iBlockLen : iLength;
+			memcpy(pBlock+iBlockLen, pData, iLen);
+			iBlockLen += iLen;
+			pData += iLen;
+			iLength -= iLen;
+			if(iBlockLen == 64) {
+				Sha256Block(pState, pBlock);
+				iBlockLen = 0;
+			}
+		}
+	}
+	//padding, a 1 bit, zeros and the length in bits (big endian)
+	pBlock[iBlockLen++] = 0x80;
+	if(iBlockLen > 56) {
+		memset(pBlock+iBlockLen, 0, 64-iBlockLen);
+		Sha256Block(pState, pBlock);
+		iBlockLen = 0;
+	}
+	memset(pBlock+iBlockLen, 0, 56-iBlockLen);
+	for(int i=0; i<8; i++) pBlock[56+i] = (uint8_t)((iTotal*8) >> (56-i*8));
+	Sha256Block(pState, pBlock);
+	for(int i=0; i<32; i++) o_pDigest[i] = (uint8_t)(pState[i/4] >> (24-(i%4)*8));
+}
+
+//////////////////////////////////////////////
+//deflate (rfc 1951) compressor, so no compression library is needed.
+//lz77 on hash chains (greedy for the low levels, lazy matching for the higher)
+// and each block is written as the smallest of stored, fixed or dynamic huffman.
+//input is compressed in parts which are given the previous 32K as history. all
+// parts but the last end byte aligned (with an empty stored block), so parts
+// compressed independently can be concatenated to one deflate stream.
+
+static const uint16_t g_pLengthBase[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const uint8_t  g_pLengthExtra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const uint16_t g_pDistBase[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const uint8_t  g_pDistExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+//order the code length code lengths are written in
+static const uint8_t  g_pCodeLengthOrder[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+
+struct S_DeflateTables
+{
+	uint8_t pLengthCode[259]; //by match length
+	uint8_t pDistCode[512];   //by distance-1 for <256, else 256+((distance-1)>>7)
+	uint8_t pFixedLitLens[288];
+	uint8_t pFixedDistLens[30];
+	S_DeflateTables()
+	{
+		for(int i=0; i<29; i++) {
+			int iEnd = i==28 ? 259 : g_pLengthBase[i+1];
+			for(int iLen=g_pLengthBase[i]; iLen<iEnd; iLen++) pLengthCode[iLen] = (uint8_t)i;
+		}
+		pLengthCode[258] = 28;
+		for(int i=0; i<30; i++) {
+			int iEnd = i==29 ? 32769 : g_pDistBase[i+1];
+			for(int iDist=g_pDistBase[i]; iDist<iEnd; iDist++) {
+				if(iDist <= 256) pDistCode[iDist-1] = (uint8_t)i;
+				else pDistCode[256+((iDist-1)>>7)] = (uint8_t)i;
+			}
+		}
+		for(int i=0; i<288; i++) pFixedLitLens[i] = i<144 ? 8 : (i<256 ? 9 : (i<280 ? 7 : 8));
+		for(int i=0; i<30; i++) pFixedDistLens[i] = 5;
+	}
+	int DistCode(uint32_t i_iDist) const { return i_iDist <= 256 ? pDistCode[i_iDist-1] : pDistCode[256+((i_iDist-1)>>7)]; };
+};
+static const S_DeflateTables g_stDeflateTables;
+
+class C_Deflater
+{
+public:
+	C_Deflater();
+	~C_Deflater();
+
+	void SetLevel(int i_iLevel); //1 (fast) to 9 (best)
+	//compresses i_pData[i_iHistory..i_iLength), i_pData[0..i_iHistory) is the data
+	// before it (the last 32K is used), the result is taken with DetachOutput
+	void Compress(const uint8_t *i_pData, uint32_t i_iHistory, uint32_t i_iLength, bool i_bLast);
+	uint8_t *DetachOutput(uint32_t *o_iLength); //delete[] by the caller
+private:
+	enum { WINDOW_SIZE = 32768, HASH_BITS = 15, MAX_SYMBOLS = 16384, MAX_MATCH = 258 };
+
+	uint32_t Hash(const uint8_t *i_pData) { return (((uint32_t)i_pData[0] | ((uint32_t)i_pData[1]<<8) | ((uint32_t)i_pData[2]<<16)) * 2654435761u) >> (32-HASH_BITS); };
+	void Insert(uint32_t i_iPos);
+	uint32_t LongestMatch(uint32_t i_iPos, uint32_t i_iPrevLength, uint32_t *o_iDist);
+	void AddLiteral(uint8_t i_iLiteral);
+	void AddMatch(uint32_t i_iLength, uint32_t i_iDist);
+	void FlushBlock(bool i_bLast);
+
+	static void BuildLengths(const uint32_t *i_pFreq, int i_iNum, int i_iMaxBits, uint8_t *o_pLens);
+	static void BuildCodes(const uint8_t *i_pLens, int i_iNum, uint16_t *o_pCodes);
+	void EnsureOutput(uint32_t i_iBytes);
+	void PutBits(uint32_t i_iValue, int i_iNumBits);
+	void AlignBits();
+	void WriteStored(uint32_t i_iStart, uint32_t i_iLength, bool i_bLast);
+
+	//level parameters
+	int m_iMaxChain, m_iNiceLength, m_iMaxLazy, m_iGoodLength;
+	bool m_bLazy;
+
+	//input and lz77 state
+	const uint8_t *m_pData;
+	uint32_t m_iLength;
+	int32_t *m_pHead;
+	int32_t *m_pPrev; //by position modulo the window, so the chains stay in cache
+
+	//symbols of the current block: literal (dist 0) or length and distance
+	uint16_t *m_pSymLength;
+	uint16_t *m_pSymDist;
+	int m_iNumSymbols;
+	uint32_t m_iBlockStart, m_iSymbolEnd; //input covered by the symbols
+
+	//output
+	uint8_t *m_pOut;
+	uint32_t m_iOutLength, m_iOutCapacity;
+	uint64_t m_iBitBuffer;
+	int m_iBitCount;
+};
+
+C_Deflater::C_Deflater()
+{
+	m_pHead = new int32_t[1<<HASH_BITS];
+	m_pPrev = new int32_t[WINDOW_SIZE];
+	m_pSymLength = new uint16_t[MAX_SYMBOLS];
+	m_pSymDist = new uint16_t[MAX_SYMBOLS];
+	m_iNumSymbols = 0;
+	m_pData = NULL;
+	m_iLength = 0;
+	m_iBlockStart = m_iSymbolEnd = 0;
+	m_pOut = NULL;
+	m_iOutLength = m_iOutCapacity = 0;
+	m_iBitBuffer = 0;
+	m_iBitCount = 0;
+	SetLevel(9);
+}
+
+C_Deflater::~C_Deflater()
+{
+	delete[] m_pHead;
+	delete[] m_pPrev;
+	delete[] m_pSymLength;
+	delete[] m_pSymDist;
+	delete[] m_pOut;
+}
+
+void C_Deflater::SetLevel(int i_iLevel)
+{
+	//chain length, nice length, lazy (or greedy) limit, good length; in the spirit
+	// of the zlib levels
+	static const int pConfig[10][4] = {
+		{    4,   8,   0,  4 }, {    4,   8,   0,  4 }, {    8,  16,   0,  4 }, {   32,  32,   0,  4 },
+		{   16,  16,   4,  4 }, {   32,  32,  16,  8 }, {  128, 128,  16,  8 }, {  256, 128,  32,  8 },
+		{ 1024, 258, 128, 32 }, { 4096, 258, 258, 32 } };
+	if(i_iLevel < 1) i_iLevel = 1;
+	if(i_iLevel > 9) i_iLevel = 9;
+	m_iMaxChain   = pConfig[i_iLevel][0];
+	m_iNiceLength = pConfig[i_iLevel][1];
+	m_iMaxLazy    = pConfig[i_iLevel][2];
+	m_iGoodLength = pConfig[i_iLevel][3];
+	m_bLazy = i_iLevel >= 4;
+}
+
+uint8_t *C_Deflater::DetachOutput(uint32_t *o_iLength)
+{
+	uint8_t *pOut = m_pOut;
+	*o_iLength = m_iOutLength;
+	m_pOut = NULL;
+	m_iOutLength = m_iOutCapacity = 0;
+	return pOut;
+}
+
+void C_Deflater::Insert(uint32_t i_iPos)
+{
+	if(i_iPos+2 >= m_iLength) return;
+	uint32_t iHash = Hash(m_pData+i_iPos);
+	m_pPrev[i_iPos & (WINDOW_SIZE-1)] = m_pHead[iHash];
+	m_pHead[iHash] = (int32_t)i_iPos;
+}
+
+uint32_t C_Deflater::LongestMatch(uint32_t i_iPos, uint32_t i_iPrevLength, uint32_t *o_iDist)
+{
+	uint32_t iMaxLength = m_iLength-i_iPos < MAX_MATCH ? m_iLength-i_iPos : MAX_MATCH;
+	if(iMaxLength < 3 || i_iPrevLength >= iMaxLength) return 0;
+	int iChain = i_iPrevLength >= (uint32_t)m_iGoodLength ? m_iMaxChain>>2 : m_iMaxChain;
+	int32_t iLimit = i_iPos > WINDOW_SIZE ? (int32_t)(i_iPos-WINDOW_SIZE) : 0;
+	const uint8_t *pCur = m_pData+i_iPos;
+
+	//only matches longer than the previous one are of interest, so a candidate
+	// must have the two bytes ending the best match so far before it is compared.
+	// a slot of m_pPrev is reused only by a position a window later, which is
+	// never reached from a candidate inside the window
+	uint32_t iBest = i_iPrevLength > 2 ? i_iPrevLength : 2;
+	uint32_t iBestDist = 0;
+	uint16_t iBestEnd;
+	memcpy(&iBestEnd, pCur+iBest-1, 2);
+	for(int32_t iCand = m_pHead[Hash(pCur)]; iCand >= iLimit && iChain-- > 0; iCand = m_pPrev[iCand & (WINDOW_SIZE-1)]) {
+		const uint8_t *pCand = m_pData+iCand;
+		uint16_t iCandEnd;
+		memcpy(&iCandEnd, pCand+iBest-1, 2);
+		if(iCandEnd != iBestEnd || pCand[0] != pCur[0] || pCand[1] != pCur[1]) continue;
+		//8 bytes at a time, then the rest
+		uint32_t iLen = 2;
+		for(; iLen+8 <= iMaxLength; iLen += 8) {
+			uint64_t iA, iB;
+			memcpy(&iA, pCand+iLen, 8);
+			memcpy(&iB, pCur+iLen, 8);
+			if(iA != iB) break;
+		}
+		while(iLen < iMaxLength && pCand[iLen] == pCur[iLen]) iLen++;
+		if(iLen > iBest) {
+			iBest = iLen;
+			iBestDist = i_iPos-(uint32_t)iCand;
+			if(iLen >= (uint32_t)m_iNiceLength || iLen >= iMaxLength) break;
+			memcpy(&iBestEnd, pCur+iBest-1, 2);
+		}
+	}
+	//a short match far away costs more than the literals
+	if(iBestDist == 0 || (iBest == 3 && iBestDist > 4096)) return 0;
+	*o_iDist = iBestDist;
+	return iBest;
+}
+
+void C_Deflater::AddLiteral(uint8_t i_iLiteral)
+{
+	m_pSymLength[m_iNumSymbols] = i_iLiteral;
+	m_pSymDist[m_iNumSymbols++] = 0;
+	m_iSymbolEnd++;
+	if(m_iNumSymbols == MAX_SYMBOLS) FlushBlock(false);
+}
+
+void C_Deflater::AddMatch(uint32_t i_iLength, uint32_t i_iDist)
+{
+	m_pSymLength[m_iNumSymbols] = (uint16_t)i_iLength;
+	m_pSymDist[m_iNumSymbols++] = (uint16_t)i_iDist;
+	m_iSymbolEnd += i_iLength;
+	if(m_iNumSymbols == MAX_SYMBOLS) FlushBlock(false);
+}
+
+void C_Deflater::Compress(const uint8_t *i_pData, uint32_t i_iHistory, uint32_t i_iLength, bool i_bLast)
+{
+	if(i_iHistory > WINDOW_SIZE) {
+		i_pData += i_iHistory-WINDOW_SIZE;
+		i_iLength -= i_iHistory-WINDOW_SIZE;
+		i_iHistory = WINDOW_SIZE;
+	}
+	m_pData = i_pData;
+	m_iLength = i_iLength;
+	for(int i=0; i<(1<<HASH_BITS); i++) m_pHead[i] = -1;
+	m_iOutLength = 0;
+	m_iBitBuffer = 0;
+	m_iBitCount = 0;
+	m_iNumSymbols = 0;
+	m_iBlockStart = m_iSymbolEnd = i_iHistory;
+	EnsureOutput((i_iLength-i_iHistory)/8 + 1024);
+
+	//the history can be matched
+	for(uint32_t i=0; i<i_iHistory; i++) Insert(i);
+
+	uint32_t iPos = i_iHistory;
+	if(!m_bLazy) {
+		while(iPos < i_iLength) {
+			uint32_t iDist, iLen = LongestMatch(iPos, 0, &iDist);
+			if(iLen) {
+				AddMatch(iLen, iDist);
+				for(uint32_t i=0; i<iLen; i++) Insert(iPos+i);
+				iPos += iLen;
+			} else {
+				AddLiteral(i_pData[iPos]);
+				Insert(iPos++);
+			}
+		}
+	} else {
+		//a match is only taken if the next position does not have a longer one
+		bool bHavePrev = false;
+		uint32_t iPrevLen = 0, iPrevDist = 0;
+		while(iPos < i_iLength) {
+			uint32_t iDist = 0, iLen = 0;
+			if(!bHavePrev || iPrevLen < (uint32_t)m_iMaxLazy) iLen = LongestMatch(iPos, bHavePrev ? iPrevLen : 0, &iDist);
+			Insert(iPos);
+			if(bHavePrev) {
+				if(iPrevLen >= 3 && iLen <= iPrevLen) {
+					//the match at the previous position covers up to iPos-1+iPrevLen
+					AddMatch(iPrevLen, iPrevDist);
+					uint32_t iEnd = iPos-1+iPrevLen;
+					for(uint32_t i=iPos+1; i<iEnd; i++) Insert(i);
+					iPos = iEnd;
+					bHavePrev = false;
+					continue;
+				}
+				AddLiteral(i_pData[iPos-1]);
+			}
+			bHavePrev = true;
+			iPrevLen = iLen;
+			iPrevDist = iDist;
+			iPos++;
+		}
+		if(bHavePrev) AddLiteral(i_pData[iPos-1]);
+	}
+	FlushBlock(i_bLast);
+
+	if(!i_bLast) {
+		//empty stored block, the next part starts byte aligned
+		EnsureOutput(16);
+		PutBits(0, 3);
+		AlignBits();
+		m_pOut[m_iOutLength++] = 0x00; m_pOut[m_iOutLength++] = 0x00;
+		m_pOut[m_iOutLength++] = 0xff; m_pOut[m_iOutLength++] = 0xff;
+	}
+	AlignBits();
+}
+
+void C_Deflater::BuildLengths(const uint32_t *i_pFreq, int i_iNum, int i_iMaxBits, uint8_t *o_pLens)
+{
+	//huffman code lengths with the two queue method over the symbols sorted by
+	// frequency. when the longest code is too long the frequencies are flattened
+	// and it is done again.
+	uint32_t pFreq[288];
+	int pLeaves[288];
+	uint32_t pNodeFreq[2*288];
+	int pParent[2*288];
+	uint8_t pDepth[2*288];
+	memcpy(pFreq, i_pFreq, i_iNum*sizeof(uint32_t));
+	memset(o_pLens, 0, i_iNum);
+
+	//there must be at least two codes, a single code is not a complete code
+	int iNumUsed = 0;
+	for(int i=0; i<i_iNum; i++) if(pFreq[i]) iNumUsed++;
+	for(int i=0; i<i_iNum && iNumUsed<2; i++) {
+		if(!pFreq[i]) {
+			pFreq[i] = 1;
+			iNumUsed++;
+		}
+	}
+
+	while(true) {
+		//leaves by frequency, then symbol (insertion sort, there are few symbols)
+		int iNumLeaves = 0;
+		for(int i=0; i<i_iNum; i++) {
+			if(!pFreq[i]) continue;
+			int j = iNumLeaves++;
+			while(j>0 && pFreq[pLeaves[j-1]] > pFreq[i]) {
+				pLeaves[j] = pLeaves[j-1];
+				j--;
+			}
+			pLeaves[j] = i;
+		}
+		if(iNumLeaves < 2) return; //only when there are less than two symbols at all
+		for(int i=0; i<iNumLeaves; i++) pNodeFreq[i] = pFreq[pLeaves[i]];
+
+		//leaves are nodes 0..n-1, internal nodes are made in order of frequency
+		int iLeaf = 0, iInner = iNumLeaves, iNext = iNumLeaves;
+		for(int i=0; i<iNumLeaves-1; i++) {
+			int pTake[2];
+			for(int j=0; j<2; j++) {
+				if(iLeaf < iNumLeaves && (iInner >= iNext || pNodeFreq[iLeaf] <= pNodeFreq[iInner])) pTake[j] = iLeaf++;
+				else pTake[j] = iInner++;
+			}
+			pNodeFreq[iNext] = pNodeFreq[pTake[0]] + pNodeFreq[pTake[1]];
+			pParent[pTake[0]] = pParent[pTake[1]] = iNext;
+			iNext++;
+		}
+		pDepth[iNext-1] = 0;
+		int iMaxDepth = 0;
+		for(int i=iNext-2; i>=0; i--) {
+			pDepth[i] = pDepth[pParent[i]]+1;
+			if(pDepth[i] > iMaxDepth) iMaxDepth = pDepth[i];
+		}
+		if(iMaxDepth <= i_iMaxBits) {
+			for(int i=0; i<iNumLeaves; i++) o_pLens[pLeaves[i]] = pDepth[i];
+			return;
+		}
+		for(int i=0; i<i_iNum; i++) pFreq[i] = (pFreq[i]+1) >> 1;
+	}
+}
+
+void C_Deflater::BuildCodes(const uint8_t *i_pLens, int i_iNum, uint16_t *o_pCodes)
+{
+	//canonical codes, bit reversed since they are written from the lowest bit
+	int pCount[16] = { 0 };
+	uint16_t pNextCode[16];
+	for(int i=0; i<i_iNum; i++) pCount[i_pLens[i]]++;
+	pCount[0] = 0;
+	uint16_t iCode = 0;
+	for(int iBits=1; iBits<16; iBits++) {
+		iCode = (uint16_t)((iCode + pCount[iBits-1]) << 1);
+		pNextCode[iBits] = iCode;
+	}
+	for(int i=0; i<i_iNum; i++) {
+		int iLen = i_pLens[i];
+		if(!iLen) continue;
+		uint16_t iValue = pNextCode[iLen]++, iReversed = 0;
+		for(int j=0; j<iLen; j++) iReversed |= ((iValue >> j) & 1) << (iLen-1-j);
+		o_pCodes[i] = iReversed;
+	}
+}
+
+void C_Deflater::EnsureOutput(uint32_t i_iBytes)
+{
+	if(m_iOutLength + i_iBytes + 8 <= m_iOutCapacity) return;
+	uint32_t iCapacity = m_iOutCapacity ? m_iOutCapacity : 4096;
+	while(iCapacity < m_iOutLength + i_iBytes + 8) iCapacity *= 2;
+	uint8_t *pNew = new uint8_t[iCapacity];
+	if(m_iOutLength) memcpy(pNew, m_pOut, m_iOutLength);
+	delete[] m_pOut;
+	m_pOut = pNew;
+	m_iOutCapacity = iCapacity;
+}
+
+void C_Deflater::PutBits(uint32_t i_iValue, int i_iNumBits)
+{
+	m_iBitBuffer |= (uint64_t)i_iValue << m_iBitCount;
+	m_iBitCount += i_iNumBits;
+	while(m_iBitCount >= 8) {
+		m_pOut[m_iOutLength++] = (uint8_t)m_iBitBuffer;
+		m_iBitBuffer >>= 8;
+		m_iBitCount -= 8;
+	}
+}
+
+void C_Deflater::AlignBits()
+{
+	if(m_iBitCount > 0) m_pOut[m_iOutLength++] = (uint8_t)m_iBitBuffer;
+	m_iBitBuffer = 0;
+	m_iBitCount = 0;
+}
+
+void C_Deflater::WriteStored(uint32_t i_iStart, uint32_t i_iLength, bool i_bLast)
+{
+	do {
+		uint32_t iLen = i_iLength < 65535 ? i_iLength : 65535;
+		EnsureOutput(iLen+8);
+		PutBits((i_bLast && iLen==i_iLength) ? 1 : 0, 3);
+		AlignBits();
+		m_pOut[m_iOutLength++] = (uint8_t)iLen;  m_pOut[m_iOutLength++] = (uint8_t)(iLen>>8);
+		m_pOut[m_iOutLength++] = (uint8_t)~iLen; m_pOut[m_iOutLength++] = (uint8_t)(~iLen>>8);
+		memcpy(m_pOut+m_iOutLength, m_pData+i_iStart, iLen);
+		m_iOutLength += iLen;
+		i_iStart += iLen;
+		i_iLength -= iLen;
+	} while(i_iLength > 0);
+}
+
+void C_Deflater::FlushBlock(bool i_bLast)
+{
+	uint32_t pLitFreq[286] = { 0 }, pDistFreq[30] = { 0 };
+	for(int i=0; i<m_iNumSymbols; i++) {
+		if(m_pSymDist[i] == 0) pLitFreq[m_pSymLength[i]]++;
+		else {
+			pLitFreq[257+g_stDeflateTables.pLengthCode[m_pSymLength[i]]]++;
+			pDistFreq[g_stDeflateTables.DistCode(m_pSymDist[i])]++;
+		}
+	}
+	pLitFreq[256] = 1; //end of block
+
+	uint8_t pLitLens[286], pDistLens[30];
+	BuildLengths(pLitFreq, 286, 15, pLitLens);
+	BuildLengths(pDistFreq, 30, 15, pDistLens);
+	int iNumLit = 286, iNumDist = 30;
+	while(iNumLit > 257 && pLitLens[iNumLit-1] == 0) iNumLit--;
+	while(iNumDist > 1 && pDistLens[iNumDist-1] == 0) iNumDist--;
+
+	//code lengths of both codes in one sequence, run length coded
+	uint8_t pAllLens[286+30];
+	memcpy(pAllLens, pLitLens, iNumLit);
+	memcpy(pAllLens+iNumLit, pDistLens, iNumDist);
+	int iNumAll = iNumLit+iNumDist;
+	uint8_t pRunSym[286+30], pRunExtra[286+30];
+	int iNumRuns = 0;
+	uint32_t pCLFreq[19] = { 0 };
+	for(int i=0; i<iNumAll; ) {
+		uint8_t iLen = pAllLens[i];
+		int iRun = 1;
+		while(i+iRun < iNumAll && pAllLens[i+iRun] == iLen) iRun++;
+		if(iLen == 0 && iRun >= 3) {
+			if(iRun > 138) iRun = 138;
+			pRunSym[iNumRuns] = iRun >= 11 ? 18 : 17;
+			pRunExtra[iNumRuns++] = (uint8_t)(iRun >= 11 ? iRun-11 : iRun-3);
+		} else if(iLen != 0 && iRun >= 4) {
+			//the length itself, then repeats of it
+			if(iRun > 7) iRun = 7;
+			pRunSym[iNumRuns] = iLen; pRunExtra[iNumRuns++] = 0;
+			pRunSym[iNumRuns] = 16; pRunExtra[iNumRuns++] = (uint8_t)(iRun-4);
+		} else {
+			iRun = 1;
+			pRunSym[iNumRuns] = iLen; pRunExtra[iNumRuns++] = 0;
+		}
+		i += iRun;
+	}
+	for(int i=0; i<iNumRuns; i++) pCLFreq[pRunSym[i]]++;
+	uint8_t pCLLens[19];
+	BuildLengths(pCLFreq, 19, 7, pCLLens);
+	int iNumCL = 19;
+	while(iNumCL > 4 && pCLLens[g_pCodeLengthOrder[iNumCL-1]] == 0) iNumCL--;
+
+	//size of each way to write the block, in bits
+	uint64_t iExtraBits = 0, iDynamicBits = 0, iFixedBits = 0;
+	for(int i=0; i<286; i++) {
+		uint32_t iExtra = i >= 257 ? g_pLengthExtra[i-257] : 0;
+		iExtraBits   += (uint64_t)pLitFreq[i]*iExtra;
+		iDynamicBits += (uint64_t)pLitFreq[i]*pLitLens[i];
+		iFixedBits   += (uint64_t)pLitFreq[i]*g_stDeflateTables.pFixedLitLens[i];
+	}
+	for(int i=0; i<30; i++) {
+		iExtraBits   += (uint64_t)pDistFreq[i]*g_pDistExtra[i];
+		iDynamicBits += (uint64_t)pDistFreq[i]*pDistLens[i];
+		iFixedBits   += (uint64_t)pDistFreq[i]*5;
+	}
+	iDynamicBits += 3+5+5+4 + 3*iNumCL + iExtraBits;
+	for(int i=0; i<19; i++) iDynamicBits += (uint64_t)pCLFreq[i]*pCLLens[i];
+	iDynamicBits += (uint64_t)pCLFreq[16]*2 + (uint64_t)pCLFreq[17]*3 + (uint64_t)pCLFreq[18]*7;
+	iFixedBits += 3 + iExtraBits;
+	uint32_t iRawLength = m_iSymbolEnd-m_iBlockStart;
+	uint64_t iStoredBits = ((uint64_t)iRawLength + 5*(iRawLength/65535+1))*8 + 7;
+
+	if(iStoredBits <= iDynamicBits && iStoredBits <= iFixedBits) {
+		WriteStored(m_iBlockStart, iRawLength, i_bLast);
+	} else {
+		bool bFixed = iFixedBits <= iDynamicBits;
+		const uint8_t *pUseLitLens = bFixed ? g_stDeflateTables.pFixedLitLens : pLitLens;
+		const uint8_t *pUseDistLens = bFixed ? g_stDeflateTables.pFixedDistLens : pDistLens;
+		uint16_t pLitCodes[288], pDistCodes[30];
+		BuildCodes(pUseLitLens, bFixed ? 288 : 286, pLitCodes);
+		BuildCodes(pUseDistLens, 30, pDistCodes);
+		EnsureOutput((uint32_t)((bFixed ? iFixedBits : iDynamicBits)/8) + 16);
+
+		PutBits(i_bLast ? 1 : 0, 1);
+		PutBits(bFixed ? 1 : 2, 2);
+		if(!bFixed) {
+			uint16_t pCLCodes[19];
+			BuildCodes(pCLLens, 19, pCLCodes);
+			PutBits(iNumLit-257, 5);
+			PutBits(iNumDist-1, 5);
+			PutBits(iNumCL-4, 4);
+			for(int i=0; i<iNumCL; i++) PutBits(pCLLens[g_pCodeLengthOrder[i]], 3);
+			for(int i=0; i<iNumRuns; i++) {
+				PutBits(pCLCodes[pRunSym[i]], pCLLens[pRunSym[i]]);
+				if(pRunSym[i] == 16) PutBits(pRunExtra[i], 2);
+				else if(pRunSym[i] == 17) PutBits(pRunExtra[i], 3);
+				else if(pRunSym[i] == 18) PutBits(pRunExtra[i], 7);
+			}
+		}
+		for(int i=0; i<m_iNumSymbols; i++) {
+			uint32_t iDist = m_pSymDist[i];
+			if(iDist == 0) {
+				PutBits(pLitCodes[m_pSymLength[i]], pUseLitLens[m_pSymLength[i]]);
+				continue;
+			}
+			int iLenCode = g_stDeflateTables.pLengthCode[m_pSymLength[i]];
+			PutBits(pLitCodes[257+iLenCode], pUseLitLens[257+iLenCode]);
+			PutBits(m_pSymLength[i]-g_pLengthBase[iLenCode], g_pLengthExtra[iLenCode]);
+			int iDistCode = g_stDeflateTables.DistCode(iDist);
+			PutBits(pDistCodes[iDistCode], pUseDistLens[iDistCode]);
+			PutBits(iDist-g_pDistBase[iDistCode], g_pDistExtra[iDistCode]);
+		}
+		PutBits(pLitCodes[256], pUseLitLens[256]);
+	}
+	m_iBlockStart = m_iSymbolEnd;
+	m_iNumSymbols = 0;
+}
+
+//////////////////////////////////////////////
+//deflate decompressor, used for verifying and extracting. the output is decoded
+// into a window, which is summed (crc), written when there is a file for it, and
+// slid back to the last 32K when full.
+//codes up to FAST_BITS long are decoded with one table lookup, longer ones
+// bit by bit from the counts per length (canonical huffman).
+
+class C_Inflater
+{
+public:
+	C_Inflater();
+	~C_Inflater();
+
+	//decompresses the deflate stream of i_iCompressedSize bytes at the current
+	// position of i_pclIn, returns its size and crc. the data is written to i_pclOut
+	// if one is given
+	//with UNKNOWN_SIZE the stream ends at its last block: the compressed bytes are
+	// written to i_pclPass as they are used up, and what was read after the end is
+	// left in GetUnusedInput
+	enum { UNKNOWN_SIZE = 0xffffffffffffffffull };
+	bool Inflate(C_Resource *i_pclIn, uint64_t i_iCompressedSize, uint64_t *o_iSize, uint32_t *o_iCrc, C_Resource *i_pclOut = NULL, C_Resource *i_pclPass = NULL);
+	uint64_t GetCompressedSize() { return m_iInRead-m_iUnused; };
+	uint32_t GetUnusedInput(const uint8_t **o_pData);
+	const char *GetError() { return m_szError; };
+private:
+	//bytes of the previous input chunk kept in front of it, more than the whole
+	// bytes the bit buffer can hold
+	enum { FAST_BITS = 10, WINDOW_SIZE = 32768, OUT_SIZE = 1<<18, IN_SIZE = 1<<16, IN_HISTORY = 8 };
+	struct S_Huffman
+	{
+		uint16_t pFast[1<<FAST_BITS]; //symbol<<4 | length, 0 when the code is longer
+		uint16_t pCount[16];          //number of codes per length
+		uint16_t pSymbols[288];       //symbols ordered by code
+	};
+
+	bool Build(S_Huffman *o_pHuff, const uint8_t *i_pLens, int i_iNum);
+	void Refill(int i_iNumBits);
+	uint32_t GetBits(int i_iNumBits);
+	int Decode(const S_Huffman *i_pHuff);
+	void Flush();
+	void PassInput(uint64_t i_iEnd);
+	bool StoredBlock();
+	bool DynamicTables();
+	bool CodesBlock(const S_Huffman *i_pLit, const S_Huffman *i_pDist);
+
+	C_Resource *m_pclIn;
+	uint64_t m_iInLeft; //compressed bytes not read yet
+	uint8_t *m_pInMem, *m_pIn;
+	uint32_t m_iInPos, m_iInLength;
+	//input positions: read in total, written to m_pclPass, read after the end
+	uint64_t m_iInRead, m_iPassed, m_iUnused;
+	C_Resource *m_pclPass;
+	//bit buffer, after the end of the input it is filled with zero bytes, which
+	// are counted, reading one of them means the stream is cut off
+	uint64_t m_iBits;
+	int m_iNumBits;
+	int m_iNumPadBits;
+	bool m_bOverrun;
+	//output window, m_pOut[0..m_iCrcPos) has been summed
+	uint8_t *m_pOut;
+	uint32_t m_iOutPos, m_iCrcPos;
+	C_Resource *m_pclOut;
+	bool m_bWriteError;
+	uint64_t m_iSize;
+	uint32_t m_iCrc;
+	const char *m_szError;
+	S_Huffman m_stFixedLit, m_stFixedDist;
+	S_Huffman m_stLit, m_stDist;
+};
+
+C_Inflater::C_Inflater()
+{
+	m_pInMem = new uint8_t[IN_HISTORY+IN_SIZE];
+	m_pIn = m_pInMem+IN_HISTORY;
+	m_pOut = new uint8_t[OUT_SIZE];
+	m_pclOut = NULL;
+	m_pclPass = NULL;
+	m_iInRead = m_iPassed = m_iUnused = 0;
+	m_bWriteError = false;
+	m_szError = NULL;
+	Build(&m_stFixedLit, g_stDeflateTables.pFixedLitLens, 288);
+	Build(&m_stFixedDist, g_stDeflateTables.pFixedDistLens, 30);
+}
+
+C_Inflater::~C_Inflater()
+{
+	delete[] m_pInMem;
+	delete[] m_pOut;
+}
+
+bool C_Inflater::Build(S_Huffman *o_pHuff, const uint8_t *i_pLens, int i_iNum)
+{
+	memset(o_pHuff->pCount, 0, sizeof(o_pHuff->pCount));
+	for(int i=0; i<i_iNum; i++) o_pHuff->pCount[i_pLens[i]]++;
+	o_pHuff->pCount[0] = 0;
+	//over-subscribed sets are invalid, incomplete ones are allowed (a code which
+	// is not used only fails when it is read)
+	int iLeft = 1;
+	for(int iLen=1; iLen<16; iLen++) {
+		iLeft = (iLeft << 1) - o_pHuff->pCount[iLen];
+		if(iLeft < 0) return false;
+	}
+	uint16_t pOffsets[16];
+	uint16_t pNextCode[16];
+	pOffsets[1] = 0;
+	pNextCode[1] = 0;
+	for(int iLen=1; iLen<15; iLen++) {
+		pOffsets[iLen+1] = pOffsets[iLen] + o_pHuff->pCount[iLen];
+		pNextCode[iLen+1] = (uint16_t)((pNextCode[iLen] + o_pHuff->pCount[iLen]) << 1);
+	}
+	memset(o_pHuff->pFast, 0, sizeof(o_pHuff->pFast));
+	for(int i=0; i<i_iNum; i++) {
+		int iLen = i_pLens[i];
+		if(iLen == 0) continue;
+		o_pHuff->pSymbols[pOffsets[iLen]++] = (uint16_t)i;
+		uint32_t iCode = pNextCode[iLen]++;
+		if(iLen > FAST_BITS) continue;
+		//the bits are read lsb first, so the table is indexed by the reversed code
+		uint32_t iReversed = 0;
+		for(int j=0; j<iLen; j++) iReversed |= ((iCode >> j) & 1) << (iLen-1-j);
+		for(uint32_t j=iReversed; j<(1u<<FAST_BITS); j+=1u<<iLen) o_pHuff->pFast[j] = (uint16_t)(i<<4 | iLen);
+	}
+	return true;
+}
+
+void C_Inflater::Refill(int i_iNumBits)
+{
+	while(m_iNumBits < i_iNumBits) {
+		if(m_iInPos == m_iInLength && m_iInLeft) {
+			if(m_pclPass) {
+				//the chunk is passed on but its last bytes, which may still be in
+				// the bit buffer unused at the end, are kept in front of the next
+				uint32_t iKeep = m_iInRead < IN_HISTORY ? (uint32_t)m_iInRead : IN_HISTORY;
+				PassInput(m_iInRead-iKeep);
+				memmove(m_pIn-iKeep, m_pIn+m_iInLength-iKeep, iKeep);
+			}
+			m_iInLength = m_iInLeft < IN_SIZE ? (uint32_t)m_iInLeft : IN_SIZE;
+			m_iInLength = m_pclIn->ReadSome(m_pIn, m_iInLength);
+			m_iInLeft = m_iInLength ? m_iInLeft-m_iInLength : 0;
+			m_iInRead += m_iInLength;
+			m_iInPos = 0;
+		}
+		if(m_iInPos < m_iInLength) m_iBits |= (uint64_t)m_pIn[m_iInPos++] << m_iNumBits;
+		else m_iNumPadBits += 8;
+		m_iNumBits += 8;
+	}
+}
+
+uint32_t C_Inflater::GetBits(int i_iNumBits)
+{
+	if(i_iNumBits == 0) return 0;
+	Refill(i_iNumBits);
+	if(m_iNumBits-m_iNumPadBits < i_iNumBits) m_bOverrun = true;
+	uint32_t iValue = (uint32_t)(m_iBits & ((1u << i_iNumBits)-1));
+	m_iBits >>= i_iNumBits;
+	m_iNumBits -= i_iNumBits;
+	return iValue;
+}
+
+int C_Inflater::Decode(const S_Huffman *i_pHuff)
+{
+	Refill(15);
+	uint32_t iEntry = i_pHuff->pFast[m_iBits & ((1u<<FAST_BITS)-1)];
+	if(iEntry) {
+		GetBits(iEntry & 15);
+		return (int)(iEntry >> 4);
+	}
+	//codes longer than FAST_BITS: the first code of each length and the index of
+	// its symbol are advanced length by length
+	int iCode = 0, iFirst = 0, iIndex = 0;
+	for(int iLen=1; iLen<16; iLen++) {
+		iCode |= (int)((m_iBits >> (iLen-1)) & 1);
+		int iCount = i_pHuff->pCount[iLen];
+		if(iCode-iFirst < iCount) {
+			GetBits(iLen);
+			return i_pHuff->pSymbols[iIndex + iCode-iFirst];
+		}
+		iIndex += iCount;
+		iFirst = (iFirst+iCount) << 1;
+		iCode <<= 1;
+	}
+	return -1;
+}
+
+void C_Inflater::Flush()
+{
+	m_iCrc = Crc32Update(m_iCrc, m_pOut+m_iCrcPos, m_iOutPos-m_iCrcPos);
+	if(m_pclOut && !m_bWriteError && !m_pclOut->Write(m_pOut+m_iCrcPos, m_iOutPos-m_iCrcPos)) m_bWriteError = true;
+	m_iSize += m_iOutPos-m_iCrcPos;
+	if(m_iOutPos > WINDOW_SIZE) {
+		memmove(m_pOut, m_pOut+m_iOutPos-WINDOW_SIZE, WINDOW_SIZE);
+		m_iOutPos = WINDOW_SIZE;
+	}
+	m_iCrcPos = m_iOutPos;
+}
+
+void C_Inflater::PassInput(uint64_t i_iEnd)
+{
+	//input [m_iPassed, i_iEnd) is in the current chunk or the history before it
+	if(i_iEnd <= m_iPassed) return;
+	const uint8_t *pFrom = m_pIn + (int64_t)(m_iPassed - (m_iInRead-m_iInLength));
+	if(!m_bWriteError && !m_pclPass->Write((void *)pFrom, (uint32_t)(i_iEnd-m_iPassed))) m_bWriteError = true;
+	m_iPassed = i_iEnd;
+}
+
+uint32_t C_Inflater::GetUnusedInput(const uint8_t **o_pData)
+{
+	*o_pData = m_pIn + (int64_t)(GetCompressedSize() - (m_iInRead-m_iInLength));
+	return (uint32_t)m_iUnused;
+}
+
+bool C_Inflater::StoredBlock()
+{
+	//to the byte boundary, the padding bits are always whole bytes
+	GetBits(m_iNumBits & 7);
+	uint32_t iLength = GetBits(16);
+	uint32_t iCheck = GetBits(16);
+	if(m_bOverrun) return true;
+	if(iLength != (~iCheck & 0xffff)) {
+		m_szError = "stored block length is corrupt";
+		return false;
+	}
+	//whole bytes left in the bit buffer first, then directly from the input
+	while(iLength && m_iNumBits >= 8) {
+		if(m_iOutPos == OUT_SIZE) Flush();
+		m_pOut[m_iOutPos++] = (uint8_t)GetBits(8);
+		iLength--;
+	}
+	while(iLength && !m_bOverrun) {
+		if(m_iOutPos == OUT_SIZE) Flush();
+		if(m_iInPos == m_iInLength) {
+			Refill(8);
+			if(m_iNumPadBits) m_bOverrun = true;
+			m_pOut[m_iOutPos++] = (uint8_t)GetBits(8);
+			iLength--;
+			continue;
+		}
+		uint32_t iCopy = m_iInLength-m_iInPos;
+		if(iCopy > iLength) iCopy = iLength;
+		if(iCopy > OUT_SIZE-m_iOutPos) iCopy = OUT_SIZE-m_iOutPos;
+		memcpy(m_pOut+m_iOutPos, m_pIn+m_iInPos, iCopy);
+		m_iOutPos += iCopy;
+		m_iInPos += iCopy;
+		iLength -= iCopy;
+	}
+	return true;
+}
+
+bool C_Inflater::DynamicTables()
+{
+	int iNumLit = GetBits(5)+257;
+	int iNumDist = GetBits(5)+1;
+	int iNumCodeLens = GetBits(4)+4;
+	if(iNumLit > 286 || iNumDist > 30) {
+		m_szError = "too many length or distance codes";
+		return false;
+	}
+	uint8_t pLens[288+32];
+	memset(pLens, 0, 19);
+	for(int i=0; i<iNumCodeLens; i++) pLens[g_pCodeLengthOrder[i]] = (uint8_t)GetBits(3);
+	if(!Build(&m_stLit, pLens, 19)) {
+		m_szError = "invalid code length code";
+		return false;
+	}
+	//literal/length and distance lengths as one run length coded sequence
+	int iNum = 0;
+	while(iNum < iNumLit+iNumDist && !m_bOverrun) {
+		int iSymbol = Decode(&m_stLit);
+		if(iSymbol < 0) {
+			m_szError = "invalid code length";
+			return false;
+		}
+		if(iSymbol < 16) {
+			pLens[iNum++] = (uint8_t)iSymbol;
+			continue;
+		}
+		uint8_t iLen = 0;
+		int iRepeat;
+		if(iSymbol == 16) {
+			if(iNum == 0) {
+				m_szError = "repeated length without a previous one";
+				return false;
+			}
+			iLen = pLens[iNum-1];
+			iRepeat = 3+GetBits(2);
+		} else if(iSymbol == 17) iRepeat = 3+GetBits(3);
+		else iRepeat = 11+GetBits(7);
+		if(iNum+iRepeat > iNumLit+iNumDist) {
+			m_szError = "too many code lengths";
+			return false;
+		}
+		while(iRepeat--) pLens[iNum++] = iLen;
+	}
+	if(m_bOverrun) return true;
+	if(pLens[256] == 0) {
+		m_szError = "no end of block code";
+		return false;
+	}
+	if(!Build(&m_stLit, pLens, iNumLit) || !Build(&m_stDist, pLens+iNumLit, iNumDist)) {
+		m_szError = "invalid literal/length or distance code";
+		return false;
+	}
+	return true;
+}
+
+bool C_Inflater::CodesBlock(const S_Huffman *i_pLit, const S_Huffman *i_pDist)
+{
+	while(!m_bOverrun) {
+		if(m_iOutPos > OUT_SIZE-258) Flush();
+		int iSymbol = Decode(i_pLit);
+		if(iSymbol < 256) {
+			if(iSymbol < 0) {
+				m_szError = "invalid literal/length code";
+				return false;
+			}
+			m_pOut[m_iOutPos++] = (uint8_t)iSymbol;
+			continue;
+		}
+		if(iSymbol == 256) return true;
+		iSymbol -= 257;
+		if(iSymbol >= 29) {
+			m_szError = "invalid length code";
+			return false;
+		}
+		uint32_t iLength = g_pLengthBase[iSymbol] + GetBits(g_pLengthExtra[iSymbol]);
+		int iDistSymbol = Decode(i_pDist);
+		if(iDistSymbol < 0 || iDistSymbol >= 30) {
+			m_szError = "invalid distance code";
+			return false;
+		}
+		uint32_t iDist = g_pDistBase[iDistSymbol] + GetBits(g_pDistExtra[iDistSymbol]);
+		//the window always holds the last 32K, or everything when there is less
+		if(iDist > m_iOutPos) {
+			m_szError = "distance too far back";
+			return false;
+		}
+		uint8_t *pOut = m_pOut+m_iOutPos;
+		for(uint32_t i=0; i<iLength; i++) pOut[i] = pOut[(int)i-(int)iDist];
+		m_iOutPos += iLength;
+	}
+	return true;
+}
+
+bool C_Inflater::Inflate(C_Resource *i_pclIn, uint64_t i_iCompressedSize, uint64_t *o_iSize, uint32_t *o_iCrc, C_Resource *i_pclOut, C_Resource *i_pclPass)
+{
+	m_pclIn = i_pclIn;
+	m_pclOut = i_pclOut;
+	m_pclPass = i_pclPass;
+	m_bWriteError = false;
+	m_iInLeft = i_iCompressedSize;
+	m_iInPos = m_iInLength = 0;
+	m_iInRead = m_iPassed = m_iUnused = 0;
+	m_iBits = 0;
+	m_iNumBits = m_iNumPadBits = 0;
+	m_bOverrun = false;
+	m_iOutPos = m_iCrcPos = 0;
+	m_iSize = 0;
+	m_iCrc = 0;
+	m_szError = NULL;
+
+	bool bLast = false;
+	while(!bLast) {
+		bLast = GetBits(1) != 0;
+		uint32_t iType = GetBits(2);
+		bool bOK;
+		if(iType == 0) bOK = StoredBlock();
+		else if(iType == 1) bOK = CodesBlock(&m_stFixedLit, &m_stFixedDist);
+		else if(iType == 2) bOK = DynamicTables() && (m_bOverrun || CodesBlock(&m_stLit, &m_stDist));
+		else {
+			m_szError = "invalid block type";
+			bOK = false;
+		}
+		if(!bOK) return false;
+		if(m_bOverrun) {
+			m_szError = "compressed data ends early";
+			return false;
+		}
+		if(m_bWriteError) break;
+	}
+	Flush();
+	//the whole bytes left in the bit buffer and the rest of the chunk were read
+	// after the end
+	m_iUnused = (uint32_t)(m_iNumBits-m_iNumPadBits)/8 + (m_iInLength-m_iInPos);
+	if(m_pclPass) PassInput(GetCompressedSize());
+	if(m_bWriteError) {
+		m_szError = "could not write the data";
+		return false;
+	}
+	*o_iSize = m_iSize;
+	*o_iCrc = m_iCrc;
+	return true;
+}
+
+/////////////
+//list of files in the archive to modify, given on the commandline,
+// in a manifest file (one name per line) or on stdin
+
+class C_TargetList
+{
+public:
+	C_TargetList();
+	~C_TargetList();
+
+	void Add(const char *i_szName);
+	bool AddFromFile(const char *i_szListFile); //"-" means stdin
+
+	int GetNum() { return m_iNum; };
+	char *Get(int i_iIdx) { return m_szNames[i_iIdx]; };
+private:
+	int m_iNum, m_iCapacity;
+	char **m_szNames;
+};
+
+C_TargetList::C_TargetList()
+{
+	m_iNum      = 0;
+	m_iCapacity = 0;
+	m_szNames   = NULL;
+}
+
+C_TargetList::~C_TargetList()
+{
+	for(int i=0; i<m_iNum; i++) delete[] m_szNames[i];
+	delete[] m_szNames;
+}
+
+void C_TargetList::Add(const char *i_szName)
+{
+	if(m_iNum==m_iCapacity) {
+		m_iCapacity = m_iCapacity ? m_iCapacity*2 : 16;
+		char **szNew = new char*[m_iCapacity];
+		if(m_iNum) memcpy(szNew, m_szNames, m_iNum*sizeof(char*));
+		delete[] m_szNames;
+		m_szNames = szNew;
+	}
+	int iLen = (int)strlen(i_szName);
+	m_szNames[m_iNum] = new char[iLen+1];
+	memcpy(m_szNames[m_iNum], i_szName, iLen+1);
+	m_iNum++;
+}
+
+bool C_TargetList::AddFromFile(const char *i_szListFile)
+{
+	bool bStdin = strcmp(i_szListFile, "-")==0;
+	FILE *pFile = bStdin ? stdin : fopen(i_szListFile, "rb");
+	if(pFile == NULL) return false;
+
+	//one name per line taken literally (zip names can start with '#' and be up to
+	// 65535 bytes long), only empty lines are skipped
+	int iCapacity = 4096, iLen = 0;
+	char *szLine = new char[iCapacity];
+	bool bResult = true;
+	for(;;) {
+		int c = getc(pFile);
+		if(c != EOF && c != '\n') {
+			if(iLen+1 == iCapacity) {
+				char *szNew = new char[iCapacity*2];
+				memcpy(szNew, szLine, iLen);
+				delete[] szLine;
+				szLine = szNew;
+				iCapacity *= 2;
+			}
+			szLine[iLen++] = (char)c;
+			continue;
+		}
+		if(iLen>0 && szLine[iLen-1]=='\r') iLen--;
+		szLine[iLen] = 0;
+		if(iLen>0) Add(szLine);
+		iLen = 0;
+		if(c == EOF) break;
+	}
+	if(ferror(pFile)) bResult = false;
+	delete[] szLine;
+	if(!bStdin) fclose(pFile);
+	return bResult;
+}
+
+/////////////
+//permission policy, ordered glob rules mapping archive names to unix modes.
+//all rules are compiled into one automaton (positions of all globs, run as a
+// DFA that is built lazily while matching) so every name is classified in a
+// single pass over its characters, whatever the number of rules.
+//globs are matched against the whole name:
+// *    any characters except '/'
+// ?    one character except '/'
+// [..] one character of a set, [!..] or [^..] not in the set, ranges a-z
+// **/  zero or more directories (at the start of a segment)
+// /**  everything below the directory, not the directory itself (at the end)
+// \x   x literally
+//a name of a directory ends with '/', so a glob ending with '/' only matches
+// directories. a rule without a type that matches a directory also gives it x
+// wherever it gives r (like chmod's X), so "www/** 0644" keeps the directories
+// below www/ searchable.
+
+enum E_RuleType { RULE_ANY = 0, RULE_FILE, RULE_DIR };
+
+class C_PermissionPolicy
+{
+public:
+	C_PermissionPolicy();
+	~C_PermissionPolicy();
+
+	//one rule per line: <glob> [->] <octal mode> [file|dir], '#' comments
+	bool Load(const char *i_szPolicyFile);
+	bool AddRule(const char *i_szGlob, uint32_t i_iMode, E_RuleType i_eType);
+
+	int GetNumRules() { return m_iNumRules; };
+	const char *GetRuleGlob(int i_iRule) { return m_pRules[i_iRule].szGlob; };
+	uint32_t GetRuleMode(int i_iRule, bool i_bDirectory);
+
+	//index of the first matching rule, -1 if none
+	int Classify(const char *i_szName, int i_iLen, bool i_bDirectory);
+private:
+	enum E_GlobKind { GLOB_ONE = 0, GLOB_STAR, GLOB_DIRS, GLOB_ANY, GLOB_ACCEPT };
+	struct S_GlobPosition
+	{
+		uint8_t iKind;
+		uint8_t pClass[32]; //characters matched by GLOB_ONE/GLOB_STAR
+		int iRule;          //for GLOB_ACCEPT
+	};
+	struct S_Rule
+	{
+		char *szGlob;
+		uint32_t iMode;
+		E_RuleType eType;
+	};
+
+	S_GlobPosition *NewPosition(uint8_t i_iKind);
+	void ResetAutomaton();
+	void Closure(uint32_t *io_pSet);
+	int FindOrAddState(const uint32_t *i_pSet);
+	int Step(int i_iState, uint8_t i_iChar);
+
+	S_Rule *m_pRules;
+	int m_iNumRules, m_iRuleCapacity;
+	S_GlobPosition *m_pPositions;
+	int m_iNumPositions, m_iPositionCapacity;
+
+	//DFA states, each is a set of positions. transitions are filled in when first
+	// taken, -1 is not known yet
+	int m_iSetWords;
+	uint32_t *m_pStateSets;
+	int *m_pTransitions;
+	int *m_pAcceptFile, *m_pAcceptDir; //first rule accepted for a file/directory
+	uint32_t *m_pStateHashes;
+	int m_iNumStates, m_iStateCapacity;
+	//open addressing hash table of state index+1 by set
+	int *m_pStateIndex;
+	uint32_t m_iStateIndexMask;
+	uint32_t *m_pStepSet; //scratch
+};
+
+C_PermissionPolicy::C_PermissionPolicy()
+{
+	m_pRules = NULL;
+	m_iNumRules = m_iRuleCapacity = 0;
+	m_pPositions = NULL;
+	m_iNumPositions = m_iPositionCapacity = 0;
+	m_iSetWords = 0;
+	m_pStateSets = NULL;
+	m_pTransitions = NULL;
+	m_pAcceptFile = m_pAcceptDir = NULL;
+	m_pStateHashes = NULL;
+	m_iNumStates = m_iStateCapacity = 0;
+	m_pStateIndex = NULL;
+	m_iStateIndexMask = 0;
+	m_pStepSet = NULL;
+}
+
+C_PermissionPolicy::~C_PermissionPolicy()
+{
+	ResetAutomaton();
+	for(int i=0; i<m_iNumRules; i++) delete[] m_pRules[i].szGlob;
+	delete[] m_pRules;
+	delete[] m_pPositions;
+}
+
+C_PermissionPolicy::S_GlobPosition *C_PermissionPolicy::NewPosition(uint8_t i_iKind)
+{
+	if(m_iNumPositions==m_iPositionCapacity) {
+		m_iPositionCapacity = m_iPositionCapacity ? m_iPositionCapacity*2 : 64;
+		S_GlobPosition *pNew = new S_GlobPosition[m_iPositionCapacity];
+		if(m_iNumPositions) memcpy(pNew, m_pPositions, m_iNumPositions*sizeof(S_GlobPosition));
+		delete[] m_pPositions;
+		m_pPositions = pNew;
+	}
+	S_GlobPosition *pPos = &m_pPositions[m_iNumPositions++];
+	memset(pPos, 0, sizeof(S_GlobPosition));
+	pPos->iKind = i_iKind;
+	return pPos;
+}
+
+bool C_PermissionPolicy::AddRule(const char *i_szGlob, uint32_t i_iMode, E_RuleType i_eType)
+{
+	if(i_iMode > 07777 || i_szGlob[0]==0) return false;
+	ResetAutomaton(); //positions change
+	int iFirstPosition = m_iNumPositions;
+
+	//compile the glob to positions, followed by the accepting position of the rule
+	for(const char *p = i_szGlob; *p; ) {
+		bool bSegmentStart = p==i_szGlob || p[-1]=='/';
+		if(bSegmentStart && p[0]=='*' && p[1]=='*' && p[2]=='/') {
+			NewPosition(GLOB_DIRS);
+			p += 3;
+		} else if(bSegmentStart && p[0]=='*' && p[1]=='*' && p[2]==0) {
+			//at least one character, "dir/**" does not match "dir/"
+			S_GlobPosition *pPos = NewPosition(GLOB_ONE);
+			memset(pPos->pClass, 0xff, sizeof(pPos->pClass));
+			NewPosition(GLOB_ANY);
+			p += 2;
+		} else if(*p=='*') {
+			S_GlobPosition *pPos = NewPosition(GLOB_STAR);
+			memset(pPos->pClass, 0xff, sizeof(pPos->pClass));
+			pPos->pClass['/'>>3] &= ~(1<<('/'&7));
+			while(*p=='*') p++;
+		} else if(*p=='?') {
+			S_GlobPosition *pPos = NewPosition(GLOB_ONE);
+			memset(pPos->pClass, 0xff, sizeof(pPos->pClass));
+			pPos->pClass['/'>>3] &= ~(1<<('/'&7));
+			p++;
+		} else if(*p=='[' && strchr(p+2, ']')) {
+			S_GlobPosition *pPos = NewPosition(GLOB_ONE);
+			p++;
+			bool bNegate = *p=='!' || *p=='^';
+			if(bNegate) p++;
+			//a ']' first in the set is a member
+			do {
+				uint8_t iFrom = (uint8_t)*p, iTo = iFrom;
+				if(p[1]=='-' && p[2] && p[2]!=']') {
+					iTo = (uint8_t)p[2];
+					p += 2;
+				}
+				for(int c=iFrom; c<=iTo; c++) pPos->pClass[c>>3] |= 1<<(c&7);
+				p++;
+			} while(*p && *p!=']');
+			if(*p!=']') {
+				m_iNumPositions = iFirstPosition;
+				return false;
+			}
+			p++;
+			if(bNegate) for(int i=0; i<32; i++) pPos->pClass[i] = ~pPos->pClass[i];
+			pPos->pClass['/'>>3] &= ~(1<<('/'&7));
+		} else {
+			if(*p=='\\' && p[1]) p++;
+			S_GlobPosition *pPos = NewPosition(GLOB_ONE);
+			uint8_t c = (uint8_t)*p++;
+			pPos->pClass[c>>3] |= 1<<(c&7);
+		}
+	}
+	NewPosition(GLOB_ACCEPT)->iRule = m_iNumRules;
+
+	if(m_iNumRules==m_iRuleCapacity) {
+		m_iRuleCapacity = m_iRuleCapacity ? m_iRuleCapacity*2 : 16;
+		S_Rule *pNew = new S_Rule[m_iRuleCapacity];
+		if(m_iNumRules) memcpy(pNew, m_pRules, m_iNumRules*sizeof(S_Rule));
+		delete[] m_pRules;
+		m_pRules = pNew;
+	}
+	int iLen = (int)strlen(i_szGlob);
+	m_pRules[m_iNumRules].szGlob = new char[iLen+1];
+	memcpy(m_pRules[m_iNumRules].szGlob, i_szGlob, iLen+1);
+	m_pRules[m_iNumRules].iMode = i_iMode;
+	m_pRules[m_iNumRules].eType = i_eType;
+	m_iNumRules++;
+	return true;
+}
+
+uint32_t C_PermissionPolicy::GetRuleMode(int i_iRule, bool i_bDirectory)
+{
+	uint32_t iMode = m_pRules[i_iRule].iMode;
+	if(i_bDirectory && m_pRules[i_iRule].eType==RULE_ANY) iMode |= (iMode & 0444) >> 2;
+	return iMode;
+}
+
+//next whitespace separated token of a policy line, "" quotes spaces
+static char *NextPolicyToken(char **io_pLine)
+{
+	char *p = *io_pLine;
+	while(*p==' ' || *p=='\t') p++;
+	if(*p==0) return NULL;
+	char *szToken = p;
+	if(*p=='"') {
+		szToken = ++p;
+		while(*p && *p!='"') p++;
+	} else {
+		while(*p && *p!=' ' && *p!='\t') p++;
+	}
+	if(*p) *p++ = 0;
+	*io_pLine = p;
+	return szToken;
+}
+
+bool C_PermissionPolicy::Load(const char *i_szPolicyFile)
+{
+	FILE *pFile = fopen(i_szPolicyFile, "rb");
+	if(pFile == NULL) {
+		LogPrintf("error: could not open policy file (%s)\n", i_szPolicyFile);
+		return false;
+	}
+
+	bool bResult = true;
+	char szLine[4096];
+	for(int iLine = 1; fgets(szLine, sizeof(szLine), pFile); iLine++) {
+		int iLen = (int)strlen(szLine);
+		while(iLen>0 && (szLine[iLen-1]=='\n' || szLine[iLen-1]=='\r')) szLine[--iLen] = 0;
+		char *pLine = szLine;
+		char *szGlob = NextPolicyToken(&pLine);
+		if(szGlob == NULL || szGlob[0]=='#') continue;
+
+		char *szMode = NextPolicyToken(&pLine);
+		if(szMode && (strcmp(szMode, "->")==0 || strcmp(szMode, "\xe2\x86\x92")==0)) szMode = NextPolicyToken(&pLine); //arrow is optional
+		char *szType = NextPolicyToken(&pLine);
+		char *szEnd = NULL;
+		uint32_t iMode = szMode ? (uint32_t)strtoul(szMode, &szEnd, 8) : 0;
+		E_RuleType eType = RULE_ANY;
+		if(szType && strcmp(szType, "file")==0) eType = RULE_FILE;
+		else if(szType && strcmp(szType, "dir")==0) eType = RULE_DIR;
+		else if(szType && szType[0]!='#') szEnd = NULL;
+
+		if(szMode == NULL || szEnd == szMode || szEnd == NULL || *szEnd != 0 || !AddRule(szGlob, iMode, eType)) {
+			LogPrintf("error: invalid rule in policy file (%s:%d)\n", i_szPolicyFile, iLine);
+			bResult = false;
+			break;
+		}
+	}
+	fclose(pFile);
+	return bResult;
+}
+
+void C_PermissionPolicy::ResetAutomaton()
+{
+	delete[] m_pStateSets;   m_pStateSets   = NULL;
+	delete[] m_pTransitions; m_pTransitions = NULL;
+	delete[] m_pAcceptFile;  m_pAcceptFile  = NULL;
+	delete[] m_pAcceptDir;   m_pAcceptDir   = NULL;
+	delete[] m_pStateHashes; m_pStateHashes = NULL;
+	delete[] m_pStateIndex;  m_pStateIndex  = NULL;
+	delete[] m_pStepSet;     m_pStepSet     = NULL;
+	m_iNumStates = m_iStateCapacity = 0;
+	m_iStateIndexMask = 0;
+	m_iSetWords = 0;
+}
+
+void C_PermissionPolicy::Closure(uint32_t *io_pSet)
+{
+	//a position that matches zero characters also makes the next one active, that
+	// is always forward so one pass in order is enough
+	for(int i=0; i<m_iNumPositions; i++) {
+		if(!(io_pSet[i>>5] & (1u<<(i&31)))) continue;
+		uint8_t iKind = m_pPositions[i].iKind;
+		if(iKind==GLOB_STAR || iKind==GLOB_DIRS || iKind==GLOB_ANY) io_pSet[(i+1)>>5] |= 1u<<((i+1)&31);
+	}
+}
+
+int C_PermissionPolicy::FindOrAddState(const uint32_t *i_pSet)
+{
+	uint32_t iHash = 2166136261u;
+	for(int i=0; i<m_iSetWords; i++) {
+		iHash ^= i_pSet[i];
+		iHash *= 16777619u;
+	}
+	uint32_t iSlot = iHash & m_iStateIndexMask;
+	while(m_pStateIndex[iSlot]) {
+		int iState = m_pStateIndex[iSlot]-1;
+		if(m_pStateHashes[iState]==iHash && memcmp(m_pStateSets+iState*m_iSetWords, i_pSet, m_iSetWords*sizeof(uint32_t))==0) return iState;
+		iSlot = (iSlot+1) & m_iStateIndexMask;
+	}
+
+	if(m_iNumStates==m_iStateCapacity) {
+		//grow all state arrays and rebuild the index
+		int iCapacity = m_iStateCapacity*2;
+		uint32_t *pSets = new uint32_t[iCapacity*m_iSetWords];
+		int *pTransitions = new int[iCapacity*256];
+		int *pAcceptFile = new int[iCapacity];
+		int *pAcceptDir = new int[iCapacity];
+		uint32_t *pHashes = new uint32_t[iCapacity];
+		memcpy(pSets, m_pStateSets, m_iNumStates*m_iSetWords*sizeof(uint32_t));
+		memcpy(pTransitions, m_pTransitions, m_iNumStates*256*sizeof(int));
+		memcpy(pAcceptFile, m_pAcceptFile, m_iNumStates*sizeof(int));
+		memcpy(pAcceptDir, m_pAcceptDir, m_iNumStates*sizeof(int));
+		memcpy(pHashes, m_pStateHashes, m_iNumStates*sizeof(uint32_t));
+		delete[] m_pStateSets;   m_pStateSets   = pSets;
+		delete[] m_pTransitions; m_pTransitions = pTransitions;
+		delete[] m_pAcceptFile;  m_pAcceptFile  = pAcceptFile;
+		delete[] m_pAcceptDir;   m_pAcceptDir   = pAcceptDir;
+		delete[] m_pStateHashes; m_pStateHashes = pHashes;
+		m_iStateCapacity = iCapacity;
+
+		delete[] m_pStateIndex;
+		m_iStateIndexMask = iCapacity*2-1;
+		m_pStateIndex = new int[iCapacity*2];
+		memset(m_pStateIndex, 0, iCapacity*2*sizeof(int));
+		for(int i=0; i<m_iNumStates; i++) {
+			uint32_t iOtherSlot = m_pStateHashes[i] & m_iStateIndexMask;
+			while(m_pStateIndex[iOtherSlot]) iOtherSlot = (iOtherSlot+1) & m_iStateIndexMask;
+			m_pStateIndex[iOtherSlot] = i+1;
+		}
+		iSlot = iHash & m_iStateIndexMask;
+		while(m_pStateIndex[iSlot]) iSlot = (iSlot+1) & m_iStateIndexMask;
+	}
+
+	int iState = m_iNumStates++;
+	memcpy(m_pStateSets+iState*m_iSetWords, i_pSet, m_iSetWords*sizeof(uint32_t));
+	for(int i=0; i<256; i++) m_pTransitions[iState*256+i] = -1;
+	m_pStateHashes[iState] = iHash;
+	m_pStateIndex[iSlot] = iState+1;
+	//first accepted rule, rules are ordered
+	m_pAcceptFile[iState] = -1;
+	m_pAcceptDir[iState] = -1;
+	for(int i=0; i<m_iNumPositions; i++) {
+		if(m_pPositions[i].iKind!=GLOB_ACCEPT || !(i_pSet[i>>5] & (1u<<(i&31)))) continue;
+		int iRule = m_pPositions[i].iRule;
+		if(m_pAcceptFile[iState]<0 && m_pRules[iRule].eType!=RULE_DIR) m_pAcceptFile[iState] = iRule;
+		if(m_pAcceptDir[iState]<0 && m_pRules[iRule].eType!=RULE_FILE) m_pAcceptDir[iState] = iRule;
+	}
+	return iState;
+}
+
+int C_PermissionPolicy::Step(int i_iState, uint8_t i_iChar)
+{
+	int iNext = m_pTransitions[i_iState*256+i_iChar];
+	if(iNext >= 0) return iNext;
+
+	const uint32_t *pSet = m_pStateSets+i_iState*m_iSetWords;
+	memset(m_pStepSet, 0, m_iSetWords*sizeof(uint32_t));
+	for(int i=0; i<m_iNumPositions; i++) {
+		if(!(pSet[i>>5] & (1u<<(i&31)))) continue;
+		const S_GlobPosition *pPos = &m_pPositions[i];
+		bool bInClass = (pPos->pClass[i_iChar>>3] & (1<<(i_iChar&7))) != 0;
+		int iTo = -1;
+		switch(pPos->iKind) {
+			case GLOB_ONE:  if(bInClass) iTo = i+1; break;
+			case GLOB_STAR: if(bInClass) iTo = i; break;
+			case GLOB_ANY:  iTo = i; break;
+			case GLOB_DIRS:
+				iTo = i;
+				if(i_iChar=='/') m_pStepSet[(i+1)>>5] |= 1u<<((i+1)&31);
+				break;
+		}
+		if(iTo >= 0) m_pStepSet[iTo>>5] |= 1u<<(iTo&31);
+	}
+	Closure(m_pStepSet);
+	iNext = FindOrAddState(m_pStepSet); //may move the state arrays
+	m_pTransitions[i_iState*256+i_iChar] = iNext;
+	return iNext;
+}
+
+int C_PermissionPolicy::Classify(const char *i_szName, int i_iLen, bool i_bDirectory)
+{
+	if(m_iNumRules==0) return -1;
+	//the DFA is kept between names, but not without bound
+	if(m_iNumStates > 4096) ResetAutomaton();
+	if(m_pStateSets == NULL) {
+		m_iSetWords = (m_iNumPositions+31)/32;
+		m_iStateCapacity = 64;
+		m_pStateSets = new uint32_t[m_iStateCapacity*m_iSetWords];
+		m_pTransitions = new int[m_iStateCapacity*256];
+		m_pAcceptFile = new int[m_iStateCapacity];
+		m_pAcceptDir = new int[m_iStateCapacity];
+		m_pStateHashes = new uint32_t[m_iStateCapacity];
+		m_iStateIndexMask = m_iStateCapacity*2-1;
+		m_pStateIndex = new int[m_iStateCapacity*2];
+		memset(m_pStateIndex, 0, m_iStateCapacity*2*sizeof(int));
+		m_pStepSet = new uint32_t[m_iSetWords];
+
+		//state 0 is the start of all rules, state 1 is dead (nothing can match)
+		memset(m_pStepSet, 0, m_iSetWords*sizeof(uint32_t));
+		for(int i=0; i<m_iNumPositions; i++) {
+			if(i==0 || m_pPositions[i-1].iKind==GLOB_ACCEPT) m_pStepSet[i>>5] |= 1u<<(i&31);
+		}
+		Closure(m_pStepSet);
+		FindOrAddState(m_pStepSet);
+		memset(m_pStepSet, 0, m_iSetWords*sizeof(uint32_t));
+		FindOrAddState(m_pStepSet);
+	}
+
+	int iState = 0;
+	for(int i=0; i<i_iLen && iState!=1; i++) iState = Step(iState, (uint8_t)i_szName[i]);
+	//a directory (by attributes) without a trailing '/' in its name
+	if(i_bDirectory && iState!=1 && (i_iLen==0 || i_szName[i_iLen-1]!='/')) iState = Step(iState, '/');
+	return i_bDirectory ? m_pAcceptDir[iState] : m_pAcceptFile[iState];
+}
+
+/////////////
+
+//commandline options
+struct S_ListFilter;
+
+struct S_Options
+{
+	bool bInPlace; //only overwrite the CD of the zip instead of rewriting all of it
+	bool bStream;  //read the zip from stdin and write it to stdout
+	C_PermissionPolicy *pclPolicy; //applied before the files to set executable, or NULL
+	bool bCreate;  //create the zip from a directory
+	int iLevel;    //compression level when creating, 0 stores
+	int iThreads;  //0 means one per core
+	bool bVerify;  //check the entries of the zip (after modifying or creating it)
+	bool bSyncLocal; //also set the version needed of the local headers
+	bool bDigest;  //print the sha-256 of the CD
+	bool bExitUnchanged; //exit status 3 when no archive needed to be written
+	C_TargetList *pclAddNames, *pclAddFiles; //--add, names in the zip and the files, or NULL
+	bool bCompact; //leave out the local data no entry refers to
+	S_ListFilter *pList; //--list, only list the entries, or NULL
+};
+
+void PrintDigest(C_ZipFile *i_pclZip)
+{
+	uint8_t pDigest[32];
+	char szDigest[65];
+	i_pclZip->GetCDDigest(pDigest);
+	for(int i=0; i<32; i++) sprintf(szDigest+i*2, "%02x", pDigest[i]);
+	LogPrintf("cd digest %s\n", szDigest);
+}
+
+void ApplyPolicy(C_ZipFile *i_pclZip, C_PermissionPolicy *i_pclPolicy)
+{
+	//one pass over the CD, every entry is classified by the compiled rules
+	int iNumRules = i_pclPolicy->GetNumRules();
+	int *pRuleHits = new int[iNumRules];
+	memset(pRuleHits, 0, iNumRules*sizeof(int));
+	int iNumSet = 0, iNumEntries = 0;
+	for(int i=0; i<i_pclZip->GetNumFiles(); i++) {
+		if(i_pclZip->IsReplaced(i)) continue;
+		iNumEntries++;
+		const char *szName = i_pclZip->GetFileName(i);
+		int iRule = i_pclPolicy->Classify(szName, (int)strlen(szName), i_pclZip->IsDirectory(i));
+		if(iRule < 0) continue;
+		i_pclZip->SetUnixMode(i, i_pclPolicy->GetRuleMode(iRule, i_pclZip->IsDirectory(i)));
+		pRuleHits[iRule]++;
+		iNumSet++;
+	}
+	//and the files added
+	for(int i=0; i<i_pclZip->GetNumAdded(); i++) {
+		iNumEntries++;
+		const char *szName = i_pclZip->GetAddedName(i);
+		int iRule = i_pclPolicy->Classify(szName, (int)strlen(szName), false);
+		if(iRule < 0) continue;
+		i_pclZip->SetAddedMode(i, i_pclPolicy->GetRuleMode(iRule, false));
+		pRuleHits[iRule]++;
+		iNumSet++;
+	}
+	for(int i=0; i<iNumRules; i++) {
+		if(pRuleHits[i]==0) LogPrintf("warning: policy rule \"%s\" matched no entries\n", i_pclPolicy->GetRuleGlob(i));
+	}
+	LogPrintf("set %d of %d entries by policy (%d rules)\n", iNumSet, iNumEntries, iNumRules);
+	delete[] pRuleHits;
+}
+
+bool SetFilesExecutable(C_ZipFile *i_pclZip, C_TargetList *i_pclFilesToFix)
+{
+	//change the given files to unix executable, other files and directories will
+	// be set to unix attributes as well. all files are applied to the same loaded
+	// zip so it is only read and written once.
+	int iNumSet = 0;
+	for(int i=0; i<i_pclFilesToFix->GetNum(); i++) {
+		char *szFile = i_pclFilesToFix->Get(i);
+		int iAdded = i_pclZip->FindAdded(szFile);
+		if(iAdded >= 0) i_pclZip->SetAddedMode(iAdded, 0755);
+		if(iAdded >= 0 || i_pclZip->SetExecutable(szFile)) {
+			LogPrintf("set \"%s\" executable\n", szFile);
+			iNumSet++;
+		} else {
+			LogPrintf("error: could not set \"%s\" executable (not found)\n", szFile);
+		}
+	}
+	if(iNumSet != i_pclFilesToFix->GetNum()) {
+		LogPrintf("error: %d of %d files not found in archive\n", i_pclFilesToFix->GetNum()-iNumSet, i_pclFilesToFix->GetNum());
+		return false;
+	}
+	return true;
+}
+
+bool AddFiles(C_ZipFile *i_pclZip, C_TargetList *i_pclNames, C_TargetList *i_pclFiles)
+{
+	//written when the zip is saved, modes are set by the policy and the files to
+	// set executable after this
+	for(int i=0; i<i_pclNames->GetNum(); i++) {
+		bool bReplace = i_pclZip->FindFileIndexInCD(i_pclNames->Get(i)) >= 0;
+		if(!i_pclZip->AddFile(i_pclNames->Get(i), i_pclFiles->Get(i))) {
+			LogPrintf("error: could not add \"%s\"\n", i_pclNames->Get(i));
+			return false;
+		}
+		LogPrintf("%s \"%s\" from \"%s\"\n", bReplace ? "replacing" : "adding", i_pclNames->Get(i), i_pclFiles->Get(i));
+	}
+	return true;
+}
+
+bool FixZipFlags(char *i_szZipFile, char *i_szNewZipFile, C_TargetList *i_pclFilesToFix, S_Options *i_pstOptions, bool *o_pUnchanged)
+{
+	bool bResult = false; //assume error
+	*o_pUnchanged = false;
+
+	C_StatsPhase clPhase;
+	C_ZipFile *pclZip = new C_ZipFile();
+	pclZip->SetParseThreads(i_pstOptions->iThreads);
+	//open zip
+	if(pclZip->Open(i_szZipFile)) {
+		pclZip->SetSyncLocalHeaders(i_pstOptions->bSyncLocal);
+		pclZip->SetAddOptions(i_pstOptions->iLevel, i_pstOptions->iThreads);
+		pclZip->SetCompact(i_pstOptions->bCompact);
+		clPhase.Start(STATS_MODIFY);
+		if(i_pstOptions->pclAddNames && !AddFiles(pclZip, i_pstOptions->pclAddNames, i_pstOptions->pclAddFiles)) goto out;
+		if(i_pstOptions->pclPolicy) ApplyPolicy(pclZip, i_pstOptions->pclPolicy);
+		if(!SetFilesExecutable(pclZip, i_pclFilesToFix)) goto out;
+		clPhase.End();
+
+		//save changed zip
+		if(i_pstOptions->bInPlace) {
+			if(strcmp(i_szZipFile, i_szNewZipFile) != 0 || !pclZip->SaveInPlace(i_szNewZipFile)) {
+				LogPrintf("error: could not update zip file in place (%s)\n", i_szNewZipFile);
+				goto out;
+			}
+		} else if(!pclZip->Save(i_szNewZipFile)) {
+			LogPrintf("error: could not save output zip file (%s)\n", i_szNewZipFile);
+			goto out;
+		}
+		if(pclZip->WasSaveSkipped()) {
+			LogPrintf("unchanged, not written (%s)\n", i_szNewZipFile);
+			*o_pUnchanged = true;
+		}
+		if(i_pstOptions->bDigest) PrintDigest(pclZip);
+		bResult = true;
+	}
+
+out:
+	delete pclZip;
+	return bResult;
+}
+
+/////////////
+//streaming, the zip is read from stdin and written to stdout. local records are
+// passed through as they are read, only the CD at the end is kept in memory.
+//records with their sizes in a data descriptor after the data (what zip writes to
+// a pipe) end where the deflate stream ends, or for stored data where a descriptor
+// follows that matches the length and crc so far.
+
+static bool StreamCopy(C_Resource *i_pclIn, C_Resource *i_pclOut, uint64_t i_iLength, uint8_t *i_pBuffer, uint32_t i_iBufferSize)
+{
+	while(i_iLength > 0) {
+		uint32_t iLen = i_iLength < i_iBufferSize ? (uint32_t)i_iLength : i_iBufferSize;
+		if(!i_pclIn->Read(i_pBuffer, iLen)) return false;
+		if(!i_pclOut->Write(i_pBuffer, iLen)) return false;
+		i_iLength -= iLen;
+	}
+	return true;
+}
+
+static bool StreamWrite(C_Resource *i_pclOut, uint8_t *i_pData, uint64_t i_iLength)
+{
+	//a single write is never more than 4GB
+	while(i_iLength > 0) {
+		uint32_t iLen = i_iLength < 0x80000000u ? (uint32_t)i_iLength : 0x80000000u;
+		if(!i_pclOut->Write(i_pData, iLen)) return false;
+		i_pData += iLen;
+		i_iLength -= iLen;
+	}
+	return true;
+}
+
+static void AppendBuffer(uint8_t **io_pData, uint64_t *io_iLength, uint64_t *io_iCapacity, const uint8_t *i_pAdd, uint64_t i_iLength)
+{
+	if(*io_iLength + i_iLength > *io_iCapacity) {
+		uint64_t iCapacity = *io_iCapacity ? *io_iCapacity : 65536;
+		while(iCapacity < *io_iLength + i_iLength) iCapacity *= 2;
+		uint8_t *pNew = new uint8_t[iCapacity];
+		if(*io_iLength) memcpy(pNew, *io_pData, *io_iLength);
+		delete[] *io_pData;
+		*io_pData = pNew;
+		*io_iCapacity = iCapacity;
+	}
+	memcpy(*io_pData + *io_iLength, i_pAdd, i_iLength);
+	*io_iLength += i_iLength;
+}
+
+static bool StreamStoredData(C_Resource *i_pclIn, C_Resource *i_pclOut, bool i_bZip64, uint8_t *i_pBuffer, uint32_t i_iBufferSize, uint64_t *o_iCSize, uint32_t *o_iCrc)
+{
+	//a descriptor is crc and both sizes, with or without its signature; without it
+	// the next record has to start right after it. the buffer keeps enough after
+	// every position to check both
+	const uint32_t iSizeLen = i_bZip64 ? 8 : 4;
+	const uint32_t iLookahead = 4+4+2*iSizeLen+4;
+	uint32_t iLength = 0, iCrc = 0;
+	uint64_t iBase = 0; //data bytes before i_pBuffer[0]
+	bool bEnd = false;
+	while(true) {
+		if(!bEnd && iLength < i_iBufferSize) {
+			uint32_t iGot = i_pclIn->ReadSome(i_pBuffer+iLength, i_iBufferSize-iLength);
+			if(iGot < i_iBufferSize-iLength) bEnd = true;
+			iLength += iGot;
+		}
+		uint32_t iScanEnd = bEnd ? iLength : (iLength > iLookahead ? iLength-iLookahead : 0);
+		uint32_t iCrcPos = 0;
+		for(uint32_t iPos = 0; iPos < iScanEnd; iPos++) {
+			const uint8_t *p = i_pBuffer+iPos;
+			uint32_t iLeft = iLength-iPos;
+			uint64_t iAt = iBase+iPos;
+			const uint8_t *pDescriptor = NULL;
+			if(iLeft >= 4+4+2*iSizeLen && LoadLittleEndian<uint32_t>(p) == 0x08074b50) {
+				if((i_bZip64 ? LoadLittleEndian<uint64_t>(p+8) : LoadLittleEndian<uint32_t>(p+8)) == iAt) pDescriptor = p+4;
+			}
+			if(!pDescriptor && iLeft >= 4+2*iSizeLen+4) {
+				uint32_t iNext = LoadLittleEndian<uint32_t>(p+4+2*iSizeLen);
+				if((iNext == 0x04034b50 || iNext == 0x02014b50)
+					&& (i_bZip64 ? LoadLittleEndian<uint64_t>(p+4) : LoadLittleEndian<uint32_t>(p+4)) == iAt) pDescriptor = p;
+			}
+			if(!pDescriptor) continue;
+			//the data before a candidate is data in any case
+			iCrc = Crc32Update(iCrc, i_pBuffer+iCrcPos, iPos-iCrcPos);
+			iCrcPos = iPos;
+			if(LoadLittleEndian<uint32_t>(pDescriptor) != iCrc) continue;
+			if(!i_pclOut->Write(i_pBuffer, iPos)) return false;
+			i_pclIn->Unread(p, iLeft);
+			*o_iCSize = iAt;
+			*o_iCrc = iCrc;
+			return true;
+		}
+		if(bEnd) return false;
+		iCrc = Crc32Update(iCrc, i_pBuffer+iCrcPos, iScanEnd-iCrcPos);
+		if(!i_pclOut->Write(i_pBuffer, iScanEnd)) return false;
+		memmove(i_pBuffer, i_pBuffer+iScanEnd, iLength-iScanEnd);
+		iLength -= iScanEnd;
+		iBase += iScanEnd;
+	}
+}
+
+bool FixZipFlagsStream(FILE *i_pOutput, C_TargetList *i_pclFilesToFix, S_Options *i_pstOptions)
+{
+	bool bResult = false;
+	C_Resource clIn, clOut;
+	clIn.SetHandle(stdin);
+	clOut.SetMode(false);
+	clOut.SetHandle(i_pOutput);
+
+	const uint32_t iBufferSize = 1024*1024;
+	uint8_t *pBuffer = new uint8_t[iBufferSize];
+	uint8_t *pRest = NULL; //everything after the last local record that was passed through
+	uint64_t iRestLen = 0, iRestCapacity = 0;
+	uint64_t iPos = 0; //bytes passed through
+	C_Inflater *pclInflater = NULL;
+	C_ZipFile clZip;
+	clZip.SetParseThreads(i_pstOptions->iThreads);
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_STREAM);
+
+	//pass the local records through. anything that is not a local record (the CD),
+	// or a record which length can not be found (not stored or deflated, encrypted),
+	// ends this and the rest is kept in memory
+	while(true) {
+		uint8_t pHeader[sizeof(S_LocalFileHeader)];
+		S_LocalFileHeader stHeader;
+		uint32_t iGot = clIn.ReadSome(pHeader, 4);
+		if(iGot == 4 && LoadLittleEndian<uint32_t>(pHeader) == 0x04034b50) iGot += clIn.ReadSome(pHeader+4, sizeof(pHeader)-4);
+		if(iGot < sizeof(pHeader)) {
+			AppendBuffer(&pRest, &iRestLen, &iRestCapacity, pHeader, iGot);
+			break;
+		}
+		DecodeRecord(pHeader, &stHeader);
+		uint32_t iNameExtraLen = (uint32_t)stHeader.name_len + stHeader.extra_len;
+		iGot = clIn.ReadSome(pBuffer, iNameExtraLen);
+		if(iGot < iNameExtraLen) {
+			AppendBuffer(&pRest, &iRestLen, &iRestCapacity, pHeader, sizeof(pHeader));
+			AppendBuffer(&pRest, &iRestLen, &iRestCapacity, pBuffer, iGot);
+			break;
+		}
+
+		//the sizes may be in the zip64 extra field (both sizes, in this order)
+		uint64_t iCSize = stHeader.c_size;
+		bool bZip64 = false;
+		const uint8_t *pExtra = pBuffer+stHeader.name_len;
+		for(int iExtraPos = 0; iExtraPos+4 <= stHeader.extra_len; ) {
+			uint16_t iId  = LoadLittleEndian<uint16_t>(pExtra+iExtraPos);
+			uint16_t iLen = LoadLittleEndian<uint16_t>(pExtra+iExtraPos+2);
+			if(iExtraPos+4+iLen > stHeader.extra_len) break;
+			if(iId == 0x0001 && iLen >= 16) {
+				bZip64 = true;
+				if(stHeader.c_size == 0xffffffff) iCSize = LoadLittleEndian<uint64_t>(pExtra+iExtraPos+4+8);
+			}
+			iExtraPos += 4+iLen;
+		}
+		//sizes after the data (data descriptor), the length is found from the data
+		bool bDescriptor = (stHeader.gp_flag & 0x0008) != 0;
+		bool bFind = (bDescriptor && iCSize == 0) || iCSize == 0xffffffff;
+		if(bFind && ((stHeader.c_method != 8 && !(stHeader.c_method == 0 && bDescriptor)) || (stHeader.gp_flag & 0x0001))) {
+			AppendBuffer(&pRest, &iRestLen, &iRestCapacity, pHeader, sizeof(pHeader));
+			AppendBuffer(&pRest, &iRestLen, &iRestCapacity, pBuffer, iNameExtraLen);
+			break;
+		}
+
+		char szName[256];
+		snprintf(szName, sizeof(szName), "%.*s", (int)stHeader.name_len, (char *)pBuffer);
+		if(!clOut.Write(pHeader, sizeof(pHeader)) || !clOut.Write(pBuffer, iNameExtraLen)) {
+			LogPrintf("error: could not pass through \"%s\"\n", szName);
+			goto out;
+		}
+		uint32_t iFoundCrc = 0;
+		if(!bFind) {
+			if(!StreamCopy(&clIn, &clOut, iCSize, pBuffer, iBufferSize)) {
+				LogPrintf("error: could not pass through \"%s\"\n", szName);
+				goto out;
+			}
+		} else if(stHeader.c_method == 8) {
+			if(!pclInflater) pclInflater = new C_Inflater();
+			uint64_t iSize;
+			const uint8_t *pUnused;
+			if(!pclInflater->Inflate(&clIn, C_Inflater::UNKNOWN_SIZE, &iSize, &iFoundCrc, NULL, &clOut)) {
+				LogPrintf("error: could not pass through \"%s\" (%s)\n", szName, pclInflater->GetError());
+				goto out;
+			}
+			iCSize = pclInflater->GetCompressedSize();
+			uint32_t iUnused = pclInflater->GetUnusedInput(&pUnused);
+			clIn.Unread(pUnused, iUnused);
+		} else if(!StreamStoredData(&clIn, &clOut, bZip64, pBuffer, iBufferSize, &iCSize, &iFoundCrc)) {
+			LogPrintf("error: could not pass through \"%s\" (end of the stored data not found)\n", szName);
+			goto out;
+		}
+		iPos += sizeof(pHeader) + iNameExtraLen + iCSize;
+
+		if(bDescriptor) {
+			//crc, compressed and uncompressed size, optionally with a signature first
+			uint8_t pDescriptor[24];
+			uint32_t iLen = bZip64 ? 20 : 12;
+			bool bOK = clIn.Read(pDescriptor, 4);
+			if(bOK && LoadLittleEndian<uint32_t>(pDescriptor) == 0x08074b50) {
+				bOK = clIn.Read(pDescriptor+4, iLen);
+				iLen += 4;
+			} else if(bOK) {
+				bOK = clIn.Read(pDescriptor+4, iLen-4);
+			}
+			if(!bOK || !clOut.Write(pDescriptor, iLen)) {
+				LogPrintf("error: could not pass through data descriptor\n");
+				goto out;
+			}
+			//a found length must be the one of the descriptor
+			const uint8_t *pValues = pDescriptor+iLen-(bZip64 ? 20 : 12);
+			if(bFind && (LoadLittleEndian<uint32_t>(pValues) != iFoundCrc
+				|| (bZip64 ? LoadLittleEndian<uint64_t>(pValues+4) : LoadLittleEndian<uint32_t>(pValues+4)) != iCSize))
+			{
+				LogPrintf("error: data descriptor of \"%s\" does not match its data\n", szName);
+				goto out;
+			}
+			iPos += iLen;
+		}
+	}
+
+	//the rest, CD and end records
+	while(true) {
+		uint32_t iGot = clIn.ReadSome(pBuffer, iBufferSize);
+		if(iGot == 0) break;
+		AppendBuffer(&pRest, &iRestLen, &iRestCapacity, pBuffer, iGot);
+	}
+	clPhase.End();
+	if(!clZip.OpenMemory(pRest, iRestLen, iPos)) goto out;
+	if(clZip.GetCDStart() < iPos) {
+		LogPrintf("error: central directory overlaps local data\n");
+		goto out;
+	}
+	clPhase.Start(STATS_MODIFY);
+	if(i_pstOptions->pclPolicy) ApplyPolicy(&clZip, i_pstOptions->pclPolicy);
+	if(!SetFilesExecutable(&clZip, i_pclFilesToFix)) goto out;
+
+	//whatever is between the last local record and the CD, then the changed CD
+	clPhase.Next(STATS_SAVE_CD);
+	if(!StreamWrite(&clOut, pRest, clZip.GetCDStart()-iPos) || !clZip.WriteCD(&clOut, clZip.GetCDStart())
+		|| fflush(i_pOutput) != 0)
+	{
+		LogPrintf("error: could not write output zip\n");
+		goto out;
+	}
+	if(i_pstOptions->bDigest) PrintDigest(&clZip);
+	bResult = true;
+
+out:
+	delete pclInflater;
+	delete[] pBuffer;
+	delete[] pRest;
+	return bResult;
+}
+
+/////////////
+//pool of worker threads. every worker has its own queue of tasks and takes the
+// oldest of it, when it is empty work is stolen from the other queues.
+
+class C_WorkPool
+{
+public:
+	typedef void (*T_TaskFunction)(void *i_pContext, int i_iWorker, int i_iTask);
+
+	C_WorkPool(int i_iNumThreads, T_TaskFunction i_pFunction, void *i_pContext); //0 threads means one per core
+	~C_WorkPool(); //runs all queued tasks first
+
+	int GetNumThreads() { return m_iNumThreads; };
+	void Submit(int i_iTask);
+	//tasks signal completion through a flag, which is waited for here
+	void Wait(const std::atomic<int> *i_pFlag);
+	void SignalDone(std::atomic<int> *i_pFlag);
+
+	static int GetNumCores();
+private:
+	struct S_Queue
+	{
+		std::mutex clLock;
+		int *pTasks; //ring buffer
+		int iHead, iNum, iCapacity;
+	};
+
+	void WorkerMain(int i_iWorker);
+	bool Take(S_Queue *i_pQueue, int *o_iTask);
+
+	int m_iNumThreads;
+	T_TaskFunction m_pFunction;
+	void *m_pContext;
+	std::thread *m_pThreads;
+	S_Queue *m_pQueues;
+	int m_iNextQueue;
+	//sleeping when there is no work
+	std::mutex m_clWorkLock;
+	std::condition_variable m_clWorkCond;
+	std::atomic<int> m_iNumQueued;
+	bool m_bStop;
+	//completion
+	std::mutex m_clDoneLock;
+	std::condition_variable m_clDoneCond;
+};
+
+int C_WorkPool::GetNumCores()
+{
+	int iNum = (int)std::thread::hardware_concurrency();
+	return iNum > 0 ? iNum : 1;
+}
+
+C_WorkPool::C_WorkPool(int i_iNumThreads, T_TaskFunction i_pFunction, void *i_pContext)
+{
+	m_iNumThreads = i_iNumThreads > 0 ? i_iNumThreads : GetNumCores();
+	m_pFunction = i_pFunction;
+	m_pContext = i_pContext;
+	m_iNextQueue = 0;
+	m_iNumQueued = 0;
+	m_bStop = false;
+	m_pQueues = new S_Queue[m_iNumThreads];
+	for(int i=0; i<m_iNumThreads; i++) {
+		m_pQueues[i].iCapacity = 64;
+		m_pQueues[i].pTasks = new int[m_pQueues[i].iCapacity];
+		m_pQueues[i].iHead = m_pQueues[i].iNum = 0;
+	}
+	m_pThreads = new std::thread[m_iNumThreads];
+	for(int i=0; i<m_iNumThreads; i++) m_pThreads[i] = std::thread(&C_WorkPool::WorkerMain, this, i);
+}
+
+C_WorkPool::~C_WorkPool()
+{
+	{
+		std::lock_guard<std::mutex> clLock(m_clWorkLock);
+		m_bStop = true;
+	}
+	m_clWorkCond.notify_all();
+	for(int i=0; i<m_iNumThreads; i++) m_pThreads[i].join();
+	delete[] m_pThreads;
+	for(int i=0; i<m_iNumThreads; i++) delete[] m_pQueues[i].pTasks;
+	delete[] m_pQueues;
+}
+
+void C_WorkPool::Submit(int i_iTask)
+{
+	//spread round robin, idle workers steal what is left behind
+	S_Queue *pQueue = &m_pQueues[m_iNextQueue];
+	m_iNextQueue = (m_iNextQueue+1) % m_iNumThreads;
+	{
+		std::lock_guard<std::mutex> clLock(pQueue->clLock);
+		if(pQueue->iNum == pQueue->iCapacity) {
+			int *pTasks = new int[pQueue->iCapacity*2];
+			for(int i=0; i<pQueue->iNum; i++) pTasks[i] = pQueue->pTasks[(pQueue->iHead+i) % pQueue->iCapacity];
+			delete[] pQueue->pTasks;
+			pQueue->pTasks = pTasks;
+			pQueue->iHead = 0;
+			pQueue->iCapacity *= 2;
+		}
+		pQueue->pTasks[(pQueue->iHead+pQueue->iNum) % pQueue->iCapacity] = i_iTask;
+		pQueue->iNum++;
+	}
+	{
+		std::lock_guard<std::mutex> clLock(m_clWorkLock);
+		m_iNumQueued++;
+	}
+	m_clWorkCond.notify_one();
+}
+
+bool C_WorkPool::Take(S_Queue *i_pQueue, int *o_iTask)
+{
+	std::lock_guard<std::mutex> clLock(i_pQueue->clLock);
+	if(i_pQueue->iNum == 0) return false;
+	*o_iTask = i_pQueue->pTasks[i_pQueue->iHead];
+	i_pQueue->iHead = (i_pQueue->iHead+1) % i_pQueue->iCapacity;
+	i_pQueue->iNum--;
+	m_iNumQueued--;
+	return true;
+}
+
+void C_WorkPool::WorkerMain(int i_iWorker)
+{
+	while(true) {
+		int iTask;
+		bool bFound = Take(&m_pQueues[i_iWorker], &iTask);
+		for(int i=1; i<m_iNumThreads && !bFound; i++) bFound = Take(&m_pQueues[(i_iWorker+i) % m_iNumThreads], &iTask);
+		if(bFound) {
+			m_pFunction(m_pContext, i_iWorker, iTask);
+			continue;
+		}
+		std::unique_lock<std::mutex> clLock(m_clWorkLock);
+		while(m_iNumQueued == 0 && !m_bStop) m_clWorkCond.wait(clLock);
+		if(m_iNumQueued == 0 && m_bStop) return;
+	}
+}
+
+void C_WorkPool::SignalDone(std::atomic<int> *i_pFlag)
+{
+	{
+		std::lock_guard<std::mutex> clLock(m_clDoneLock);
+		*i_pFlag = 1;
+	}
+	m_clDoneCond.notify_all();
+}
+
+void C_WorkPool::Wait(const std::atomic<int> *i_pFlag)
+{
+	std::unique_lock<std::mutex> clLock(m_clDoneLock);
+	while(*i_pFlag == 0) m_clDoneCond.wait(clLock);
+}
+
+/////////////
+//creating a zip from a directory tree. files are split in chunks which are
+// deflated in parallel (each with the 32K before it as history, so the result is
+// one deflate stream per file), the records are written in a fixed order (sorted
+// names, directories before their contents) and the CD gets unix attributes.
+
+struct S_BuildEntry
+{
+	char *szPath;        //on disk
+	char *szName;        //in the zip, directories end with '/'
+	bool bDirectory;
+	uint64_t iSize;
+	uint16_t iTime, iDate; //dos format
+	uint32_t iMode;      //unix permissions
+	int iFirstChunk, iNumChunks;
+	//known when written
+	uint16_t iMethod;
+	uint32_t iCrc;
+	uint64_t iCompressedSize;
+	uint64_t iOffset;
+};
+
+struct S_BuildChunk
+{
+	int iEntry;
+	uint64_t iPos;
+	uint32_t iLength;
+	//result
+	std::atomic<int> iDone;
+	bool bError;
+	uint32_t iCrc;
+	uint8_t *pOut;
+	uint32_t iOutLength;
+};
+
+class C_ZipBuilder
+{
+public:
+	C_ZipBuilder();
+	~C_ZipBuilder();
+
+	//adds the contents of a directory (not the directory itself)
+	bool AddDirectory(const char *i_szPath);
+	//adds one file as i_szName
+	bool AddFile(const char *i_szPath, const char *i_szName);
+
+	int GetNumEntries() { return m_iNumEntries; };
+	const char *GetName(int i_iIdx) { return m_pEntries[i_iIdx].szName; };
+	bool IsDirectory(int i_iIdx) { return m_pEntries[i_iIdx].bDirectory; };
+	void SetUnixMode(int i_iIdx, uint32_t i_iMode) { m_pEntries[i_iIdx].iMode = i_iMode; };
+	int FindEntry(const char *i_szName);
+
+	//level 0 stores, 1..9 deflates. 0 threads means one per core
+	bool Write(const char *i_szZipFile, int i_iLevel, int i_iNumThreads);
+	//only the local records, at the current position of the file which is at
+	// *io_iPos of the zip, *io_iPos is moved past them
+	bool WriteRecords(C_Resource *i_pclFile, uint64_t *io_iPos, int i_iLevel, int i_iNumThreads);
+	//CD record of a written entry, o_pRecord must hold MAX_CD_RECORD bytes
+	enum { MAX_CD_RECORD = sizeof(S_CentralDirectoryEntry)+28+0xffff };
+	uint32_t EncodeCDRecord(int i_iIdx, uint8_t *o_pRecord);
+private:
+	enum { CHUNK_SIZE = 1024*1024, HISTORY_SIZE = 32768 };
+
+	bool AddTree(const char *i_szPath, const char *i_szName);
+	void AddEntry(const char *i_szPath, const char *i_szName, bool i_bDirectory, uint64_t i_iSize, int64_t i_iTime, uint32_t i_iMode);
+	void SortNames();
+	static void ProcessChunk(void *i_pContext, int i_iWorker, int i_iTask);
+	bool WriteLocalHeader(C_Resource *i_pclFile, S_BuildEntry *i_pEntry, bool i_bZip64);
+	bool WriteCD(C_Resource *i_pclFile, uint64_t i_iCDStart);
+
+	S_BuildEntry *m_pEntries;
+	int m_iNumEntries, m_iEntryCapacity;
+	S_BuildEntry **m_pSorted; //by name, for FindEntry
+	//while writing
+	S_BuildChunk *m_pChunks;
+	int m_iLevel;
+	bool m_bReadError; //reported already
+	C_Deflater *m_pDeflaters; //one per worker
+	uint8_t **m_pReadBuffers;
+	C_WorkPool *m_pclPool;
+};
+
+C_ZipBuilder::C_ZipBuilder()
+{
+	m_pEntries = NULL;
+	m_iNumEntries = m_iEntryCapacity = 0;
+	m_pSorted = NULL;
+	m_pChunks = NULL;
+	m_iLevel = 9;
+	m_bReadError = false;
+	m_pDeflaters = NULL;
+	m_pReadBuffers = NULL;
+	m_pclPool = NULL;
+}
+
+C_ZipBuilder::~C_ZipBuilder()
+{
+	for(int i=0; i<m_iNumEntries; i++) {
+		delete[] m_pEntries[i].szPath;
+		delete[] m_pEntries[i].szName;
+	}
+	delete[] m_pEntries;
+	delete[] m_pSorted;
+}
+
+void C_ZipBuilder::AddEntry(const char *i_szPath, const char *i_szName, bool i_bDirectory, uint64_t i_iSize, int64_t i_iTime, uint32_t i_iMode)
+{
+	if(m_iNumEntries==m_iEntryCapacity) {
+		m_iEntryCapacity = m_iEntryCapacity ? m_iEntryCapacity*2 : 256;
+		S_BuildEntry *pNew = new S_BuildEntry[m_iEntryCapacity];
+		if(m_iNumEntries) memcpy(pNew, m_pEntries, m_iNumEntries*sizeof(S_BuildEntry));
+		delete[] m_pEntries;
+		m_pEntries = pNew;
+	}
+	S_BuildEntry *pEntry = &m_pEntries[m_iNumEntries++];
+	memset(pEntry, 0, sizeof(S_BuildEntry));
+	pEntry->szPath = new char[strlen(i_szPath)+1];
+	strcpy(pEntry->szPath, i_szPath);
+	pEntry->szName = new char[strlen(i_szName)+1];
+	strcpy(pEntry->szName, i_szName);
+	pEntry->bDirectory = i_bDirectory;
+	pEntry->iSize = i_bDirectory ? 0 : i_iSize;
+
+	//same defaults as the normalized attributes, executable files stay executable
+	pEntry->iMode = (i_bDirectory || (i_iMode & 0111)) ? 0755 : 0644;
+
+	//dos time is local time, 2 second resolution, from 1980
+	time_t iTime = (time_t)i_iTime;
+	struct tm *pTime = localtime(&iTime);
+	if(pTime && pTime->tm_year >= 80) {
+		pEntry->iTime = (uint16_t)((pTime->tm_hour<<11) | (pTime->tm_min<<5) | (pTime->tm_sec>>1));
+		pEntry->iDate = (uint16_t)(((pTime->tm_year-80)<<9) | ((pTime->tm_mon+1)<<5) | pTime->tm_mday);
+	} else {
+		pEntry->iTime = 0;
+		pEntry->iDate = (1<<5) | 1;
+	}
+}
+
+static int CompareNames(const void *i_pA, const void *i_pB)
+{
+	return strcmp(*(const char **)i_pA, *(const char **)i_pB);
+}
+
+static int CompareEntryNames(const void *i_pA, const void *i_pB)
+{
+	return strcmp((*(const S_BuildEntry **)i_pA)->szName, (*(const S_BuildEntry **)i_pB)->szName);
+}
+
+bool C_ZipBuilder::AddTree(const char *i_szPath, const char *i_szName)
+{
+	//names in the directory, sorted so the zip is the same for the same tree
+	int iNum = 0, iCapacity = 64;
+	char **szNames = new char*[iCapacity];
+#ifdef _WIN32
+	char *szPattern = new char[strlen(i_szPath)+3];
+	sprintf(szPattern, "%s\\*", i_szPath);
+	WIN32_FIND_DATAA stFind;
+	HANDLE hFind = FindFirstFileA(szPattern, &stFind);
+	delete[] szPattern;
+	if(hFind == INVALID_HANDLE_VALUE) {
+		delete[] szNames;
+		LogPrintf("error: could not read directory (%s)\n", i_szPath);
+		return false;
+	}
+	do {
+		const char *szFile = stFind.cFileName;
+#else
+	DIR *pDir = opendir(i_szPath);
+	if(pDir == NULL) {
+		delete[] szNames;
+		LogPrintf("error: could not read directory (%s)\n", i_szPath);
+		return false;
+	}
+	struct dirent *pFound;
+	while((pFound = readdir(pDir)) != NULL) {
+		const char *szFile = pFound->d_name;
+#endif
+		if(strcmp(szFile, ".")==0 || strcmp(szFile, "..")==0) continue;
+		if(iNum==iCapacity) {
+			char **szNew = new char*[iCapacity*2];
+			memcpy(szNew, szNames, iNum*sizeof(char*));
+			delete[] szNames;
+			szNames = szNew;
+			iCapacity *= 2;
+		}
+		szNames[iNum] = new char[strlen(szFile)+1];
+		strcpy(szNames[iNum++], szFile);
+#ifdef _WIN32
+	} while(FindNextFileA(hFind, &stFind));
+	FindClose(hFind);
+#else
+	}
+	closedir(pDir);
+#endif
+	qsort(szNames, iNum, sizeof(char*), CompareNames);
+
+	bool bResult = true;
+	for(int i=0; i<iNum && bResult; i++) {
+		size_t iPathLen = strlen(i_szPath), iNameLen = strlen(i_szName), iFileLen = strlen(szNames[i]);
+		char *szPath = new char[iPathLen+iFileLen+2];
+		char *szName = new char[iNameLen+iFileLen+2];
+		sprintf(szPath, "%s/%s", i_szPath, szNames[i]);
+		sprintf(szName, "%s%s", i_szName, szNames[i]);
+
+#ifdef _WIN32
+		struct _stat64 stStat;
+		bool bOK = _stat64(szPath, &stStat) == 0;
+		bool bDirectory = bOK && (stStat.st_mode & _S_IFDIR);
+		bool bFile = bOK && (stStat.st_mode & _S_IFREG);
+#else
+		//symbolic links to files are followed, links to directories are not (they may loop)
+		struct stat stStat;
+		bool bOK = lstat(szPath, &stStat) == 0;
+		bool bDirectory = bOK && S_ISDIR(stStat.st_mode);
+		if(bOK && S_ISLNK(stStat.st_mode)) bOK = stat(szPath, &stStat) == 0 && S_ISREG(stStat.st_mode);
+		bool bFile = bOK && S_ISREG(stStat.st_mode);
+#endif
+		if(!bOK) {
+			LogPrintf("warning: skipped \"%s\"\n", szPath);
+		} else if(strlen(szName)+1 > 0xffff) {
+			LogPrintf("error: name too long (%s)\n", szPath);
+			bResult = false;
+		} else if(bDirectory) {
+			strcat(szName, "/");
+			AddEntry(szPath, szName, true, 0, (int64_t)stStat.st_mtime, (uint32_t)stStat.st_mode);
+			bResult = AddTree(szPath, szName);
+		} else if(bFile) {
+			AddEntry(szPath, szName, false, (uint64_t)stStat.st_size, (int64_t)stStat.st_mtime, (uint32_t)stStat.st_mode);
+		} else {
+			LogPrintf("warning: skipped \"%s\" (not a file or directory)\n", szPath);
+		}
+		delete[] szPath;
+		delete[] szName;
+	}
+	for(int i=0; i<iNum; i++) delete[] szNames[i];
+	delete[] szNames;
+	return bResult;
+}
+
+bool C_ZipBuilder::AddDirectory(const char *i_szPath)
+{
+	//without a trailing separator, names are joined with '/'
+	char *szPath = new char[strlen(i_szPath)+1];
+	strcpy(szPath, i_szPath);
+	size_t iLen = strlen(szPath);
+	while(iLen>1 && (szPath[iLen-1]=='/' || szPath[iLen-1]=='\\')) szPath[--iLen] = 0;
+	bool bResult = AddTree(szPath, "");
+	delete[] szPath;
+	SortNames();
+	return bResult;
+}
+
+bool C_ZipBuilder::AddFile(const char *i_szPath, const char *i_szName)
+{
+#ifdef _WIN32
+	struct _stat64 stStat;
+	bool bFile = _stat64(i_szPath, &stStat) == 0 && (stStat.st_mode & _S_IFREG);
+#else
+	struct stat stStat;
+	bool bFile = stat(i_szPath, &stStat) == 0 && S_ISREG(stStat.st_mode);
+#endif
+	if(!bFile) {
+		LogPrintf("error: not a file (%s)\n", i_szPath);
+		return false;
+	}
+	if(i_szName[0] == 0 || strlen(i_szName) > 0xffff || i_szName[strlen(i_szName)-1] == '/') {
+		LogPrintf("error: invalid name in archive (%s)\n", i_szName);
+		return false;
+	}
+	AddEntry(i_szPath, i_szName, false, (uint64_t)stStat.st_size, (int64_t)stStat.st_mtime, (uint32_t)stStat.st_mode);
+	SortNames();
+	return true;
+}
+
+void C_ZipBuilder::SortNames()
+{
+	//names are given in the order they are written, the index is sorted by name
+	delete[] m_pSorted;
+	m_pSorted = new S_BuildEntry*[m_iNumEntries > 0 ? m_iNumEntries : 1];
+	for(int i=0; i<m_iNumEntries; i++) m_pSorted[i] = &m_pEntries[i];
+	qsort(m_pSorted, m_iNumEntries, sizeof(S_BuildEntry*), CompareEntryNames);
+}
+
+int C_ZipBuilder::FindEntry(const char *i_szName)
+{
+	int iLow = 0, iHigh = m_iNumEntries-1;
+	while(iLow <= iHigh) {
+		int iMid = (iLow+iHigh)/2;
+		int iCmp = strcmp(m_pSorted[iMid]->szName, i_szName);
+		if(iCmp == 0) return (int)(m_pSorted[iMid]-m_pEntries);
+		if(iCmp < 0) iLow = iMid+1;
+		else iHigh = iMid-1;
+	}
+	return -1;
+}
+
+void C_ZipBuilder::ProcessChunk(void *i_pContext, int i_iWorker, int i_iTask)
+{
+	C_ZipBuilder *pThis = (C_ZipBuilder *)i_pContext;
+	S_BuildChunk *pChunk = &pThis->m_pChunks[i_iTask];
+	S_BuildEntry *pEntry = &pThis->m_pEntries[pChunk->iEntry];
+	uint8_t *pBuffer = pThis->m_pReadBuffers[i_iWorker];
+
+	//the chunk with the data before it (history for the matches)
+	uint32_t iHistory = pChunk->iPos < HISTORY_SIZE ? (uint32_t)pChunk->iPos : HISTORY_SIZE;
+	C_Resource clFile;
+	clFile.SetMode(true);
+	pChunk->bError = true;
+	if(clFile.SetFilename(pEntry->szPath)) {
+		clFile.Seek(pChunk->iPos-iHistory, SEEK_SET);
+		if(clFile.Read(pBuffer, iHistory+pChunk->iLength)) {
+			pChunk->iCrc = Crc32Update(0, pBuffer+iHistory, pChunk->iLength);
+			if(pEntry->iMethod == 0) {
+				pChunk->pOut = new uint8_t[pChunk->iLength];
+				memcpy(pChunk->pOut, pBuffer+iHistory, pChunk->iLength);
+				pChunk->iOutLength = pChunk->iLength;
+			} else {
+				bool bLast = pChunk->iPos+pChunk->iLength == pEntry->iSize;
+				C_Deflater *pDeflater = &pThis->m_pDeflaters[i_iWorker];
+				pDeflater->Compress(pBuffer, iHistory, iHistory+pChunk->iLength, bLast);
+				pChunk->pOut = pDeflater->DetachOutput(&pChunk->iOutLength);
+			}
+			pChunk->bError = false;
+		}
+	}
+	pThis->m_pclPool->SignalDone(&pChunk->iDone);
+}
+
+bool C_ZipBuilder::WriteLocalHeader(C_Resource *i_pclFile, S_BuildEntry *i_pEntry, bool i_bZip64)
+{
+	uint16_t iNameLen = (uint16_t)strlen(i_pEntry->szName);
+	uint8_t pHeader[sizeof(S_LocalFileHeader)+20];
+	S_LocalFileHeader stHeader;
+	stHeader.sign = 0x04034b50;
+	stHeader.ver_needed = (uint16_t)(0x0300 | (i_bZip64 ? 45 : (i_pEntry->iMethod ? 20 : 10)));
+	stHeader.gp_flag = m_iLevel >= 8 && i_pEntry->iMethod ? 0x0002 : 0; //maximum compression
+	for(int i=0; i<iNameLen; i++) if((uint8_t)i_pEntry->szName[i] >= 0x80) stHeader.gp_flag |= 0x0800; //utf-8
+	stHeader.c_method = i_pEntry->iMethod;
+	stHeader.lm_time = i_pEntry->iTime;
+	stHeader.lm_date = i_pEntry->iDate;
+	stHeader.crc32 = i_pEntry->iCrc;
+	stHeader.c_size = i_bZip64 ? 0xffffffff : (uint32_t)i_pEntry->iCompressedSize;
+	stHeader.u_size = i_bZip64 ? 0xffffffff : (uint32_t)i_pEntry->iSize;
+	stHeader.name_len = iNameLen;
+	stHeader.extra_len = i_bZip64 ? 20 : 0;
+	EncodeRecord(&stHeader, pHeader);
+	if(i_bZip64) {
+		//both sizes in the local zip64 extra field
+		uint8_t *pExtra = pHeader+sizeof(S_LocalFileHeader);
+		StoreLittleEndian<uint16_t>(pExtra, 0x0001);
+		StoreLittleEndian<uint16_t>(pExtra+2, 16);
+		StoreLittleEndian<uint64_t>(pExtra+4, i_pEntry->iSize);
+		StoreLittleEndian<uint64_t>(pExtra+12, i_pEntry->iCompressedSize);
+	}
+	S_WriteBuffer stBuffers[3] = {
+		{ pHeader, (uint32_t)sizeof(S_LocalFileHeader) },
+		{ i_pEntry->szName, iNameLen },
+		{ pHeader+sizeof(S_LocalFileHeader), stHeader.extra_len } };
+	return i_pclFile->WriteGather(stBuffers, 3);
+}
+
+uint32_t C_ZipBuilder::EncodeCDRecord(int i_iIdx, uint8_t *o_pRecord)
+{
+	S_BuildEntry *pEntry = &m_pEntries[i_iIdx];
+	S_CentralDirectoryEntry stEntry;
+	uint16_t iNameLen = (uint16_t)strlen(pEntry->szName);
+	memcpy(o_pRecord+sizeof(S_CentralDirectoryEntry), pEntry->szName, iNameLen);
+
+	//zip64 extra with the values that do not fit, in this order
+	uint8_t *pExtra = o_pRecord+sizeof(S_CentralDirectoryEntry)+iNameLen;
+	uint16_t iExtraLen = 0;
+	bool bUSize = pEntry->iSize >= 0xffffffff, bCSize = pEntry->iCompressedSize >= 0xffffffff, bOffset = pEntry->iOffset >= 0xffffffff;
+	if(bUSize || bCSize || bOffset) {
+		iExtraLen = 4;
+		if(bUSize)  { StoreLittleEndian<uint64_t>(pExtra+iExtraLen, pEntry->iSize); iExtraLen += 8; }
+		if(bCSize)  { StoreLittleEndian<uint64_t>(pExtra+iExtraLen, pEntry->iCompressedSize); iExtraLen += 8; }
+		if(bOffset) { StoreLittleEndian<uint64_t>(pExtra+iExtraLen, pEntry->iOffset); iExtraLen += 8; }
+		StoreLittleEndian<uint16_t>(pExtra, 0x0001);
+		StoreLittleEndian<uint16_t>(pExtra+2, (uint16_t)(iExtraLen-4));
+	}
+
+	uint16_t iVersion = (uint16_t)(0x0300 | (iExtraLen ? 45 : (pEntry->iMethod ? 20 : 10)));
+	stEntry.sign = 0x02014b50;
+	stEntry.ver = iVersion;
+	stEntry.ver_needed = iVersion;
+	stEntry.gp_flag = m_iLevel >= 8 && pEntry->iMethod ? 0x0002 : 0;
+	for(int j=0; j<iNameLen; j++) if((uint8_t)pEntry->szName[j] >= 0x80) stEntry.gp_flag |= 0x0800;
+	stEntry.c_method = pEntry->iMethod;
+	stEntry.lm_time = pEntry->iTime;
+	stEntry.lm_date = pEntry->iDate;
+	stEntry.crc32 = pEntry->iCrc;
+	stEntry.c_size = bCSize ? 0xffffffff : (uint32_t)pEntry->iCompressedSize;
+	stEntry.u_size = bUSize ? 0xffffffff : (uint32_t)pEntry->iSize;
+	stEntry.name_len = iNameLen;
+	stEntry.extra_len = iExtraLen;
+	stEntry.comment_len = 0;
+	stEntry.dn_start = 0;
+	stEntry.int_attr = 0;
+	stEntry.ext_attrib = C_ZipFile::MakeUnixAttributes(pEntry->iMode, pEntry->bDirectory);
+	stEntry.offset = bOffset ? 0xffffffff : (uint32_t)pEntry->iOffset;
+	EncodeRecord(&stEntry, o_pRecord);
+	return sizeof(S_CentralDirectoryEntry)+iNameLen+iExtraLen;
+}
+
+bool C_ZipBuilder::WriteCD(C_Resource *i_pclFile, uint64_t i_iCDStart)
+{
+	uint8_t *pCD = NULL;
+	uint64_t iCDSize = 0, iCDCapacity = 0;
+	uint8_t *pRecord = new uint8_t[MAX_CD_RECORD];
+	for(int i=0; i<m_iNumEntries; i++) {
+		uint32_t iLen = EncodeCDRecord(i, pRecord);
+		AppendBuffer(&pCD, &iCDSize, &iCDCapacity, pRecord, iLen);
+	}
+	delete[] pRecord;
+
+	//end records, with the zip64 ones if anything does not fit
+	bool bZip64 = m_iNumEntries >= 0xffff || iCDSize >= 0xffffffff || i_iCDStart >= 0xffffffff;
+	S_CentralDirectoryEnd stCDEnd;
+	stCDEnd.sign = 0x06054b50;
+	stCDEnd.num_discs = 0;
+	stCDEnd.cd_disc = 0;
+	stCDEnd.cd_num = stCDEnd.cd_tot_num = (uint16_t)(m_iNumEntries >= 0xffff ? 0xffff : m_iNumEntries);
+	stCDEnd.cd_size = iCDSize >= 0xffffffff ? 0xffffffff : (uint32_t)iCDSize;
+	stCDEnd.cd_start = i_iCDStart >= 0xffffffff ? 0xffffffff : (uint32_t)i_iCDStart;
+	stCDEnd.comment_len = 0;
+	uint8_t pCDEnd[sizeof(S_CentralDirectoryEnd)];
+	EncodeRecord(&stCDEnd, pCDEnd);
+
+	uint8_t pZip64End[sizeof(S_Zip64CentralDirectoryEnd)], pLocator[sizeof(S_Zip64CentralDirectoryLocator)];
+	if(bZip64) {
+		S_Zip64CentralDirectoryEnd stZip64End;
+		stZip64End.sign = 0x06064b50;
+		stZip64End.rec_size = sizeof(S_Zip64CentralDirectoryEnd)-12;
+		stZip64End.ver = 0x0300 | 45;
+		stZip64End.ver_needed = 45;
+		stZip64End.num_discs = 0;
+		stZip64End.cd_disc = 0;
+		stZip64End.cd_num = stZip64End.cd_tot_num = (uint64_t)m_iNumEntries;
+		stZip64End.cd_size = iCDSize;
+		stZip64End.cd_start = i_iCDStart;
+		EncodeRecord(&stZip64End, pZip64End);
+		S_Zip64CentralDirectoryLocator stLocator;
+		stLocator.sign = 0x07064b50;
+		stLocator.cd_end_disc = 0;
+		stLocator.cd_end_start = i_iCDStart+iCDSize;
+		stLocator.num_discs = 1;
+		EncodeRecord(&stLocator, pLocator);
+	}
+
+	//the CD may be larger than one write
+	bool bResult = true;
+	for(uint64_t iPos=0; iPos<iCDSize && bResult; iPos += 0x40000000) {
+		uint32_t iLen = iCDSize-iPos < 0x40000000 ? (uint32_t)(iCDSize-iPos) : 0x40000000;
+		bResult = i_pclFile->Write(pCD+iPos, iLen);
+	}
+	S_WriteBuffer stBuffers[3];
+	int iNumBuffers = 0;
+	if(bZip64) {
+		stBuffers[iNumBuffers].pData = pZip64End; stBuffers[iNumBuffers++].iLength = sizeof(pZip64End);
+		stBuffers[iNumBuffers].pData = pLocator;  stBuffers[iNumBuffers++].iLength = sizeof(pLocator);
+	}
+	stBuffers[iNumBuffers].pData = pCDEnd; stBuffers[iNumBuffers++].iLength = sizeof(pCDEnd);
+	if(bResult) bResult = i_pclFile->WriteGather(stBuffers, iNumBuffers);
+	delete[] pCD;
+	return bResult;
+}
+
+bool C_ZipBuilder::Write(const char *i_szZipFile, int i_iLevel, int i_iNumThreads)
+{
+	//written to a temporary file which then replaces the target, like C_ZipFile::Save
+	char *szTempFile = new char[strlen(i_szZipFile)+C_Resource::TEMP_NAME_EXTRA];
+	C_Resource *pclFile = new C_Resource();
+	pclFile->SetMode(false);
+	uint64_t iPos = 0;
+	m_bReadError = false;
+	bool bResult = pclFile->SetTempFilename(i_szZipFile, szTempFile);
+	if(!bResult) LogPrintf("error: could not create a temporary file next to %s\n", i_szZipFile);
+	else {
+		bResult = WriteRecords(pclFile, &iPos, i_iLevel, i_iNumThreads);
+		if(bResult) bResult = WriteCD(pclFile, iPos);
+		if(bResult) bResult = pclFile->Sync();
+		if(!bResult && !m_bReadError) LogPrintf("error: could not write output zip file (%s)\n", szTempFile);
+	}
+	delete pclFile;
+
+	if(bResult) {
+		bResult = C_Resource::Rename(szTempFile, i_szZipFile);
+		if(bResult) C_Resource::SyncDirectoryOf(i_szZipFile);
+		else LogPrintf("error: could not replace output zip file (%s)\n", i_szZipFile);
+	}
+	if(!bResult && szTempFile[0]) remove(szTempFile);
+	delete[] szTempFile;
+	return bResult;
+}
+
+bool C_ZipBuilder::WriteRecords(C_Resource *i_pclFile, uint64_t *io_iPos, int i_iLevel, int i_iNumThreads)
+{
+	m_iLevel = i_iLevel;
+
+	//split the files in chunks, in the order they are written
+	int iNumChunks = 0;
+	for(int i=0; i<m_iNumEntries; i++) {
+		S_BuildEntry *pEntry = &m_pEntries[i];
+		pEntry->iMethod = (i_iLevel > 0 && pEntry->iSize > 0) ? 8 : 0; //empty files are stored
+		pEntry->iFirstChunk = iNumChunks;
+		pEntry->iNumChunks = (int)((pEntry->iSize+CHUNK_SIZE-1)/CHUNK_SIZE);
+		iNumChunks += pEntry->iNumChunks;
+	}
+	m_pChunks = new S_BuildChunk[iNumChunks > 0 ? iNumChunks : 1];
+	for(int i=0; i<m_iNumEntries; i++) {
+		S_BuildEntry *pEntry = &m_pEntries[i];
+		for(int j=0; j<pEntry->iNumChunks; j++) {
+			S_BuildChunk *pChunk = &m_pChunks[pEntry->iFirstChunk+j];
+			pChunk->iEntry = i;
+			pChunk->iPos = (uint64_t)j*CHUNK_SIZE;
+			pChunk->iLength = (uint32_t)(pEntry->iSize-pChunk->iPos < CHUNK_SIZE ? pEntry->iSize-pChunk->iPos : CHUNK_SIZE);
+			pChunk->iDone = 0;
+			pChunk->bError = false;
+			pChunk->pOut = NULL;
+			pChunk->iOutLength = 0;
+		}
+	}
+
+	int iNumThreads = i_iNumThreads > 0 ? i_iNumThreads : C_WorkPool::GetNumCores();
+	m_pDeflaters = new C_Deflater[iNumThreads];
+	m_pReadBuffers = new uint8_t*[iNumThreads];
+	for(int i=0; i<iNumThreads; i++) {
+		m_pDeflaters[i].SetLevel(i_iLevel);
+		m_pReadBuffers[i] = new uint8_t[HISTORY_SIZE+CHUNK_SIZE];
+	}
+	m_pclPool = new C_WorkPool(iNumThreads, ProcessChunk, this);
+	//chunks are compressed ahead of the one being written, but not without bound
+	int iWindow = iNumThreads*4, iNumSubmitted = 0;
+
+	C_Resource *pclFile = i_pclFile;
+	bool bResult = true;
+	uint64_t iPos = *io_iPos;
+	for(int i=0; i<m_iNumEntries && bResult; i++) {
+		S_BuildEntry *pEntry = &m_pEntries[i];
+		pEntry->iOffset = iPos;
+		//sizes in the local zip64 extra if the compressed size could possibly need it
+		bool bZip64 = pEntry->iSize >= 0xff000000;
+		pEntry->iCrc = 0;
+		pEntry->iCompressedSize = 0;
+		//with a single chunk the header is written complete after it, otherwise the
+		// crc and size are filled in when all is written
+		bool bPatchHeader = pEntry->iNumChunks > 1;
+		if(bPatchHeader) bResult = WriteLocalHeader(pclFile, pEntry, bZip64);
+		uint64_t iHeaderEnd = iPos + sizeof(S_LocalFileHeader) + strlen(pEntry->szName) + (bZip64 ? 20 : 0);
+		if(bPatchHeader) iPos = iHeaderEnd;
+
+		for(int j=0; j<pEntry->iNumChunks && bResult; j++) {
+			int iChunk = pEntry->iFirstChunk+j;
+			while(iNumSubmitted < iNumChunks && iNumSubmitted < iChunk+iWindow) m_pclPool->Submit(iNumSubmitted++);
+			S_BuildChunk *pChunk = &m_pChunks[iChunk];
+			m_pclPool->Wait(&pChunk->iDone);
+			if(pChunk->bError) {
+				LogPrintf("error: could not read \"%s\"\n", pEntry->szPath);
+				m_bReadError = true;
+				bResult = false;
+				break;
+			}
+			pEntry->iCrc = j==0 ? pChunk->iCrc : Crc32Combine(pEntry->iCrc, pChunk->iCrc, pChunk->iLength);
+			pEntry->iCompressedSize += pChunk->iOutLength;
+			if(!bPatchHeader) bResult = WriteLocalHeader(pclFile, pEntry, bZip64);
+			if(bResult) bResult = pclFile->Write(pChunk->pOut, pChunk->iOutLength);
+			if(!bPatchHeader) iPos = iHeaderEnd;
+			iPos += pChunk->iOutLength;
+			delete[] pChunk->pOut;
+			pChunk->pOut = NULL;
+		}
+		if(bResult && pEntry->iNumChunks == 0) {
+			bResult = WriteLocalHeader(pclFile, pEntry, bZip64);
+			iPos = iHeaderEnd;
+		}
+		if(bResult && bPatchHeader) {
+			pclFile->Seek(pEntry->iOffset, SEEK_SET);
+			bResult = WriteLocalHeader(pclFile, pEntry, bZip64);
+			pclFile->Seek(iPos, SEEK_SET);
+		}
+	}
+	*io_iPos = iPos;
+
+	//the remaining chunks are finished before they are freed
+	delete m_pclPool; m_pclPool = NULL;
+	for(int i=0; i<iNumChunks; i++) delete[] m_pChunks[i].pOut;
+	delete[] m_pChunks; m_pChunks = NULL;
+	delete[] m_pDeflaters; m_pDeflaters = NULL;
+	for(int i=0; i<iNumThreads; i++) delete[] m_pReadBuffers[i];
+	delete[] m_pReadBuffers; m_pReadBuffers = NULL;
+	return bResult;
+}
+
+bool CreateZip(char *i_szZipFile, char *i_szDirectory, C_TargetList *i_pclFilesToFix, S_Options *i_pstOptions)
+{
+	C_ZipBuilder clBuilder;
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_CREATE_SCAN);
+	if(!clBuilder.AddDirectory(i_szDirectory)) return false;
+
+	//modes from the files (normalized), then the policy, then the files to set executable
+	clPhase.Next(STATS_MODIFY);
+	if(i_pstOptions->pclPolicy) {
+		C_PermissionPolicy *pclPolicy = i_pstOptions->pclPolicy;
+		int iNumSet = 0;
+		for(int i=0; i<clBuilder.GetNumEntries(); i++) {
+			const char *szName = clBuilder.GetName(i);
+			int iRule = pclPolicy->Classify(szName, (int)strlen(szName), clBuilder.IsDirectory(i));
+			if(iRule < 0) continue;
+			clBuilder.SetUnixMode(i, pclPolicy->GetRuleMode(iRule, clBuilder.IsDirectory(i)));
+			iNumSet++;
+		}
+		LogPrintf("set %d of %d entries by policy (%d rules)\n", iNumSet, clBuilder.GetNumEntries(), pclPolicy->GetNumRules());
+	}
+	int iNumSet = 0;
+	for(int i=0; i<i_pclFilesToFix->GetNum(); i++) {
+		char *szFile = i_pclFilesToFix->Get(i);
+		int iIdx = clBuilder.FindEntry(szFile);
+		if(iIdx >= 0 && !clBuilder.IsDirectory(iIdx)) {
+			clBuilder.SetUnixMode(iIdx, 0755);
+			LogPrintf("set \"%s\" executable\n", szFile);
+			iNumSet++;
+		} else {
+			LogPrintf("error: could not set \"%s\" executable (not found)\n", szFile);
+		}
+	}
+	if(iNumSet != i_pclFilesToFix->GetNum()) {
+		LogPrintf("error: %d of %d files not found in directory\n", i_pclFilesToFix->GetNum()-iNumSet, i_pclFilesToFix->GetNum());
+		return false;
+	}
+
+	clPhase.Next(STATS_CREATE_WRITE);
+	if(!clBuilder.Write(i_szZipFile, i_pstOptions->iLevel, i_pstOptions->iThreads)) return false;
+	clPhase.End();
+	LogPrintf("created \"%s\" (%d entries)\n", i_szZipFile, clBuilder.GetNumEntries());
+	return true;
+}
+
+/////////////
+//files added to an opened zip (append-only update), compressed and written by a
+// C_ZipBuilder where the CD was. the existing local data is not touched.
+
+void C_ZipFile::FreeAdded()
+{
+	delete m_pclAdded;      m_pclAdded     = NULL;
+	delete[] m_pReplacedBy; m_pReplacedBy  = NULL;
+}
+
+bool C_ZipFile::AddFile(const char *i_szName, const char *i_szPath)
+{
+	if(!m_bOpenOK) return false;
+	if(FindAdded(i_szName) >= 0) {
+		LogPrintf("error: \"%s\" added more than once\n", i_szName);
+		return false;
+	}
+	if(m_pclAdded == NULL) {
+		m_pclAdded = new C_ZipBuilder();
+		m_pReplacedBy = new int[m_iNumFiles > 0 ? m_iNumFiles : 1];
+		for(int i=0; i<m_iNumFiles; i++) m_pReplacedBy[i] = -1;
+	}
+	if(!m_pclAdded->AddFile(i_szPath, i_szName)) return false;
+	int iIdx = FindFileIndexInCD(i_szName);
+	if(iIdx >= 0) m_pReplacedBy[iIdx] = m_pclAdded->GetNumEntries()-1;
+	return true;
+}
+
+void C_ZipFile::SetAddOptions(int i_iLevel, int i_iNumThreads)
+{
+	m_iAddLevel = i_iLevel;
+	m_iAddThreads = i_iNumThreads;
+}
+
+int C_ZipFile::GetNumAdded()
+{
+	return m_pclAdded ? m_pclAdded->GetNumEntries() : 0;
+}
+
+const char *C_ZipFile::GetAddedName(int i_iAdded)
+{
+	return m_pclAdded->GetName(i_iAdded);
+}
+
+int C_ZipFile::FindAdded(const char *i_szName)
+{
+	return m_pclAdded ? m_pclAdded->FindEntry(i_szName) : -1;
+}
+
+void C_ZipFile::SetAddedMode(int i_iAdded, uint32_t i_iMode)
+{
+	m_pclAdded->SetUnixMode(i_iAdded, i_iMode);
+}
+
+bool C_ZipFile::WriteAdded(C_Resource *i_pclFile, uint64_t *io_iPos)
+{
+	return m_pclAdded->WriteRecords(i_pclFile, io_iPos, m_iAddLevel, m_iAddThreads);
+}
+
+bool C_ZipFile::WriteMergedCD(C_Resource *i_pclFile, uint64_t i_iCDStart, uint64_t *o_iEnd)
+{
+	//the entries in their order, a replaced one with the record of the file which
+	// replaces it (so it points to the new data), then the new files
+	NormalizeAttributes();
+	int iNumAdded = m_pclAdded->GetNumEntries();
+	uint8_t *pReplacing = new uint8_t[iNumAdded];
+	memset(pReplacing, 0, iNumAdded);
+	uint8_t *pRecord = new uint8_t[C_ZipBuilder::MAX_CD_RECORD];
+	uint8_t *pCD = NULL;
+	uint64_t iCDSize = 0, iCDCapacity = 0;
+	uint64_t iNumFiles = m_iNumFiles;
+	for(int i=0; i<m_iNumFiles; i++) {
+		int iAdded = m_pReplacedBy[i];
+		if(iAdded >= 0) {
+			uint32_t iLen = m_pclAdded->EncodeCDRecord(iAdded, pRecord);
+			AppendBuffer(&pCD, &iCDSize, &iCDCapacity, pRecord, iLen);
+			pReplacing[iAdded] = 1;
+		} else {
+			uint32_t iRecordEnd = i+1 < m_iNumFiles ? m_pEntryPos[i+1] : m_iCDUsed;
+			AppendBuffer(&pCD, &iCDSize, &iCDCapacity, m_pCD+m_pEntryPos[i], iRecordEnd-m_pEntryPos[i]);
+		}
+	}
+	for(int i=0; i<iNumAdded; i++) {
+		if(pReplacing[i]) continue;
+		uint32_t iLen = m_pclAdded->EncodeCDRecord(i, pRecord);
+		AppendBuffer(&pCD, &iCDSize, &iCDCapacity, pRecord, iLen);
+		iNumFiles++;
+	}
+	delete[] pRecord;
+	delete[] pReplacing;
+
+	bool bResult = false;
+	if(iCDSize < 0xffffffff) {
+		S_WriteBuffer stBuffers[6];
+		S_EndRecords stRecords;
+		int iNumBuffers = BuildCDBuffers(stBuffers, &stRecords, pCD, (uint32_t)iCDSize, iNumFiles, i_iCDStart);
+		*o_iEnd = i_iCDStart;
+		for(int i=0; i<iNumBuffers; i++) *o_iEnd += stBuffers[i].iLength;
+		bResult = i_pclFile->WriteGather(stBuffers, iNumBuffers);
+	}
+	delete[] pCD;
+	return bResult;
+}
+
+/////////////
+//verification of a zip: the local header of every entry is compared with its CD
+// entry, and the data is checked against the crc and size in the CD (deflated
+// entries are inflated). entries are verified in parallel, the largest first,
+// every worker reads the zip through its own handle.
+
+enum E_VerifyStatus { VERIFY_OK, VERIFY_WARNING, VERIFY_SKIPPED, VERIFY_ERROR };
+
+struct S_VerifyResult
+{
+	E_VerifyStatus eStatus; //the worst found, with its message
+	char szMessage[128];
+};
+
+class C_ZipVerifier
+{
+public:
+	C_ZipVerifier(C_ZipFile *i_pclZip, const char *i_szZipFile);
+	~C_ZipVerifier();
+
+	bool Verify(int i_iNumThreads); //reports what was found, false on errors
+private:
+	enum { BUFFER_SIZE = 1<<20 };
+	struct S_Worker
+	{
+		C_Resource clFile;
+		C_Inflater clInflater;
+		uint8_t *pBuffer;
+	};
+	struct S_SizeIndex
+	{
+		uint64_t iSize;
+		int iIdx;
+	};
+
+	static void VerifyTask(void *i_pContext, int i_iWorker, int i_iTask);
+	static int CompareSizes(const void *i_pA, const void *i_pB);
+	static void SetResult(S_VerifyResult *io_pResult, E_VerifyStatus i_eStatus, const char *i_szFormat, ...);
+	void VerifyEntry(S_Worker *i_pWorker, int i_iIdx, S_VerifyResult *o_pResult);
+
+	C_ZipFile *m_pclZip;
+	const char *m_szZipFile;
+	S_Worker *m_pWorkers;
+	S_VerifyResult *m_pResults;
+};
+
+C_ZipVerifier::C_ZipVerifier(C_ZipFile *i_pclZip, const char *i_szZipFile)
+{
+	m_pclZip = i_pclZip;
+	m_szZipFile = i_szZipFile;
+	m_pWorkers = NULL;
+	m_pResults = NULL;
+}
+
+C_ZipVerifier::~C_ZipVerifier()
+{
+	delete[] m_pWorkers;
+	delete[] m_pResults;
+}
+
+void C_ZipVerifier::SetResult(S_VerifyResult *io_pResult, E_VerifyStatus i_eStatus, const char *i_szFormat, ...)
+{
+	if(i_eStatus <= io_pResult->eStatus) return;
+	io_pResult->eStatus = i_eStatus;
+	va_list pArgs;
+	va_start(pArgs, i_szFormat);
+	vsnprintf(io_pResult->szMessage, sizeof(io_pResult->szMessage), i_szFormat, pArgs);
+	va_end(pArgs);
+}
+
+int C_ZipVerifier::CompareSizes(const void *i_pA, const void *i_pB)
+{
+	const S_SizeIndex *pA = (const S_SizeIndex *)i_pA;
+	const S_SizeIndex *pB = (const S_SizeIndex *)i_pB;
+	if(pA->iSize != pB->iSize) return pA->iSize > pB->iSize ? -1 : 1;
+	return pA->iIdx - pB->iIdx;
+}
+
+void C_ZipVerifier::VerifyTask(void *i_pContext, int i_iWorker, int i_iTask)
+{
+	C_ZipVerifier *pThis = (C_ZipVerifier *)i_pContext;
+	pThis->VerifyEntry(&pThis->m_pWorkers[i_iWorker], i_iTask, &pThis->m_pResults[i_iTask]);
+}
+
+void C_ZipVerifier::VerifyEntry(S_Worker *i_pWorker, int i_iIdx, S_VerifyResult *o_pResult)
+{
+	S_CentralDirectoryEntry stEntry;
+	m_pclZip->GetEntry(i_iIdx, &stEntry);
+	const S_Zip64Values *pValues = m_pclZip->GetEntry64(i_iIdx);
+	const char *szName = m_pclZip->GetFileName(i_iIdx);
+	uint64_t iDataEnd = m_pclZip->GetCDStart(); //all local data is before the CD
+	C_Resource *pclFile = &i_pWorker->clFile;
+	uint8_t *pBuffer = i_pWorker->pBuffer;
+
+	//local header, with its name and extra field
+	if(pValues->offset > iDataEnd || iDataEnd-pValues->offset < sizeof(S_LocalFileHeader)) {
+		SetResult(o_pResult, VERIFY_ERROR, "local header is not before the central directory");
+		return;
+	}
+	S_LocalFileHeader stLocal;
+	pclFile->Seek(pValues->offset, SEEK_SET);
+	if(!pclFile->Read(pBuffer, sizeof(S_LocalFileHeader))) {
+		SetResult(o_pResult, VERIFY_ERROR, "could not read local header");
+		return;
+	}
+	DecodeRecord(pBuffer, &stLocal);
+	uint64_t iDataPos = pValues->offset + sizeof(S_LocalFileHeader) + stLocal.name_len + stLocal.extra_len;
+	if(stLocal.sign != 0x04034b50) {
+		SetResult(o_pResult, VERIFY_ERROR, "no local header at offset %llu", (unsigned long long)pValues->offset);
+		return;
+	}
+	if(iDataPos > iDataEnd || !pclFile->Read(pBuffer, stLocal.name_len+stLocal.extra_len)) {
+		SetResult(o_pResult, VERIFY_ERROR, "could not read local name and extra field");
+		return;
+	}
+	if(stLocal.name_len != stEntry.name_len || memcmp(pBuffer, szName, stLocal.name_len) != 0) {
+		SetResult(o_pResult, VERIFY_ERROR, "local name differs");
+		return;
+	}
+	if(stLocal.gp_flag != stEntry.gp_flag) SetResult(o_pResult, VERIFY_ERROR, "local flags differ (%04x, central %04x)", stLocal.gp_flag, stEntry.gp_flag);
+	if(stLocal.c_method != stEntry.c_method) SetResult(o_pResult, VERIFY_ERROR, "local method differs (%d, central %d)", stLocal.c_method, stEntry.c_method);
+	if(stLocal.lm_time != stEntry.lm_time || stLocal.lm_date != stEntry.lm_date) SetResult(o_pResult, VERIFY_WARNING, "local modification time differs");
+	if(stLocal.ver_needed != stEntry.ver_needed) SetResult(o_pResult, VERIFY_WARNING, "local version needed differs (%04x, central %04x)", stLocal.ver_needed, stEntry.ver_needed);
+	//with a data descriptor (bit 3) the local crc and sizes are 0, otherwise they
+	// must be the ones of the CD, the sizes can be in the local zip64 extra field
+	if(!(stLocal.gp_flag & 0x0008)) {
+		uint64_t iSize = stLocal.u_size;
+		uint64_t iCompressedSize = stLocal.c_size;
+		const uint8_t *pExtra = pBuffer+stLocal.name_len;
+		for(int iPos=0; iPos+4 <= stLocal.extra_len; ) {
+			uint16_t iId  = LoadLittleEndian<uint16_t>(pExtra+iPos);
+			uint16_t iLen = LoadLittleEndian<uint16_t>(pExtra+iPos+2);
+			iPos += 4;
+			if(iPos+iLen > stLocal.extra_len) break;
+			if(iId == 0x0001) {
+				if(iSize == 0xffffffff && iLen >= 8) iSize = LoadLittleEndian<uint64_t>(pExtra+iPos);
+				if(iCompressedSize == 0xffffffff && iLen >= 16) iCompressedSize = LoadLittleEndian<uint64_t>(pExtra+iPos+8);
+				break;
+			}
+			iPos += iLen;
+		}
+		if(stLocal.crc32 != stEntry.crc32) SetResult(o_pResult, VERIFY_ERROR, "local crc differs (%08x, central %08x)", stLocal.crc32, stEntry.crc32);
+		if(iSize != pValues->u_size || iCompressedSize != pValues->c_size) SetResult(o_pResult, VERIFY_ERROR, "local sizes differ");
+	}
+	if(iDataEnd-iDataPos < pValues->c_size) {
+		SetResult(o_pResult, VERIFY_ERROR, "data overlaps the central directory");
+		return;
+	}
+	if(stEntry.gp_flag & 0x0001) {
+		SetResult(o_pResult, VERIFY_SKIPPED, "is encrypted, data not verified");
+		return;
+	}
+
+	//the data
+	uint64_t iSize = 0;
+	uint32_t iCrc = 0;
+	pclFile->Seek(iDataPos, SEEK_SET);
+	if(stEntry.c_method == 0) {
+		if(pValues->c_size != pValues->u_size) {
+			SetResult(o_pResult, VERIFY_ERROR, "stored, but the sizes differ");
+			return;
+		}
+		while(iSize < pValues->c_size) {
+			uint32_t iLength = pValues->c_size-iSize < BUFFER_SIZE ? (uint32_t)(pValues->c_size-iSize) : BUFFER_SIZE;
+			if(!pclFile->Read(pBuffer, iLength)) {
+				SetResult(o_pResult, VERIFY_ERROR, "could not read data");
+				return;
+			}
+			iCrc = Crc32Update(iCrc, pBuffer, iLength);
+			iSize += iLength;
+		}
+	} else if(stEntry.c_method == 8) {
+		if(!i_pWorker->clInflater.Inflate(pclFile, pValues->c_size, &iSize, &iCrc)) {
+			SetResult(o_pResult, VERIFY_ERROR, "could not inflate (%s)", i_pWorker->clInflater.GetError());
+			return;
+		}
+	} else {
+		SetResult(o_pResult, VERIFY_SKIPPED, "compression method %d, data not verified", stEntry.c_method);
+		return;
+	}
+	if(iSize != pValues->u_size) {
+		SetResult(o_pResult, VERIFY_ERROR, "size mismatch (%llu, central %llu)", (unsigned long long)iSize, (unsigned long long)pValues->u_size);
+		return;
+	}
+	if(iCrc != stEntry.crc32) SetResult(o_pResult, VERIFY_ERROR, "crc mismatch (%08x, central %08x)", iCrc, stEntry.crc32);
+}
+
+bool C_ZipVerifier::Verify(int i_iNumThreads)
+{
+	int iNumFiles = m_pclZip->GetNumFiles();
+	m_pResults = new S_VerifyResult[iNumFiles > 0 ? iNumFiles : 1];
+	memset(m_pResults, 0, sizeof(S_VerifyResult)*(iNumFiles > 0 ? iNumFiles : 1));
+
+	int iNumThreads = i_iNumThreads > 0 ? i_iNumThreads : C_WorkPool::GetNumCores();
+	if(iNumThreads > iNumFiles) iNumThreads = iNumFiles > 0 ? iNumFiles : 1;
+	m_pWorkers = new S_Worker[iNumThreads];
+	bool bResult = true;
+	for(int i=0; i<iNumThreads; i++) {
+		m_pWorkers[i].pBuffer = NULL;
+		m_pWorkers[i].clFile.SetMode(true);
+		if(!m_pWorkers[i].clFile.SetFilename(m_szZipFile)) bResult = false;
+	}
+	if(!bResult) {
+		LogPrintf("error: could not open zip file for verifying (%s)\n", m_szZipFile);
+		return false;
+	}
+	for(int i=0; i<iNumThreads; i++) m_pWorkers[i].pBuffer = new uint8_t[BUFFER_SIZE];
+
+	//largest first, so a big entry does not end up alone at the end
+	S_SizeIndex *pOrder = new S_SizeIndex[iNumFiles > 0 ? iNumFiles : 1];
+	for(int i=0; i<iNumFiles; i++) {
+		pOrder[i].iSize = m_pclZip->GetEntry64(i)->c_size;
+		pOrder[i].iIdx = i;
+	}
+	qsort(pOrder, iNumFiles, sizeof(S_SizeIndex), CompareSizes);
+	{
+		C_WorkPool clPool(iNumThreads, VerifyTask, this);
+		for(int i=0; i<iNumFiles; i++) clPool.Submit(pOrder[i].iIdx);
+	}
+	delete[] pOrder;
+	for(int i=0; i<iNumThreads; i++) delete[] m_pWorkers[i].pBuffer;
+
+	//in CD order
+	static const char *szStatus[4] = { "ok", "warning", "skipped", "error" };
+	int pNum[4] = { 0, 0, 0, 0 };
+	for(int i=0; i<iNumFiles; i++) {
+		S_VerifyResult *pResult = &m_pResults[i];
+		pNum[pResult->eStatus]++;
+		if(pResult->eStatus != VERIFY_OK) LogPrintf("%s: \"%s\" %s\n", szStatus[pResult->eStatus], m_pclZip->GetFileName(i), pResult->szMessage);
+	}
+	LogPrintf("verified %d entries: %d ok, %d warnings, %d skipped, %d errors\n", iNumFiles, pNum[VERIFY_OK], pNum[VERIFY_WARNING], pNum[VERIFY_SKIPPED], pNum[VERIFY_ERROR]);
+	return pNum[VERIFY_ERROR] == 0;
+}
+
+/////////////
+//parallel decoding of the CD records, the boundaries are found before
+
+struct S_ParseContext
+{
+	C_ZipFile *pclZip;
+	int iNumFiles;
+	int *pErrors; //per chunk, the first bad entry or -1
+};
+
+void C_ZipFile::ParseTask(void *i_pContext, int i_iWorker, int i_iTask)
+{
+	S_ParseContext *pContext = (S_ParseContext *)i_pContext;
+	int iFirst = i_iTask*PARSE_CHUNK;
+	int iEnd = pContext->iNumFiles-iFirst < PARSE_CHUNK ? pContext->iNumFiles : iFirst+PARSE_CHUNK;
+	pContext->pErrors[i_iTask] = pContext->pclZip->DecodeEntries(iFirst, iEnd);
+}
+
+int C_ZipFile::DecodeEntriesParallel(int i_iNumFiles)
+{
+	int iNumChunks = (i_iNumFiles+PARSE_CHUNK-1)/PARSE_CHUNK;
+	int iNumThreads = m_iParseThreads > 0 ? m_iParseThreads : C_WorkPool::GetNumCores();
+	if(iNumThreads > iNumChunks) iNumThreads = iNumChunks;
+	if(iNumThreads <= 1) return DecodeEntries(0, i_iNumFiles);
+
+	S_ParseContext stContext;
+	stContext.pclZip = this;
+	stContext.iNumFiles = i_iNumFiles;
+	stContext.pErrors = new int[iNumChunks];
+	{
+		C_WorkPool clPool(iNumThreads, ParseTask, &stContext);
+		for(int i=0; i<iNumChunks; i++) clPool.Submit(i);
+	}
+	//the first in CD order, whichever chunk finished first
+	int iBad = -1;
+	for(int i=0; i<iNumChunks && iBad < 0; i++) iBad = stContext.pErrors[i];
+	delete[] stContext.pErrors;
+	return iBad;
+}
+
+bool VerifyZip(char *i_szZipFile, S_Options *i_pstOptions)
+{
+	C_ZipFile clZip;
+	clZip.SetParseThreads(i_pstOptions->iThreads);
+	if(!clZip.Open(i_szZipFile)) {
+		LogPrintf("error: could not open zip file (%s)\n", i_szZipFile);
+		return false;
+	}
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_VERIFY);
+	C_ZipVerifier clVerifier(&clZip, i_szZipFile);
+	return clVerifier.Verify(i_pstOptions->iThreads);
+}
+
+/////////////
+//listing of the CD (--list), only the tail of the zip is read. every entry is
+// filtered while scanning and written as one line of tab separated values or
+// one json object, to stdout (the messages go to stderr).
+
+enum E_ListKind { LIST_ANY = -1, LIST_DIR, LIST_EXEC, LIST_NORMAL, LIST_OTHER };
+static const char *g_szListKinds[] = { "dir", "exec", "normal", "other" };
+
+static int GetListKind(C_ZipFile *i_pclZip, int i_iIdx)
+{
+	//the same bits IsExecutable/IsNormal look at
+	if(i_pclZip->IsDirectory(i_iIdx)) return LIST_DIR;
+	return i_pclZip->IsExecutable(i_iIdx) ? LIST_EXEC : i_pclZip->IsNormal(i_iIdx) ? LIST_NORMAL : LIST_OTHER;
+}
+
+//unix mode only when made on unix (or given anyway), false when there is none
+static bool GetUnixMode(const S_CentralDirectoryEntry *i_pEntry, uint32_t *o_iMode)
+{
+	*o_iMode = (i_pEntry->ext_attrib >> 16) & 07777;
+	return (i_pEntry->ver >> 8) == 3 || (i_pEntry->ext_attrib >> 16) != 0;
+}
+
+struct S_ListFilter
+{
+	bool bJson;
+	C_PermissionPolicy clMatch; //--match globs, every entry when there are none
+	uint32_t pModes[64];        //--mode or --not-mode, unix permission bits
+	int iNumModes;
+	bool bNotModes;
+	int iKind;                  //E_ListKind
+	bool bHeaderDone;           //tsv header, once for all archives
+};
+
+bool ParseListModes(const char *i_szModes, S_ListFilter *o_pFilter, bool i_bNot)
+{
+	//octal modes separated by ',' or '/'
+	o_pFilter->iNumModes = 0;
+	o_pFilter->bNotModes = i_bNot;
+	const char *pPos = i_szModes;
+	while(*pPos) {
+		char *szEnd;
+		uint32_t iMode = (uint32_t)strtoul(pPos, &szEnd, 8);
+		if(szEnd == pPos || iMode > 07777 || o_pFilter->iNumModes == 64 || (*szEnd != 0 && *szEnd != ',' && *szEnd != '/')) return false;
+		o_pFilter->pModes[o_pFilter->iNumModes++] = iMode;
+		pPos = *szEnd ? szEnd+1 : szEnd;
+	}
+	return o_pFilter->iNumModes > 0;
+}
+
+static bool IsValidUtf8(const uint8_t *i_pText, int i_iLen)
+{
+	for(int i=0; i<i_iLen; ) {
+		uint8_t c = i_pText[i];
+		int iFollow = c < 0x80 ? 0 : (c >= 0xc2 && c < 0xe0) ? 1 : (c >= 0xe0 && c < 0xf0) ? 2 : (c >= 0xf0 && c < 0xf5) ? 3 : -1;
+		if(iFollow < 0 || i_iLen-i <= iFollow) return false;
+		for(int j=1; j<=iFollow; j++) if((i_pText[i+j]&0xc0) != 0x80) return false;
+		i += 1+iFollow;
+	}
+	return true;
+}
+
+static void PutListName(FILE *i_pOutput, const char *i_szName, int i_iLen, bool i_bJson)
+{
+	//json: quoted, names which are not utf-8 (cp437) have the upper bytes as
+	// latin-1 code points. tsv: tab, newline and backslash escaped.
+	bool bUtf8 = !i_bJson || IsValidUtf8((const uint8_t *)i_szName, i_iLen);
+	if(i_bJson) putc('"', i_pOutput);
+	for(int i=0; i<i_iLen; i++) {
+		uint8_t c = (uint8_t)i_szName[i];
+		if(c == '\\') fputs("\\\\", i_pOutput);
+		else if(c == '\t') fputs("\\t", i_pOutput);
+		else if(c == '\n') fputs("\\n", i_pOutput);
+		else if(c == '\r') fputs("\\r", i_pOutput);
+		else if(i_bJson && c == '"') fputs("\\\"", i_pOutput);
+		else if(i_bJson && (c < 0x20 || (c >= 0x80 && !bUtf8))) fprintf(i_pOutput, "\\u%04x", c);
+		else putc(c, i_pOutput);
+	}
+	if(i_bJson) putc('"', i_pOutput);
+}
+
+bool ListZip(char *i_szZipFile, FILE *i_pOutput, S_ListFilter *i_pFilter, int i_iThreads)
+{
+	C_ZipFile clZip;
+	clZip.SetParseThreads(i_iThreads);
+	if(!clZip.Open(i_szZipFile)) return false;
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_LIST);
+	if(!i_pFilter->bJson && !i_pFilter->bHeaderDone) fputs("zip\tname\tsize\tcsize\tmethod\tcrc\tos\tmode\tdos\tkind\toffset\n", i_pOutput);
+	i_pFilter->bHeaderDone = true;
+	int iNumListed = 0;
+	S_CentralDirectoryEntry stEntry;
+	for(int i=0; i<clZip.GetNumFiles(); i++) {
+		const char *szName = clZip.GetFileName(i);
+		int iLen = (int)strlen(szName);
+		int iKind = GetListKind(&clZip, i);
+		bool bDirectory = iKind == LIST_DIR;
+		if(i_pFilter->iKind != LIST_ANY && iKind != i_pFilter->iKind) continue;
+		clZip.GetEntry(i, &stEntry);
+		//no mode matches no --mode
+		int iOS = stEntry.ver >> 8;
+		uint32_t iMode;
+		bool bUnix = GetUnixMode(&stEntry, &iMode);
+		if(i_pFilter->iNumModes) {
+			bool bFound = false;
+			for(int j=0; j<i_pFilter->iNumModes && !bFound; j++) bFound = bUnix && iMode == i_pFilter->pModes[j];
+			if(bFound == i_pFilter->bNotModes) continue;
+		}
+		if(i_pFilter->clMatch.GetNumRules() && i_pFilter->clMatch.Classify(szName, iLen, bDirectory) < 0) continue;
+
+		const S_Zip64Values *pValues = clZip.GetEntry64(i);
+		char szDos[8];
+		int iDos = 0;
+		if(stEntry.ext_attrib & 0x10) szDos[iDos++] = 'd';
+		if(stEntry.ext_attrib & 0x01) szDos[iDos++] = 'r';
+		if(stEntry.ext_attrib & 0x02) szDos[iDos++] = 'h';
+		if(stEntry.ext_attrib & 0x04) szDos[iDos++] = 's';
+		if(stEntry.ext_attrib & 0x20) szDos[iDos++] = 'a';
+		szDos[iDos] = 0;
+		char szMode[8];
+		if(bUnix) sprintf(szMode, "%04o", iMode);
+		else szMode[0] = 0;
+		const char *szOS = iOS == 0 ? "dos" : iOS == 3 ? "unix" : iOS == 19 ? "osx" : iOS == 10 ? "ntfs" : "other";
+		const char *szMethod = stEntry.c_method == 0 ? "stored" : stEntry.c_method == 8 ? "deflated" : stEntry.c_method == 9 ? "deflate64" : stEntry.c_method == 12 ? "bzip2" : stEntry.c_method == 14 ? "lzma" : stEntry.c_method == 93 ? "zstd" : "other";
+
+		if(i_pFilter->bJson) {
+			fputs("{\"zip\":", i_pOutput);
+			PutListName(i_pOutput, i_szZipFile, (int)strlen(i_szZipFile), true);
+			fputs(",\"name\":", i_pOutput);
+			PutListName(i_pOutput, szName, iLen, true);
+			fprintf(i_pOutput, ",\"size\":%llu,\"csize\":%llu,\"method\":\"%s\",\"crc\":\"%08x\",\"os\":\"%s\",\"mode\":%s%s%s,\"dos\":\"%s\",\"kind\":\"%s\",\"offset\":%llu}\n",
+				(unsigned long long)pValues->u_size, (unsigned long long)pValues->c_size, szMethod, stEntry.crc32, szOS,
+				bUnix ? "\"" : "", bUnix ? szMode : "null", bUnix ? "\"" : "", szDos, g_szListKinds[iKind], (unsigned long long)pValues->offset);
+		} else {
+			PutListName(i_pOutput, i_szZipFile, (int)strlen(i_szZipFile), false);
+			putc('\t', i_pOutput);
+			PutListName(i_pOutput, szName, iLen, false);
+			fprintf(i_pOutput, "\t%llu\t%llu\t%s\t%08x\t%s\t%s\t%s\t%s\t%llu\n",
+				(unsigned long long)pValues->u_size, (unsigned long long)pValues->c_size, szMethod, stEntry.crc32, szOS,
+				szMode, szDos, g_szListKinds[iKind], (unsigned long long)pValues->offset);
+		}
+		iNumListed++;
+	}
+	clPhase.End();
+	if(fflush(i_pOutput) != 0) {
+		LogPrintf("error: could not write the list\n");
+		return false;
+	}
+	LogPrintf("listed %d of %d entries\n", iNumListed, clZip.GetNumFiles());
+	return true;
+}
+
+/////////////
+//--diff, the CDs of two zips joined on the names: every entry of one is looked up
+// in the name index of the other with the hash made when opening, so the cost is
+// linear in the number of entries.
+// only the CDs are read, contents are compared by crc-32 and size.
+
+//the unix mode and file type when there is a mode, otherwise the dos attributes.
+// these are all the bits compared, so the texts differ only when they do
+static void FormatDiffAttributes(const S_CentralDirectoryEntry *i_pEntry, char *o_szText)
+{
+	uint32_t iMode;
+	if(GetUnixMode(i_pEntry, &iMode)) {
+		uint32_t iType = (i_pEntry->ext_attrib >> 16) & 0170000;
+		const char *szType = iType == 0100000 ? "file" : iType == 0040000 ? "dir" : iType == 0120000 ? "link" : iType == 0 ? "no type" : "other type";
+		sprintf(o_szText, "%04o %s", iMode, szType);
+	}
+	else sprintf(o_szText, "no mode, dos %02x", i_pEntry->ext_attrib & 0xff);
+}
+
+bool DiffZips(char *i_szOldZip, char *i_szNewZip, S_Options *i_pstOptions, bool *o_bDifferent)
+{
+	*o_bDifferent = false;
+	C_ZipFile clOld, clNew;
+	clOld.SetParseThreads(i_pstOptions->iThreads);
+	clNew.SetParseThreads(i_pstOptions->iThreads);
+	if(!clOld.Open(i_szOldZip)) {
+		LogPrintf("error: could not open zip file (%s)\n", i_szOldZip);
+		return false;
+	}
+	if(!clNew.Open(i_szNewZip)) {
+		LogPrintf("error: could not open zip file (%s)\n", i_szNewZip);
+		return false;
+	}
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_DIFF);
+	int iNumAdded = 0, iNumRemoved = 0, iNumChanged = 0, iNumAttributes = 0, iNumSame = 0;
+	S_CentralDirectoryEntry stOld, stNew;
+	char szOld[32], szNew[32];
+	//removed and changed in the order of the old CD. of duplicate names only the
+	// first is compared, it is the one found by name
+	for(int i=0; i<clOld.GetNumFiles(); i++) {
+		const char *szName = clOld.GetFileName(i);
+		uint32_t iHash = clOld.GetNameHash(i);
+		if(clOld.FindFileIndexInCD(szName, iHash) != i) continue;
+		int j = clNew.FindFileIndexInCD(szName, iHash);
+		if(j < 0) {
+			LogPrintf("removed: \"%s\"\n", szName);
+			iNumRemoved++;
+			continue;
+		}
+		clOld.GetEntry(i, &stOld);
+		clNew.GetEntry(j, &stNew);
+		const S_Zip64Values *pOld = clOld.GetEntry64(i);
+		const S_Zip64Values *pNew = clNew.GetEntry64(j);
+		bool bSame = true;
+		if(stOld.crc32 != stNew.crc32 || pOld->u_size != pNew->u_size) {
+			LogPrintf("changed: \"%s\" size %llu -> %llu, crc %08x -> %08x\n", szName,
+				(unsigned long long)pOld->u_size, (unsigned long long)pNew->u_size, stOld.crc32, stNew.crc32);
+			iNumChanged++;
+			bSame = false;
+		}
+		//whether there is a unix mode depends on the os byte of the version made by,
+		// the version needed is not looked at
+		bool bAttributes = stOld.ext_attrib != stNew.ext_attrib || (stOld.ver >> 8) != (stNew.ver >> 8);
+		if(bAttributes) {
+			FormatDiffAttributes(&stOld, szOld);
+			FormatDiffAttributes(&stNew, szNew);
+		}
+		if(bAttributes && strcmp(szOld, szNew) != 0) {
+			LogPrintf("attributes: \"%s\" %s -> %s\n", szName, szOld, szNew);
+			iNumAttributes++;
+			bSame = false;
+		}
+		if(bSame) iNumSame++;
+	}
+	//added in the order of the new CD
+	for(int i=0; i<clNew.GetNumFiles(); i++) {
+		const char *szName = clNew.GetFileName(i);
+		uint32_t iHash = clNew.GetNameHash(i);
+		if(clNew.FindFileIndexInCD(szName, iHash) != i || clOld.FindFileIndexInCD(szName, iHash) >= 0) continue;
+		clNew.GetEntry(i, &stNew);
+		FormatDiffAttributes(&stNew, szNew);
+		LogPrintf("added: \"%s\" size %llu, %s\n", szName, (unsigned long long)clNew.GetEntry64(i)->u_size, szNew);
+		iNumAdded++;
+	}
+	clPhase.End();
+	LogPrintf("diff: %d added, %d removed, %d changed, %d with other attributes, %d the same\n",
+		iNumAdded, iNumRemoved, iNumChanged, iNumAttributes, iNumSame);
+	*o_bDifferent = iNumAdded || iNumRemoved || iNumChanged || iNumAttributes;
+	return true;
+}
+
+/////////////
+//extraction (--extract) into a staging directory next to the target, so a failed
+// or interrupted run leaves the target as it was. the directories are made first,
+// then the files are written in parallel, the largest first: stored ones are
+// summed while they are copied (file to file when the zip was verified first),
+// deflated ones inflated, and both checked against the crc and size of the CD. the modes are those of the unix attributes. a target which does
+// not exist is replaced by the staging directory with one rename, in an existing
+// one every file replaces the old one with its own rename and the files which
+// are not in the zip are kept (config and logs of an installation). that is not
+// atomic as a whole: the old files are kept as hard links next to the target
+// until all are replaced, and put back when one can not be.
+
+struct S_ExtractResult
+{
+	bool bError;
+	char szMessage[128];
+};
+
+class C_ZipExtractor
+{
+public:
+	C_ZipExtractor(C_ZipFile *i_pclZip, const char *i_szZipFile);
+	~C_ZipExtractor();
+
+	//i_bVerified: the zip passed VerifyZip, stored data is then copied file to
+	// file without summing it again
+	bool Extract(const char *i_szDirectory, int i_iNumThreads, bool i_bVerified);
+private:
+	enum { COPY_SIZE = 1024*1024 };
+	struct S_Worker
+	{
+		C_Resource clFile;
+		C_Inflater clInflater;
+		uint8_t *pBuffer; //stored data when it is summed
+	};
+	struct S_SizeIndex
+	{
+		uint64_t iSize;
+		int iIdx;
+	};
+
+	static void ExtractTask(void *i_pContext, int i_iWorker, int i_iTask);
+	static int CompareSizes(const void *i_pA, const void *i_pB);
+	static void SetResult(S_ExtractResult *o_pResult, const char *i_szFormat, ...);
+	static bool IsSafeName(const char *i_szName);
+	static bool MakeDirectory(const char *i_szPath);
+	static bool MakeDirectories(char *io_szPath, int i_iFrom);
+	static bool MoveReplacing(const char *i_szFrom, const char *i_szTo);
+	static bool LinkFile(const char *i_szExisting, const char *i_szNew);
+	static bool Exists(const char *i_szPath);
+	static void SetMode(const char *i_szPath, uint32_t i_iMode);
+	char *MakePath(const char *i_szBase, int i_iIdx);
+	bool CheckEntries();
+	bool MakeTree(const char *i_szBase);
+	void ExtractEntry(S_Worker *i_pWorker, int i_iIdx, S_ExtractResult *o_pResult);
+	bool WriteFiles(int i_iNumThreads);
+	void SetDirectoryModes(const char *i_szBase);
+	bool MoveInto(const char *i_szDirectory);
+	char *MakeBackupPath(int i_iIdx);
+	bool PutBack(const char *i_szDirectory);
+	void RemoveBackup();
+	void RemoveStaging();
+
+	C_ZipFile *m_pclZip;
+	const char *m_szZipFile;
+	char *m_szStaging;
+	char *m_szBackup;    //old files of an existing target while it is updated
+	enum { MOVED_NONE, MOVED_NEW, MOVED_REPLACED };
+	uint8_t *m_pMoved;   //per entry, set while moving into an existing target
+	bool m_bPutBackFailed;
+	bool *m_pSkip;       //per entry, duplicate names after the first
+	uint32_t *m_pModes;  //per entry, unix mode or 0 when there is none
+	S_Worker *m_pWorkers;
+	int m_iNumWorkers;
+	S_ExtractResult *m_pResults;
+	bool m_bVerified;
+};
+
+C_ZipExtractor::C_ZipExtractor(C_ZipFile *i_pclZip, const char *i_szZipFile)
+{
+	m_pclZip = i_pclZip;
+	m_szZipFile = i_szZipFile;
+	m_szStaging = NULL;
+	m_szBackup = NULL;
+	m_pMoved = NULL;
+	m_bPutBackFailed = false;
+	m_pSkip = NULL;
+	m_pModes = NULL;
+	m_pWorkers = NULL;
+	m_iNumWorkers = 0;
+	m_pResults = NULL;
+	m_bVerified = false;
+}
+
+C_ZipExtractor::~C_ZipExtractor()
+{
+	delete[] m_szStaging;
+	delete[] m_szBackup;
+	delete[] m_pMoved;
+	delete[] m_pSkip;
+	delete[] m_pModes;
+	for(int i=0; i<m_iNumWorkers; i++) delete[] m_pWorkers[i].pBuffer;
+	delete[] m_pWorkers;
+	delete[] m_pResults;
+}
+
+void C_ZipExtractor::SetResult(S_ExtractResult *o_pResult, const char *i_szFormat, ...)
+{
+	if(o_pResult->bError) return;
+	o_pResult->bError = true;
+	va_list pArgs;
+	va_start(pArgs, i_szFormat);
+	vsnprintf(o_pResult->szMessage, sizeof(o_pResult->szMessage), i_szFormat, pArgs);
+	va_end(pArgs);
+}
+
+int C_ZipExtractor::CompareSizes(const void *i_pA, const void *i_pB)
+{
+	const S_SizeIndex *pA = (const S_SizeIndex *)i_pA;
+	const S_SizeIndex *pB = (const S_SizeIndex *)i_pB;
+	if(pA->iSize != pB->iSize) return pA->iSize > pB->iSize ? -1 : 1;
+	return pA->iIdx - pB->iIdx;
+}
+
+bool C_ZipExtractor::IsSafeName(const char *i_szName)
+{
+	//relative, without .. and without drive letters or backslashes (which are
+	// separators on windows), so nothing can be written outside the directory
+	if(i_szName[0] == 0 || i_szName[0] == '/' || strchr(i_szName, '\\') || strchr(i_szName, ':')) return false;
+	for(const char *pPos = i_szName; *pPos; ) {
+		const char *pEnd = strchr(pPos, '/');
+		size_t iLen = pEnd ? (size_t)(pEnd-pPos) : strlen(pPos);
+		if(iLen == 2 && pPos[0] == '.' && pPos[1] == '.') return false;
+		pPos += iLen;
+		if(*pPos) pPos++;
+	}
+	return true;
+}
+
+bool C_ZipExtractor::MakeDirectory(const char *i_szPath)
+{
+	//one that is there must be a directory itself, not a link to one, which would
+	// let the entries below it be written somewhere else
+#ifdef _WIN32
+	if(CreateDirectoryA(i_szPath, NULL)) return true;
+	DWORD iAttributes = GetFileAttributesA(i_szPath);
+	return iAttributes != INVALID_FILE_ATTRIBUTES && (iAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		&& !(iAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+#else
+	if(mkdir(i_szPath, 0755) == 0) return true;
+	struct stat stStat;
+	return errno == EEXIST && lstat(i_szPath, &stStat) == 0 && S_ISDIR(stStat.st_mode);
+#endif
+}
+
+bool C_ZipExtractor::MakeDirectories(char *io_szPath, int i_iFrom)
+{
+	//every directory of the path after i_iFrom, the path is changed while working
+	for(char *pPos = io_szPath+i_iFrom; ; pPos++) {
+		if(*pPos != '/' && *pPos != 0) continue;
+		char c = *pPos;
+		*pPos = 0;
+		bool bOK = pPos == io_szPath+i_iFrom || MakeDirectory(io_szPath);
+		*pPos = c;
+		if(!bOK) return false;
+		if(c == 0) return true;
+	}
+}
+
+bool C_ZipExtractor::MoveReplacing(const char *i_szFrom, const char *i_szTo)
+{
+	//the mode of the new file is kept (C_Resource::Rename takes the old one)
+#ifdef _WIN32
+	return MoveFileExA(i_szFrom, i_szTo, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(i_szFrom, i_szTo) == 0;
+#endif
+}
+
+bool C_ZipExtractor::LinkFile(const char *i_szExisting, const char *i_szNew)
+{
+#ifdef _WIN32
+	return CreateHardLinkA(i_szNew, i_szExisting, NULL) != 0;
+#else
+	return link(i_szExisting, i_szNew) == 0;
+#endif
+}
+
+bool C_ZipExtractor::Exists(const char *i_szPath)
+{
+#ifdef _WIN32
+	return GetFileAttributesA(i_szPath) != INVALID_FILE_ATTRIBUTES;
+#else
+	struct stat stStat;
+	return lstat(i_szPath, &stStat) == 0;
+#endif
+}
+
+void C_ZipExtractor::SetMode(const char *i_szPath, uint32_t i_iMode)
+{
+	//permission bits only, setuid/setgid/sticky from an archive are not applied
+#ifndef _WIN32
+	if(i_iMode & 0777) chmod(i_szPath, i_iMode & 0777);
+#endif
+}
+
+char *C_ZipExtractor::MakePath(const char *i_szBase, int i_iIdx)
+{
+	const char *szName = m_pclZip->GetFileName(i_iIdx);
+	char *szPath = new char[strlen(i_szBase)+strlen(szName)+2];
+	sprintf(szPath, "%s/%s", i_szBase, szName);
+	//without the trailing separator of directories
+	size_t iLen = strlen(szPath);
+	if(szPath[iLen-1] == '/') szPath[iLen-1] = 0;
+	return szPath;
+}
+
+bool C_ZipExtractor::CheckEntries()
+{
+	//everything that would stop the extraction is found before anything is written
+	int iNumFiles = m_pclZip->GetNumFiles();
+	m_pSkip = new bool[iNumFiles > 0 ? iNumFiles : 1];
+	m_pModes = new uint32_t[iNumFiles > 0 ? iNumFiles : 1];
+	bool bResult = true;
+	S_CentralDirectoryEntry stEntry;
+	for(int i=0; i<iNumFiles; i++) {
+		const char *szName = m_pclZip->GetFileName(i);
+		m_pSkip[i] = m_pclZip->FindFileIndexInCD(szName, m_pclZip->GetNameHash(i)) != i;
+		if(m_pSkip[i]) {
+			LogPrintf("warning: \"%s\" is in the zip more than once, the first is extracted\n", szName);
+			continue;
+		}
+		m_pclZip->GetEntry(i, &stEntry);
+		uint32_t iMode;
+		m_pModes[i] = GetUnixMode(&stEntry, &iMode) ? ((stEntry.ext_attrib >> 16) & 0170000) | iMode : 0;
+		const char *szProblem = NULL;
+		if(!IsSafeName(szName)) szProblem = "name is not a relative path within the directory";
+		else if(stEntry.gp_flag & 0x0001) szProblem = "is encrypted";
+		else if((m_pModes[i] & 0170000) == 0120000) szProblem = "is a symbolic link";
+		else if(!m_pclZip->IsDirectory(i) && stEntry.c_method != 0 && stEntry.c_method != 8) szProblem = "compression method is not supported";
+		if(szProblem) {
+			LogPrintf("error: \"%s\" %s\n", szName, szProblem);
+			bResult = false;
+		}
+	}
+	return bResult;
+}
+
+bool C_ZipExtractor::MakeTree(const char *i_szBase)
+{
+	//the directories of the entries, in CD order. consecutive entries usually share
+	// their directory, it is only made once then
+	int iBaseLen = (int)strlen(i_szBase);
+	char *szLast = NULL;
+	bool bResult = true;
+	for(int i=0; i<m_pclZip->GetNumFiles() && bResult; i++) {
+		if(m_pSkip[i]) continue;
+		char *szPath = MakePath(i_szBase, i);
+		if(!m_pclZip->IsDirectory(i)) {
+			char *szSlash = strrchr(szPath, '/');
+			*szSlash = 0;
+		}
+		if(szLast == NULL || strcmp(szLast, szPath) != 0) {
+			bResult = MakeDirectories(szPath, iBaseLen);
+			if(!bResult) LogPrintf("error: could not make directory, or something else than a directory is in its place (%s)\n", szPath);
+			delete[] szLast;
+			szLast = szPath;
+		} else delete[] szPath;
+	}
+	delete[] szLast;
+	return bResult;
+}
+
+void C_ZipExtractor::ExtractTask(void *i_pContext, int i_iWorker, int i_iTask)
+{
+	C_ZipExtractor *pThis = (C_ZipExtractor *)i_pContext;
+	pThis->ExtractEntry(&pThis->m_pWorkers[i_iWorker], i_iTask, &pThis->m_pResults[i_iTask]);
+}
+
+void C_ZipExtractor::ExtractEntry(S_Worker *i_pWorker, int i_iIdx, S_ExtractResult *o_pResult)
+{
+	S_CentralDirectoryEntry stEntry;
+	m_pclZip->GetEntry(i_iIdx, &stEntry);
+	const S_Zip64Values *pValues = m_pclZip->GetEntry64(i_iIdx);
+	uint64_t iDataEnd = m_pclZip->GetCDStart();
+	C_Resource *pclFile = &i_pWorker->clFile;
+
+	//the data follows the local header with its name and extra field
+	uint8_t pHeader[sizeof(S_LocalFileHeader)];
+	S_LocalFileHeader stLocal;
+	pclFile->Seek(pValues->offset, SEEK_SET);
+	if(pValues->offset > iDataEnd || iDataEnd-pValues->offset < sizeof(pHeader) || !pclFile->Read(pHeader, sizeof(pHeader))) {
+		SetResult(o_pResult, "could not read local header");
+		return;
+	}
+	DecodeRecord(pHeader, &stLocal);
+	uint64_t iDataPos = pValues->offset + sizeof(S_LocalFileHeader) + stLocal.name_len + stLocal.extra_len;
+	if(stLocal.sign != 0x04034b50 || iDataPos > iDataEnd || iDataEnd-iDataPos < pValues->c_size) {
+		SetResult(o_pResult, "local header or data not before the central directory");
+		return;
+	}
+	if(stEntry.c_method == 0 && pValues->c_size != pValues->u_size) {
+		SetResult(o_pResult, "stored, but the sizes differ");
+		return;
+	}
+
+	char *szPath = MakePath(m_szStaging, i_iIdx);
+	C_Resource clOut;
+	clOut.SetMode(false);
+	if(!clOut.SetFilename(szPath)) {
+		SetResult(o_pResult, "could not create file");
+		delete[] szPath;
+		return;
+	}
+	if(stEntry.c_method == 0 && m_bVerified) {
+		if(!clOut.CopyFrom(pclFile, iDataPos, pValues->c_size)) SetResult(o_pResult, "could not copy data");
+	} else if(stEntry.c_method == 0) {
+		//summed on the way, in chunks
+		uint32_t iCrc = 0;
+		pclFile->Seek(iDataPos, SEEK_SET);
+		for(uint64_t iLeft = pValues->c_size; iLeft > 0 && !o_pResult->bError; ) {
+			uint32_t iLen = iLeft < COPY_SIZE ? (uint32_t)iLeft : COPY_SIZE;
+			if(!pclFile->Read(i_pWorker->pBuffer, iLen) || !clOut.Write(i_pWorker->pBuffer, iLen)) SetResult(o_pResult, "could not copy data");
+			iCrc = Crc32Update(iCrc, i_pWorker->pBuffer, iLen);
+			iLeft -= iLen;
 		}
-		bResult = true;
+		if(!o_pResult->bError && iCrc != stEntry.crc32) SetResult(o_pResult, "crc mismatch (%08x, central %08x)", iCrc, stEntry.crc32);
+	} else {
+		uint64_t iSize = 0;
+		uint32_t iCrc = 0;
+		pclFile->Seek(iDataPos, SEEK_SET);
+		if(!i_pWorker->clInflater.Inflate(pclFile, pValues->c_size, &iSize, &iCrc, &clOut)) SetResult(o_pResult, "could not inflate (%s)", i_pWorker->clInflater.GetError());
+		else if(iSize != pValues->u_size) SetResult(o_pResult, "size mismatch (%llu, central %llu)", (unsigned long long)iSize, (unsigned long long)pValues->u_size);
+		else if(iCrc != stEntry.crc32) SetResult(o_pResult, "crc mismatch (%08x, central %08x)", iCrc, stEntry.crc32);
 	}
+	clOut.SetMode(false); //closes it
+	if(!o_pResult->bError) SetMode(szPath, m_pModes[i_iIdx]);
+	delete[] szPath;
+}
 
-out:
-	delete pclZip;
+bool C_ZipExtractor::WriteFiles(int i_iNumThreads)
+{
+	int iNumFiles = m_pclZip->GetNumFiles();
+	m_pResults = new S_ExtractResult[iNumFiles > 0 ? iNumFiles : 1];
+	memset(m_pResults, 0, sizeof(S_ExtractResult)*(iNumFiles > 0 ? iNumFiles : 1));
+	S_SizeIndex *pOrder = new S_SizeIndex[iNumFiles > 0 ? iNumFiles : 1];
+	int iNumTasks = 0;
+	for(int i=0; i<iNumFiles; i++) {
+		if(m_pSkip[i] || m_pclZip->IsDirectory(i)) continue;
+		pOrder[iNumTasks].iSize = m_pclZip->GetEntry64(i)->c_size;
+		pOrder[iNumTasks++].iIdx = i;
+	}
+	int iNumThreads = i_iNumThreads > 0 ? i_iNumThreads : C_WorkPool::GetNumCores();
+	if(iNumThreads > iNumTasks) iNumThreads = iNumTasks > 0 ? iNumTasks : 1;
+	m_pWorkers = new S_Worker[iNumThreads];
+	m_iNumWorkers = iNumThreads;
+	bool bResult = true;
+	for(int i=0; i<iNumThreads; i++) {
+		m_pWorkers[i].pBuffer = m_bVerified ? NULL : new uint8_t[COPY_SIZE];
+		m_pWorkers[i].clFile.SetMode(true);
+		if(!m_pWorkers[i].clFile.SetFilename(m_szZipFile)) bResult = false;
+	}
+	if(!bResult) {
+		LogPrintf("error: could not open zip file for extracting (%s)\n", m_szZipFile);
+		delete[] pOrder;
+		return false;
+	}
+
+	//largest first, so a big entry does not end up alone at the end
+	qsort(pOrder, iNumTasks, sizeof(S_SizeIndex), CompareSizes);
+	{
+		C_WorkPool clPool(iNumThreads, ExtractTask, this);
+		for(int i=0; i<iNumTasks; i++) clPool.Submit(pOrder[i].iIdx);
+	}
+	delete[] pOrder;
+
+	//in CD order
+	for(int i=0; i<iNumFiles; i++) {
+		if(!m_pResults[i].bError) continue;
+		LogPrintf("error: \"%s\" %s\n", m_pclZip->GetFileName(i), m_pResults[i].szMessage);
+		bResult = false;
+	}
+	return bResult;
+}
+
+void C_ZipExtractor::SetDirectoryModes(const char *i_szBase)
+{
+	//last to first, so the contents are done before a directory which may not be
+	// writable any more
+	for(int i=m_pclZip->GetNumFiles()-1; i>=0; i--) {
+		if(m_pSkip[i] || !m_pclZip->IsDirectory(i) || m_pModes[i] == 0) continue;
+		char *szPath = MakePath(i_szBase, i);
+		SetMode(szPath, m_pModes[i]);
+		delete[] szPath;
+	}
+}
+
+bool C_ZipExtractor::MoveInto(const char *i_szDirectory)
+{
+	//nothing is moved when a file would replace a directory. the directories of
+	// the entries are checked without following links by MakeTree, a link in the
+	// place of a file is replaced itself
+	bool bResult = true;
+	for(int i=0; i<m_pclZip->GetNumFiles(); i++) {
+		if(m_pSkip[i] || m_pclZip->IsDirectory(i)) continue;
+		char *szPath = MakePath(i_szDirectory, i);
+#ifdef _WIN32
+		DWORD iAttributes = GetFileAttributesA(szPath);
+		bool bDirectory = iAttributes != INVALID_FILE_ATTRIBUTES && (iAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			&& !(iAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+#else
+		struct stat stStat;
+		bool bDirectory = lstat(szPath, &stStat) == 0 && S_ISDIR(stStat.st_mode);
+#endif
+		if(bDirectory) {
+			LogPrintf("error: \"%s\" is a directory in %s\n", m_pclZip->GetFileName(i), i_szDirectory);
+			bResult = false;
+		}
+		delete[] szPath;
+	}
+	if(!bResult || !MakeTree(i_szDirectory)) return false;
+	if(!MakeDirectory(m_szBackup)) {
+		LogPrintf("error: could not make directory (%s)\n", m_szBackup);
+		return false;
+	}
+
+	//an old file is linked into the backup first, then the new one is renamed over
+	// it, so the path always has one of both
+	int iNumFiles = m_pclZip->GetNumFiles();
+	m_pMoved = new uint8_t[iNumFiles > 0 ? iNumFiles : 1];
+	memset(m_pMoved, MOVED_NONE, iNumFiles > 0 ? iNumFiles : 1);
+	for(int i=0; i<iNumFiles && bResult; i++) {
+		if(m_pSkip[i] || m_pclZip->IsDirectory(i)) continue;
+		char *szFrom = MakePath(m_szStaging, i);
+		char *szTo = MakePath(i_szDirectory, i);
+		char *szBackup = MakeBackupPath(i);
+		bool bOld = Exists(szTo);
+		if(bOld && !LinkFile(szTo, szBackup)) {
+			LogPrintf("error: could not link \"%s\" to %s\n", szTo, szBackup);
+			bResult = false;
+		} else if(!MoveReplacing(szFrom, szTo)) {
+			LogPrintf("error: could not replace \"%s\"\n", szTo);
+			if(bOld) remove(szBackup);
+			bResult = false;
+		} else m_pMoved[i] = bOld ? MOVED_REPLACED : MOVED_NEW;
+		delete[] szFrom;
+		delete[] szTo;
+		delete[] szBackup;
+	}
+	if(bResult) SetDirectoryModes(i_szDirectory);
+	else if(PutBack(i_szDirectory)) LogPrintf("the files replaced so far were put back, %s is as it was\n", i_szDirectory);
+	else {
+		LogPrintf("error: %s could not be restored, the old files left are in %s and the new ones not moved in %s\n", i_szDirectory, m_szBackup, m_szStaging);
+		m_bPutBackFailed = true;
+		return false;
+	}
+	RemoveBackup();
+	return bResult;
+}
+
+char *C_ZipExtractor::MakeBackupPath(int i_iIdx)
+{
+	//by entry index, the names may have directories which are not there
+	char *szPath = new char[strlen(m_szBackup)+16];
+	sprintf(szPath, "%s/%d", m_szBackup, i_iIdx);
+	return szPath;
+}
+
+bool C_ZipExtractor::PutBack(const char *i_szDirectory)
+{
+	//old files are renamed back over the new ones, new files are removed. the
+	// directories made for them stay
+	bool bResult = true;
+	for(int i=0; i<m_pclZip->GetNumFiles(); i++) {
+		if(m_pMoved[i] == MOVED_NONE) continue;
+		char *szTo = MakePath(i_szDirectory, i);
+		char *szBackup = MakeBackupPath(i);
+		bool bOK = m_pMoved[i] == MOVED_REPLACED ? MoveReplacing(szBackup, szTo) : remove(szTo) == 0;
+		if(bOK) m_pMoved[i] = MOVED_NONE;
+		else {
+			LogPrintf("error: could not put back \"%s\"\n", szTo);
+			bResult = false;
+		}
+		delete[] szTo;
+		delete[] szBackup;
+	}
+	return bResult;
+}
+
+void C_ZipExtractor::RemoveBackup()
+{
+	for(int i=0; i<m_pclZip->GetNumFiles(); i++) {
+		if(m_pMoved[i] != MOVED_REPLACED) continue;
+		char *szBackup = MakeBackupPath(i);
+		remove(szBackup);
+		delete[] szBackup;
+	}
+#ifdef _WIN32
+	RemoveDirectoryA(m_szBackup);
+#else
+	rmdir(m_szBackup);
+#endif
+}
+
+void C_ZipExtractor::RemoveStaging()
+{
+	//what was made there, files first, then the directories deepest first. those of
+	// the entries (and the staging directory) are the only ones made
+	for(int i=0; i<m_pclZip->GetNumFiles(); i++) {
+		if(m_pSkip[i] || m_pclZip->IsDirectory(i)) continue;
+		char *szPath = MakePath(m_szStaging, i);
+		remove(szPath);
+		delete[] szPath;
+	}
+	for(int i=m_pclZip->GetNumFiles()-1; i>=0; i--) {
+		if(m_pSkip[i]) continue;
+		char *szPath = MakePath(m_szStaging, i);
+		size_t iBaseLen = strlen(m_szStaging);
+		for(char *szSlash = szPath+strlen(szPath); szSlash > szPath+iBaseLen; szSlash--) {
+			if(*szSlash != '/' && *szSlash != 0) continue;
+			*szSlash = 0;
+#ifdef _WIN32
+			RemoveDirectoryA(szPath);
+#else
+			rmdir(szPath);
+#endif
+		}
+		delete[] szPath;
+	}
+#ifdef _WIN32
+	RemoveDirectoryA(m_szStaging);
+#else
+	rmdir(m_szStaging);
+#endif
+}
+
+bool C_ZipExtractor::Extract(const char *i_szDirectory, int i_iNumThreads, bool i_bVerified)
+{
+	m_bVerified = i_bVerified;
+	//without a trailing separator, the staging directory is next to it (the same
+	// file system, so it can be renamed)
+	char *szDirectory = new char[strlen(i_szDirectory)+1];
+	strcpy(szDirectory, i_szDirectory);
+	size_t iLen = strlen(szDirectory);
+	while(iLen>1 && (szDirectory[iLen-1]=='/' || szDirectory[iLen-1]=='\\')) szDirectory[--iLen] = 0;
+	m_szStaging = new char[iLen+16];
+	sprintf(m_szStaging, "%s.zip_exec.tmp", szDirectory);
+	m_szBackup = new char[iLen+16];
+	sprintf(m_szBackup, "%s.zip_exec.old", szDirectory);
+
+	bool bResult = false;
+#ifdef _WIN32
+	DWORD iAttributes = GetFileAttributesA(szDirectory);
+	bool bExists = iAttributes != INVALID_FILE_ATTRIBUTES;
+	bool bDirectory = bExists && (iAttributes & FILE_ATTRIBUTE_DIRECTORY);
+	bool bStagingExists = GetFileAttributesA(m_szStaging) != INVALID_FILE_ATTRIBUTES;
+	bool bBackupExists = GetFileAttributesA(m_szBackup) != INVALID_FILE_ATTRIBUTES;
+#else
+	struct stat stStat;
+	bool bExists = stat(szDirectory, &stStat) == 0;
+	bool bDirectory = bExists && S_ISDIR(stStat.st_mode);
+	bool bStagingExists = stat(m_szStaging, &stStat) == 0;
+	bool bBackupExists = stat(m_szBackup, &stStat) == 0;
+#endif
+	if(bExists && !bDirectory) LogPrintf("error: not a directory (%s)\n", szDirectory);
+	else if(bStagingExists) LogPrintf("error: %s exists, left by an earlier run? it must be removed first\n", m_szStaging);
+	else if(bBackupExists) LogPrintf("error: %s exists, the old files of an earlier run which could not be restored\n", m_szBackup);
+	else if(CheckEntries()) {
+		if(!MakeDirectory(m_szStaging)) LogPrintf("error: could not make directory (%s)\n", m_szStaging);
+		else {
+			bResult = MakeTree(m_szStaging) && WriteFiles(i_iNumThreads);
+			if(bResult && !bExists) {
+				SetDirectoryModes(m_szStaging);
+				bResult = C_ZipExtractor::MoveReplacing(m_szStaging, szDirectory);
+				if(!bResult) LogPrintf("error: could not rename %s to %s\n", m_szStaging, szDirectory);
+			} else if(bResult) bResult = MoveInto(szDirectory);
+			if((!bResult || bExists) && !m_bPutBackFailed) RemoveStaging();
+		}
+	}
+	if(bResult) {
+		int iNumWritten = 0;
+		for(int i=0; i<m_pclZip->GetNumFiles(); i++) if(!m_pSkip[i] && !m_pclZip->IsDirectory(i)) iNumWritten++;
+		LogPrintf("extracted %d files to %s%s\n", iNumWritten, szDirectory, bExists ? " (replacing those there)" : "");
+	}
+	delete[] szDirectory;
+	return bResult;
+}
+
+bool ExtractZip(char *i_szZipFile, const char *i_szDirectory, S_Options *i_pstOptions)
+{
+	C_ZipFile clZip;
+	clZip.SetParseThreads(i_pstOptions->iThreads);
+	if(!clZip.Open(i_szZipFile)) {
+		LogPrintf("error: could not open zip file (%s)\n", i_szZipFile);
+		return false;
+	}
+	C_StatsPhase clPhase;
+	clPhase.Start(STATS_EXTRACT);
+	C_ZipExtractor clExtractor(&clZip, i_szZipFile);
+	//only called with --verify when the zip had no errors
+	return clExtractor.Extract(i_szDirectory, i_pstOptions->iThreads, i_pstOptions->bVerify);
+}
+
+//in stream mode stdout is the zip, so messages are moved to stderr
+FILE *OpenStreamOutput()
+{
+	fflush(stdout);
+#ifdef _WIN32
+	int iFd = _dup(_fileno(stdout));
+	if(iFd < 0 || _dup2(_fileno(stderr), _fileno(stdout)) != 0) return NULL;
+	return _fdopen(iFd, "wb");
+#else
+	int iFd = dup(fileno(stdout));
+	if(iFd < 0 || dup2(fileno(stderr), fileno(stdout)) < 0) return NULL;
+	return fdopen(iFd, "wb");
+#endif
+}
+
+#ifndef ZIP_EXEC_LIBRARY
+/////////////
+//allocations of the tool are counted with --stats (current and peak bytes). the
+// size, and whether the block was counted, are kept in front of every block, so
+// blocks allocated before the statistics were enabled are not subtracted later.
+// without --stats nothing but the header is added to malloc
+
+static const size_t g_iAllocHeader = 16; //keeps the alignment of malloc
+//not inlined into the callers of new/delete, where it would look like a mismatch
+#ifdef _MSC_VER
+#define ZIP_EXEC_NOINLINE __declspec(noinline)
+#else
+#define ZIP_EXEC_NOINLINE __attribute__((noinline))
+#endif
+
+static ZIP_EXEC_NOINLINE void *CountedAlloc(size_t i_iSize)
+{
+	uint8_t *pBlock = (uint8_t *)malloc(i_iSize+g_iAllocHeader);
+	if(pBlock == NULL) return NULL;
+	bool bCounted = g_stStats.bEnabled;
+	((size_t *)pBlock)[0] = i_iSize;
+	((size_t *)pBlock)[1] = bCounted;
+	if(!bCounted) return pBlock+g_iAllocHeader;
+	int64_t iNow = g_stStats.iAllocated.fetch_add((int64_t)i_iSize, std::memory_order_relaxed) + (int64_t)i_iSize;
+	int64_t iPeak = g_stStats.iPeakAllocated.load(std::memory_order_relaxed);
+	while(iNow > iPeak && !g_stStats.iPeakAllocated.compare_exchange_weak(iPeak, iNow, std::memory_order_relaxed)) {}
+	return pBlock+g_iAllocHeader;
+}
+
+static ZIP_EXEC_NOINLINE void CountedFree(void *i_pData)
+{
+	if(i_pData == NULL) return;
+	uint8_t *pBlock = (uint8_t *)i_pData-g_iAllocHeader;
+	if(((size_t *)pBlock)[1]) g_stStats.iAllocated.fetch_sub((int64_t)((size_t *)pBlock)[0], std::memory_order_relaxed);
+	free(pBlock);
+}
+
+void *operator new(size_t i_iSize)
+{
+	void *pData = CountedAlloc(i_iSize);
+	if(pData == NULL) throw std::bad_alloc();
+	return pData;
+}
+void *operator new[](size_t i_iSize) { return operator new(i_iSize); }
+void *operator new(size_t i_iSize, const std::nothrow_t &) noexcept { return CountedAlloc(i_iSize); }
+void *operator new[](size_t i_iSize, const std::nothrow_t &) noexcept { return CountedAlloc(i_iSize); }
+void operator delete(void *i_pData) noexcept { CountedFree(i_pData); }
+void operator delete[](void *i_pData) noexcept { CountedFree(i_pData); }
+void operator delete(void *i_pData, size_t) noexcept { CountedFree(i_pData); }
+void operator delete[](void *i_pData, size_t) noexcept { CountedFree(i_pData); }
+void operator delete(void *i_pData, const std::nothrow_t &) noexcept { CountedFree(i_pData); }
+void operator delete[](void *i_pData, const std::nothrow_t &) noexcept { CountedFree(i_pData); }
+
+#ifndef _DEBUG
+//--stats as text with the messages, --stats-json to a file ('-' with the messages)
+static bool WriteStats(bool i_bText, const char *i_szJsonFile)
+{
+	if(i_bText) PrintStats(false, NULL);
+	if(i_szJsonFile == NULL) return true;
+	if(strcmp(i_szJsonFile, "-")==0) {
+		PrintStats(true, NULL);
+		return true;
+	}
+	FILE *pFile = fopen(i_szJsonFile, "w");
+	if(pFile == NULL) {
+		LogPrintf("error: could not write statistics (%s)\n", i_szJsonFile);
+		return false;
+	}
+	PrintStats(true, pFile);
+	fclose(pFile);
+	return true;
+}
+#endif
+
+/////////////
+//archives processed in one run, each with its own files and policy. with more
+// than one they are processed in parallel, the messages of each are printed
+// together (in the order given) when it is done.
+
+struct S_ArchiveJob
+{
+	char *szZipFile;
+	char *szDirectory;       //--create
+	const char *szPolicyFile;
+	C_TargetList clFiles;
+	C_TargetList clAddNames, clAddFiles; //--add
+	C_PermissionPolicy clPolicy; //own instance, matching is not thread safe
+	S_Options stOptions;
+	FILE *pStreamOutput;     //--stream
+	bool bResult;
+	bool bUnchanged;         //nothing needed to be written
+	S_MessageLog stLog;
+	std::atomic<int> iDone;
+};
+
+bool RunArchiveJob(S_ArchiveJob *i_pJob)
+{
+	S_Options *pOptions = &i_pJob->stOptions;
+	if(pOptions->bStream) return FixZipFlagsStream(i_pJob->pStreamOutput, &i_pJob->clFiles, pOptions);
+	if(pOptions->pList) return ListZip(i_pJob->szZipFile, i_pJob->pStreamOutput, pOptions->pList, pOptions->iThreads);
+	bool bResult = true;
+	if(pOptions->bCreate) bResult = CreateZip(i_pJob->szZipFile, i_pJob->szDirectory, &i_pJob->clFiles, pOptions);
+	else if(i_pJob->clFiles.GetNum() || pOptions->pclPolicy || pOptions->bSyncLocal || pOptions->pclAddNames || pOptions->bCompact) bResult = FixZipFlags(i_pJob->szZipFile, i_pJob->szZipFile, &i_pJob->clFiles, pOptions, &i_pJob->bUnchanged);
+	//only verifying when nothing is to be modified
+	if(bResult && pOptions->bVerify) bResult = VerifyZip(i_pJob->szZipFile, pOptions);
 	return bResult;
 }
 
+#ifndef _DEBUG
+static C_WorkPool *g_pclJobPool = NULL;
+
+static void RunArchiveTask(void *i_pContext, int i_iWorker, int i_iTask)
+{
+	S_ArchiveJob *pJob = ((S_ArchiveJob **)i_pContext)[i_iTask];
+	g_pMessageLog = &pJob->stLog;
+	pJob->bResult = RunArchiveJob(pJob);
+	if(!pJob->bResult) LogPrintf("error: failed operation (%s)\n", pJob->szZipFile);
+	g_pMessageLog = NULL;
+	g_pclJobPool->SignalDone(&pJob->iDone);
+}
+#endif
+
 int main(int argc, char *argv[])
 {
-	printf("zip_exec v1.20\n");
+	S_Options stOptions;
+	memset(&stOptions, 0, sizeof(stOptions));
+	stOptions.iLevel = 9;
+	bool bResult = true;
+	bool bUnchanged = false; //all archives were already as they would be written
 #ifndef _DEBUG
-	if(argc<3) {
-		printf("usage: 'zip_exec \"file_with_full_path.zip\" \"file_in_archive_to_modify_with_full_path\"'\n");
+	S_ArchiveJob **pJobs = NULL;
+	int iNumJobs = 0;
+	int iArg = 1;
+	const char *szPolicyFile = NULL;
+	bool bStats = false;
+	const char *szStatsJson = NULL;
+	bool bList = false, bListFilter = false;
+	bool bDiff = false;
+	bool bExtract = false;
+	S_ListFilter stList;
+	stList.bJson = false;
+	stList.iNumModes = 0;
+	stList.bNotModes = false;
+	stList.iKind = LIST_ANY;
+	stList.bHeaderDone = false;
+	for(; iArg<argc && strncmp(argv[iArg], "--", 2)==0; iArg++) {
+		if(strcmp(argv[iArg], "--in-place")==0) stOptions.bInPlace = true;
+		else if(strcmp(argv[iArg], "--stream")==0) stOptions.bStream = true;
+		else if(strcmp(argv[iArg], "--policy")==0 && iArg+1<argc) szPolicyFile = argv[++iArg];
+		else if(strcmp(argv[iArg], "--create")==0) stOptions.bCreate = true;
+		else if(strcmp(argv[iArg], "--level")==0 && iArg+1<argc) stOptions.iLevel = atoi(argv[++iArg]);
+		else if(strcmp(argv[iArg], "--threads")==0 && iArg+1<argc) stOptions.iThreads = atoi(argv[++iArg]);
+		else if(strcmp(argv[iArg], "--verify")==0) stOptions.bVerify = true;
+		else if(strcmp(argv[iArg], "--sync-local")==0) stOptions.bSyncLocal = true;
+		else if(strcmp(argv[iArg], "--stats")==0) bStats = true;
+		else if(strcmp(argv[iArg], "--stats-json")==0 && iArg+1<argc) szStatsJson = argv[++iArg];
+		else if(strcmp(argv[iArg], "--digest")==0) stOptions.bDigest = true;
+		else if(strcmp(argv[iArg], "--exit-unchanged")==0) stOptions.bExitUnchanged = true;
+		else if(strcmp(argv[iArg], "--compact")==0) stOptions.bCompact = true;
+		else if(strcmp(argv[iArg], "--list")==0) bList = true;
+		else if(strcmp(argv[iArg], "--diff")==0) bDiff = true;
+		else if(strcmp(argv[iArg], "--extract")==0) bExtract = true;
+		else if(strcmp(argv[iArg], "--list-json")==0) bList = stList.bJson = true;
+		else if(strcmp(argv[iArg], "--match")==0 && iArg+1<argc) {
+			if(!stList.clMatch.AddRule(argv[++iArg], 0, RULE_ANY)) {
+				LogPrintf("error: invalid glob (%s)\n", argv[iArg]);
+				return 1;
+			}
+			bListFilter = true;
+		}
+		else if((strcmp(argv[iArg], "--mode")==0 || strcmp(argv[iArg], "--not-mode")==0) && iArg+1<argc) {
+			bool bNot = argv[iArg][2] == 'n';
+			if(!ParseListModes(argv[++iArg], &stList, bNot)) {
+				LogPrintf("error: invalid modes (%s)\n", argv[iArg]);
+				return 1;
+			}
+			bListFilter = true;
+		}
+		else if(strcmp(argv[iArg], "--kind")==0 && iArg+1<argc) {
+			const char *szKind = argv[++iArg];
+			for(int i=0; i<4; i++) if(strcmp(szKind, g_szListKinds[i])==0) stList.iKind = i;
+			if(stList.iKind == LIST_ANY) {
+				LogPrintf("error: invalid kind (%s), dir, exec, normal or other\n", szKind);
+				return 1;
+			}
+			bListFilter = true;
+		}
+		else {
+			LogPrintf("error: unknown option (%s)\n", argv[iArg]);
+			return 1;
+		}
+	}
+	if(bStats || szStatsJson) EnableStats();
+	if(bList) stOptions.pList = &stList;
+	FILE *pStreamOutput = NULL;
+	if(stOptions.bStream || bList) {
+		pStreamOutput = OpenStreamOutput();
+		if(pStreamOutput == NULL) {
+			LogPrintf("error: could not open stdout\n");
+			return 1;
+		}
+	}
+	LogPrintf("zip_exec v1.30\n");
+	if(stOptions.bCreate && (stOptions.bStream || stOptions.bInPlace)) {
+		LogPrintf("error: --create can not be used with --stream or --in-place\n");
+		return 1;
+	}
+	if(stOptions.bCompact && (stOptions.bStream || stOptions.bCreate || stOptions.bInPlace)) {
+		LogPrintf("error: --compact can not be used with --stream, --create or --in-place\n");
+		return 1;
+	}
+	if(bList && (stOptions.bStream || stOptions.bCreate || stOptions.bInPlace || stOptions.bVerify || stOptions.bSyncLocal || stOptions.bCompact || szPolicyFile)) {
+		LogPrintf("error: --list only lists, it can not be used with options that modify or verify\n");
+		return 1;
+	}
+	if(bDiff && (bList || stOptions.bStream || stOptions.bCreate || stOptions.bInPlace || stOptions.bVerify || stOptions.bSyncLocal || stOptions.bCompact || szPolicyFile)) {
+		LogPrintf("error: --diff only compares, it can not be used with options that modify, verify or list\n");
+		return 1;
+	}
+	if(bExtract && (bList || bDiff || stOptions.bStream || stOptions.bCreate || stOptions.bInPlace || stOptions.bSyncLocal || stOptions.bCompact || szPolicyFile)) {
+		LogPrintf("error: --extract can only be used with --verify (which checks the zip first) and --threads\n");
+		return 1;
+	}
+	if(bListFilter && !bList) {
+		LogPrintf("error: --match, --mode, --not-mode and --kind filter --list\n");
+		return 1;
+	}
+	if((stOptions.bVerify || stOptions.bSyncLocal) && stOptions.bStream) {
+		//the local headers are passed on before the CD is read
+		LogPrintf("error: --verify and --sync-local can not be used with --stream\n");
+		return 1;
+	}
+	if(stOptions.bInPlace && stOptions.bStream) {
+		//the stream is written to stdout, there is no file to update
+		LogPrintf("error: --in-place can not be used with --stream\n");
+		return 1;
+	}
+	if(stOptions.iLevel < 0 || stOptions.iLevel > 9 || stOptions.iThreads < 0) {
+		LogPrintf("error: invalid --level or --threads\n");
+		return 1;
+	}
+	//with a policy, when syncing or when verifying no files need to be given, when
+	// creating the directory is needed
+	int iMinArgs = stOptions.bStream ? 0 : 1;
+	if(stOptions.bCreate) iMinArgs = 2;
+	else if(szPolicyFile == NULL && !stOptions.bVerify && !stOptions.bSyncLocal && !stOptions.bCompact && !bList) iMinArgs++;
+	if(bDiff || bExtract) iMinArgs = 2;
+	if(argc-iArg < iMinArgs) {
+		LogPrintf("usage: 'zip_exec [options] \"file_with_full_path.zip\" \"file_in_archive_to_modify_with_full_path\" [more files...]'\n");
+		LogPrintf("       'zip_exec [options] \"a.zip\" [files...] --next \"b.zip\" [--policy rules.txt] [files...] ...'\n");
+		LogPrintf("       'zip_exec --stream \"file_in_archive_to_modify_with_full_path\" [more files...] <in.zip >out.zip'\n");
+		LogPrintf("       'zip_exec --create \"new.zip\" \"directory\" [files in the directory to set executable...]'\n");
+		LogPrintf("       'zip_exec --verify \"file_with_full_path.zip\" [files to modify first...]'\n");
+		LogPrintf("       'zip_exec --list [--match glob] [--not-mode 644,755] [--kind exec] \"a.zip\" [--next \"b.zip\" ...]'\n");
+		LogPrintf("       'zip_exec --diff \"old.zip\" \"new.zip\"'\n");
+		LogPrintf("       'zip_exec --extract [--verify] \"a.zip\" \"directory\"'\n");
+		LogPrintf("       a file argument of '@list.txt' reads names from list.txt (one per line), '-' reads them from stdin, names are taken literally\n");
+		LogPrintf("       archives after --next are processed in parallel, each with its own files and optionally its own policy\n");
+		LogPrintf("       '--add \"name_in_archive\" \"file\"' after an archive adds the file (or replaces the entry) by appending it\n");
+		LogPrintf("options:\n");
+		LogPrintf("  --in-place  only overwrite the central directory instead of rewriting the whole zip\n");
+		LogPrintf("  --stream    read the zip from stdin and write it to stdout, only the central directory is kept in memory\n");
+		LogPrintf("  --policy rules.txt\n");
+		LogPrintf("              set modes by ordered glob rules, one per line: <glob> [->] <octal mode> [file|dir]\n");
+		LogPrintf("              the first matching rule is used, the files given are set executable after that\n");
+		LogPrintf("  --create    create the zip from the contents of a directory, deflated in parallel with unix attributes\n");
+		LogPrintf("  --level n   compression level for --create and --add, 0 (store) to 9 (best, default)\n");
+		LogPrintf("  --threads n number of threads for --create, --add, --verify, --extract and for several archives, default one per core\n");
+		LogPrintf("  --verify    check the local headers and the crc-32 and size of all entries (in parallel), after\n");
+		LogPrintf("              modifying or creating the zip, or alone\n");
+		LogPrintf("  --sync-local\n");
+		LogPrintf("              also set the version needed of the local headers to the one of the central directory\n");
+		LogPrintf("  --stats     print the time per phase, bytes read and written, i/o calls, entries scanned and peak memory\n");
+		LogPrintf("  --stats-json file\n");
+		LogPrintf("              the same as one json object to a file, '-' prints it with the messages\n");
+		LogPrintf("  --digest    print the sha-256 of the central directory and end records of the result\n");
+		LogPrintf("  --list      list the central directory as tab separated values to stdout, one line per entry: name,\n");
+		LogPrintf("              sizes, method, crc, os, unix mode, dos attributes, kind (dir/exec/normal/other), offset\n");
+		LogPrintf("  --list-json the same as one json object per line\n");
+		LogPrintf("  --match glob, --mode m[,m...], --not-mode m[,m...], --kind k\n");
+		LogPrintf("              list only the entries matching any of the globs, with (without) one of the modes, of the kind\n");
+		LogPrintf("  --diff      report the entries added, removed, changed (crc-32 or size) and with other unix mode or type in\n");
+		LogPrintf("              the new zip, from the central directories only. exits with 2 when there are differences\n");
+		LogPrintf("  --extract   extract the zip in parallel with the unix modes, into a staging directory next to the\n");
+		LogPrintf("              target which then replaces it, or whose files replace those in an existing one. the\n");
+		LogPrintf("              latter is not atomic: files are replaced one by one, and put back if one fails\n");
+		LogPrintf("  --compact   leave out the local data no entry refers to (the records of replaced entries)\n");
+		LogPrintf("  --exit-unchanged\n");
+		LogPrintf("              exit with 3 when no archive needed to be written (already had all the attributes)\n");
+		return 1;
+	}
+
+	if(bDiff) {
+		if(argc-iArg != 2) {
+			LogPrintf("error: --diff needs the old and the new zip\n");
+			return 1;
+		}
+		bool bDifferent = false;
+		bResult = DiffZips(argv[iArg], argv[iArg+1], &stOptions, &bDifferent);
+		if(!WriteStats(bStats, szStatsJson)) bResult = false;
+		if(!bResult) {
+			LogPrintf("error: failed operation\n");
+			return 1;
+		}
+		return bDifferent ? 2 : 0;
+	}
+
+	if(bExtract) {
+		if(argc-iArg != 2) {
+			LogPrintf("error: --extract needs the zip and the directory\n");
+			return 1;
+		}
+		//nothing is written when the zip has errors
+		bResult = !stOptions.bVerify || VerifyZip(argv[iArg], &stOptions);
+		if(bResult) bResult = ExtractZip(argv[iArg], argv[iArg+1], &stOptions);
+		if(!WriteStats(bStats, szStatsJson)) bResult = false;
+		if(!bResult) {
+			LogPrintf("error: failed operation\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	//one job per archive, they are separated by --next
+	int iMaxJobs = 1;
+	for(int i=iArg; i<argc; i++) if(strcmp(argv[i], "--next")==0) iMaxJobs++;
+	if(iMaxJobs > 1 && (stOptions.bStream || stOptions.bCreate)) {
+		LogPrintf("error: --next can not be used with --stream or --create\n");
 		return 1;
 	}
+	pJobs = new S_ArchiveJob*[iMaxJobs];
+	//a stream with only a policy has no arguments, but still one job
+	while((iArg < argc || (stOptions.bStream && iNumJobs == 0)) && bResult) {
+		if(argc-iArg < (stOptions.bCreate ? 2 : (stOptions.bStream ? 0 : 1))) {
+			LogPrintf("error: archive missing after --next\n");
+			bResult = false;
+			break;
+		}
+		S_ArchiveJob *pJob = new S_ArchiveJob();
+		pJobs[iNumJobs++] = pJob;
+		pJob->szZipFile = stOptions.bStream ? NULL : argv[iArg++];
+		pJob->szDirectory = stOptions.bCreate ? argv[iArg++] : NULL;
+		pJob->szPolicyFile = szPolicyFile;
+		pJob->stOptions = stOptions;
+		pJob->pStreamOutput = pStreamOutput;
+		pJob->bResult = false;
+		pJob->bUnchanged = false;
+		memset(&pJob->stLog, 0, sizeof(pJob->stLog));
+		pJob->iDone = 0;
+		for(; iArg<argc; iArg++) {
+			if(strcmp(argv[iArg], "--next")==0) {
+				iArg++;
+				break;
+			}
+			if(strcmp(argv[iArg], "--policy")==0 && iArg+1<argc) {
+				pJob->szPolicyFile = argv[++iArg];
+				continue;
+			}
+			if(strcmp(argv[iArg], "--add")==0) {
+				if(iArg+2 >= argc || stOptions.bStream || stOptions.bCreate) {
+					LogPrintf("error: --add needs a name and a file, and can not be used with --stream or --create\n");
+					bResult = false;
+					break;
+				}
+				pJob->clAddNames.Add(argv[++iArg]);
+				pJob->clAddFiles.Add(argv[++iArg]);
+				pJob->stOptions.pclAddNames = &pJob->clAddNames;
+				pJob->stOptions.pclAddFiles = &pJob->clAddFiles;
+				continue;
+			}
+			if(stOptions.bStream && strcmp(argv[iArg], "-")==0) {
+				LogPrintf("error: stdin is the zip in stream mode\n");
+				bResult = false;
+				break;
+			}
+			if(argv[iArg][0]=='@' || strcmp(argv[iArg], "-")==0) {
+				const char *szList = argv[iArg][0]=='@' ? argv[iArg]+1 : argv[iArg];
+				if(!pJob->clFiles.AddFromFile(szList)) {
+					LogPrintf("error: could not read file list (%s)\n", szList);
+					bResult = false;
+					break;
+				}
+			} else pJob->clFiles.Add(argv[iArg]);
+		}
+		if(!bResult) break;
+		if(pJob->szPolicyFile) {
+			if(!pJob->clPolicy.Load(pJob->szPolicyFile)) {
+				bResult = false;
+				break;
+			}
+			pJob->stOptions.pclPolicy = &pJob->clPolicy;
+		}
+		if(bList && (pJob->clFiles.GetNum() || pJob->stOptions.pclPolicy || pJob->stOptions.pclAddNames)) {
+			LogPrintf("error: --list only lists, no files to modify can be given (%s)\n", pJob->szZipFile);
+			bResult = false;
+		}
+		if(pJob->clFiles.GetNum()==0 && pJob->stOptions.pclPolicy==NULL && pJob->stOptions.pclAddNames==NULL && !stOptions.bCreate && !stOptions.bVerify && !stOptions.bSyncLocal && !stOptions.bCompact && !bList) {
+			LogPrintf("error: no files to modify given (%s)\n", pJob->szZipFile ? pJob->szZipFile : "-");
+			bResult = false;
+		}
+	}
+
+	//the same archive twice would be written by two threads at once
+	for(int i=0; i<iNumJobs && bResult; i++) {
+		for(int j=0; j<i && bResult; j++) {
+			if(pJobs[i]->szZipFile && C_ZipFile::IsSameFile(pJobs[i]->szZipFile, pJobs[j]->szZipFile)) {
+				LogPrintf("error: archive given more than once (%s)\n", pJobs[i]->szZipFile);
+				bResult = false;
+			}
+		}
+	}
 
-	bool bResult = FixZipFlags(argv[1], argv[1], argv[2]);
+	if(bResult && iNumJobs == 1) {
+		bResult = RunArchiveJob(pJobs[0]);
+		bUnchanged = pJobs[0]->bUnchanged;
+	} else if(bResult) {
+		//in parallel, messages and results are reported in the order given
+		int iNumThreads = stOptions.iThreads > 0 ? stOptions.iThreads : C_WorkPool::GetNumCores();
+		if(iNumThreads > iNumJobs) iNumThreads = iNumJobs;
+		if(bList) iNumThreads = 1; //the lists are written as they are made, in the order given
+		g_pclJobPool = new C_WorkPool(iNumThreads, RunArchiveTask, pJobs);
+		for(int i=0; i<iNumJobs; i++) g_pclJobPool->Submit(i);
+		int iNumFailed = 0;
+		for(int i=0; i<iNumJobs; i++) {
+			S_ArchiveJob *pJob = pJobs[i];
+			g_pclJobPool->Wait(&pJob->iDone);
+			LogPrintf("%s:\n", pJob->szZipFile);
+			if(pJob->stLog.iLength) fwrite(pJob->stLog.pText, 1, pJob->stLog.iLength, stdout);
+			if(!pJob->bResult) iNumFailed++;
+		}
+		bUnchanged = true;
+		for(int i=0; i<iNumJobs; i++) bUnchanged = bUnchanged && pJobs[i]->bUnchanged;
+		delete g_pclJobPool;
+		g_pclJobPool = NULL;
+		for(int i=0; i<iNumJobs; i++) LogPrintf("%s %s\n", pJobs[i]->bResult ? "ok    " : "failed", pJobs[i]->szZipFile);
+		if(iNumFailed) LogPrintf("error: %d of %d archives failed\n", iNumFailed, iNumJobs);
+		if(!WriteStats(bStats, szStatsJson)) iNumFailed++;
+		//the failed ones have reported it already
+		for(int i=0; i<iNumJobs; i++) delete[] pJobs[i]->stLog.pText;
+		for(int i=0; i<iNumJobs; i++) delete pJobs[i];
+		delete[] pJobs;
+		if(iNumFailed) return 1;
+		return bUnchanged && stOptions.bExitUnchanged ? 3 : 0;
+	}
+	for(int i=0; i<iNumJobs; i++) delete pJobs[i];
+	delete[] pJobs;
+	if(!WriteStats(bStats, szStatsJson)) bResult = false;
 #else
 	//debug
-	bool bResult = FixZipFlags("d:\\galaxyv2_1.75_linux_bin.zip", "d:\\test.zip", "galaxyv2_1.75_linux_bin/galaxyv2.exe");
+	LogPrintf("zip_exec v1.30\n");
+	C_TargetList clFiles;
+	clFiles.Add("galaxyv2_1.75_linux_bin/galaxyv2.exe");
+	char szZipFile[] = "d:\\galaxyv2_1.75_linux_bin.zip", szNewZipFile[] = "d:\\test.zip";
+	bResult = FixZipFlags(szZipFile, szNewZipFile, &clFiles, &stOptions, &bUnchanged);
 #endif
 	if(!bResult) {
-		printf("error: failed operation\n");
+		LogPrintf("error: failed operation\n");
 	}
+	if(bResult && bUnchanged && stOptions.bExitUnchanged) return 3;
 	return bResult ? 0 : 1;
 }
+#endif //ZIP_EXEC_LIBRARY
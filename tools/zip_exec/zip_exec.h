@@ -0,0 +1,600 @@
+//core of zip_exec: file handling (C_Resource) and the zip itself (C_ZipFile),
+// declared here so the library build (zip_exec.cpp with ZIP_EXEC_LIBRARY defined,
+// which leaves out the commandline) can be used by the benchmark tools.
+#pragma once
+
+//////////////////////////////////////////////
+//file handling partly from fileresource.cpp and common.h
+#define _FILE_OFFSET_BITS 64 //64 bit file offsets on 32 bit posix systems
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ZIP_EXEC_SSE2
+#include <emmintrin.h>
+#endif
+//carry-less multiply for crc-32, compiled in on x86 and used if the cpu has it
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ZIP_EXEC_PCLMUL
+#define ZIP_EXEC_PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#include <cpuid.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#define ZIP_EXEC_PCLMUL
+#define ZIP_EXEC_PCLMUL_TARGET
+#include <intrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+//messages are printed directly, unless a log is set for the thread (an archive
+// processed on a worker), then they are collected to be printed together later
+struct S_MessageLog
+{
+	char *pText;
+	size_t iLength, iCapacity;
+};
+extern thread_local S_MessageLog *g_pMessageLog;
+
+int LogPrintf(const char *i_szFormat, ...);
+
+//statistics (--stats): time per phase, i/o and memory. nothing is counted unless
+// enabled. phases are timed with C_StatsPhase and summed over all threads, i/o
+// calls are the calls of C_Resource on files (not the system calls below them).
+enum E_StatsPhase
+{
+	STATS_EOCD_SCAN,    //tail of the zip read, end records found
+	STATS_CD_READ,      //CD read (when not within the tail)
+	STATS_CD_PARSE,     //CD entries indexed
+	STATS_NAME_INDEX,   //hash table of the names
+	STATS_MODIFY,       //policy and name lookups with the attribute changes
+	STATS_SAVE_DATA,    //local data copied
+	STATS_APPEND,       //records of added files written
+	STATS_SAVE_CD,      //CD and end records written
+	STATS_SYNC,         //flush to disk and rename
+	STATS_STREAM,       //--stream, local records passed through
+	STATS_CREATE_SCAN,  //--create, directory tree walked
+	STATS_CREATE_WRITE, //--create, compressed and written
+	STATS_VERIFY,       //--verify
+	STATS_LIST,         //--list, entries filtered and written
+	STATS_DIFF,         //--diff, the entries of both zips joined by name
+	STATS_EXTRACT,      //--extract, files written and moved into place
+	STATS_NUM_PHASES
+};
+
+struct S_Stats
+{
+	bool bEnabled;
+	uint64_t iStartNs;
+	std::atomic<uint64_t> pWallNs[STATS_NUM_PHASES];
+	std::atomic<uint64_t> pCpuNs[STATS_NUM_PHASES];
+	std::atomic<uint64_t> pCount[STATS_NUM_PHASES];
+	std::atomic<uint64_t> iBytesRead, iBytesWritten;
+	std::atomic<uint64_t> iReadCalls, iWriteCalls, iSeekCalls;
+	std::atomic<uint64_t> iEntriesScanned;
+	//kept by the allocation functions of the tool, 0 in the library build
+	std::atomic<int64_t> iAllocated, iPeakAllocated;
+};
+extern S_Stats g_stStats;
+
+void EnableStats();
+//text through LogPrintf, or json to i_pFile
+void PrintStats(bool i_bJson, FILE *i_pFile);
+
+//times one phase at a time from Start (or Next) until Next, End or the destructor,
+// it can be declared before gotos and only started later
+class C_StatsPhase
+{
+public:
+	C_StatsPhase() { m_iPhase = -1; };
+	~C_StatsPhase() { End(); };
+	void Start(E_StatsPhase i_ePhase);
+	void Next(E_StatsPhase i_ePhase) { End(); Start(i_ePhase); };
+	void End();
+private:
+	int m_iPhase; //-1 when not timing
+	uint64_t m_iWallStart, m_iCpuStart;
+};
+
+//one part of a gathered write
+struct S_WriteBuffer
+{
+	const void *pData;
+	uint32_t iLength;
+};
+
+class C_Resource
+{
+public:
+	C_Resource();
+	~C_Resource();
+
+	void SetMode(bool i_bReading, bool i_bUpdate = false); //default reading (resets filenames), update is read+write without truncating
+	bool SetFilename(const char* i_szFilename);
+	//a new file for writing next to i_szNextTo, under a name nothing else has (o_szName,
+	// strlen(i_szNextTo)+TEMP_NAME_EXTRA bytes, empty when it fails)
+	bool SetTempFilename(const char* i_szNextTo, char* o_szName);
+	enum { TEMP_NAME_EXTRA = 48 };
+	void SetHandle(FILE* i_pFileHandle); //use an already open stream (stdin/stdout), it is not closed
+	void SetMemory(const uint8_t* i_pData, uint64_t i_iLength, uint64_t i_iStart); //read only, the data is at i_iStart of the resource
+	bool IsOpen() { return m_pFileHandle != NULL || m_pMemory != NULL; };
+	uint64_t GetDataStart() { return m_pMemory ? m_iFileStart : 0; }; //first position that can be read
+
+	bool   Read(void* i_pData, uint32_t i_iLength); //length==0xffffffff means entire resource
+	uint32_t ReadSome(void* i_pData, uint32_t i_iLength); //returns bytes read, less only at the end
+	void   Unread(const void* i_pData, uint32_t i_iLength); //of a stream, read again before what follows
+	void   Seek(uint64_t i_iPos, int i_iMode);
+	uint64_t GetSize() { return m_iFileSize; };
+
+	bool Write(void* i_pData, uint32_t i_iLength);
+	bool WriteGather(const S_WriteBuffer* i_pBuffers, int i_iNumBuffers); //all buffers in one (vectored) write
+	bool Sync(); //flush to disk
+	bool Truncate(uint64_t i_iSize); //of a file being written
+	//i_iLength bytes at i_iPos of i_pclSource to the current position, file to file where
+	// it can be: shared blocks on copy on write file systems (FICLONERANGE), in the
+	// kernel (copy_file_range), through memory otherwise
+	bool CopyFrom(C_Resource* i_pclSource, uint64_t i_iPos, uint64_t i_iLength);
+
+	static bool Rename(const char* i_szFrom, const char* i_szTo); //replaces i_szTo
+	static void SyncDirectoryOf(const char* i_szFilename);
+
+private:
+	void Reset();
+	bool     m_bReading;
+	bool     m_bUpdate;
+	uint64_t m_iFileSize;
+	uint64_t m_iFileStart;
+	FILE* m_pFileHandle;
+	bool     m_bOwnHandle;
+	const uint8_t* m_pMemory;
+	uint64_t m_iMemoryPos;
+	//given back by Unread, read before the handle
+	uint8_t* m_pPending;
+	uint32_t m_iPendingPos, m_iPendingLength;
+	uint32_t TakePending(void* o_pData, uint32_t i_iLength);
+};
+
+//////////////////////////////////////////////
+//zip handling
+
+#pragma pack(2)
+struct S_LocalFileHeader
+{
+	uint32_t sign;        // 0  4 Local file header signature = 0x04034b50
+	uint16_t ver_needed;  // 4  2 Version needed to extract (minimum)
+	uint16_t gp_flag;     // 6  2 General purpose bit flag
+	uint16_t c_method;    // 8  2 Compression method
+	uint16_t lm_time;     //10  2 File last modification time
+	uint16_t lm_date;     //12  2 File last modification date
+	uint32_t crc32;       //14  4 CRC-32
+	uint32_t c_size;      //18  4 Compressed size
+	uint32_t u_size;      //22  4 Uncompressed size
+	uint16_t name_len;    //26  2 File name length (n)
+	uint16_t extra_len;   //28  2 Extra field length (m)
+	//30      n File name
+	//30+n    m Extra field
+};
+
+struct S_CentralDirectoryEntry
+{
+	uint32_t sign;        // 0  4 Central directory file header signature = 0x02014b50
+	uint16_t ver;         // 4  2 Version made by
+	uint16_t ver_needed;  // 6  2 Version needed to extract (minimum)
+	uint16_t gp_flag;     // 8  2 General purpose bit flag
+	uint16_t c_method;    //10  2 Compression method
+	uint16_t lm_time;     //12  2 File last modification time
+	uint16_t lm_date;     //14  2 File last modification date
+	uint32_t crc32;       //16  4 CRC-32
+	uint32_t c_size;      //20  4 Compressed size
+	uint32_t u_size;      //24  4 Uncompressed size
+	uint16_t name_len;    //28  2 File name length (n)
+	uint16_t extra_len;   //30  2 Extra field length (m)
+	uint16_t comment_len; //32  2 File comment length (k)
+	uint16_t dn_start;    //34  2 Disk number where file starts
+	uint16_t int_attr;    //36  2 Internal file attributes
+	uint32_t ext_attrib;  //38  4 External file attributes
+	uint32_t offset;      //42  4 Relative offset of local file header. This is the number of bytes between the start of the first disk on which the file occurs, and the start of the local file header. This allows software reading the central directory to locate the position of the file inside the ZIP file.
+	//46      n File name
+	//46+n    m Extra field
+	//46+n+m  k File comment
+};
+
+struct S_CentralDirectoryEnd
+{
+	uint32_t sign;        // 0  4 End of central directory signature = 0x06054b50
+	uint16_t num_discs;   // 4  2 Number of this disk
+	uint16_t cd_disc;     // 6  2 Disk where central directory starts
+	uint16_t cd_num;      // 8  2 Number of central directory records on this disk
+	uint16_t cd_tot_num;  //10  2 Total number of central directory records
+	uint32_t cd_size;     //12  4 Size of central directory (bytes)
+	uint32_t cd_start;    //16  4 Offset of start of central directory, relative to start of archive
+	uint16_t comment_len; //20  2 Comment length (n)
+	//22  n  Comment
+};
+
+struct S_Zip64CentralDirectoryEnd
+{
+	uint32_t sign;        // 0  4 Zip64 end of central directory signature = 0x06064b50
+	uint64_t rec_size;    // 4  8 Size of the remaining record (total size - 12)
+	uint16_t ver;         //12  2 Version made by
+	uint16_t ver_needed;  //14  2 Version needed to extract (minimum)
+	uint32_t num_discs;   //16  4 Number of this disk
+	uint32_t cd_disc;     //20  4 Disk where central directory starts
+	uint64_t cd_num;      //24  8 Number of central directory records on this disk
+	uint64_t cd_tot_num;  //32  8 Total number of central directory records
+	uint64_t cd_size;     //40  8 Size of central directory (bytes)
+	uint64_t cd_start;    //48  8 Offset of start of central directory, relative to start of archive
+	//56  n  Zip64 extensible data sector
+};
+
+struct S_Zip64CentralDirectoryLocator
+{
+	uint32_t sign;        // 0  4 Zip64 end of central directory locator signature = 0x07064b50
+	uint32_t cd_end_disc; // 4  4 Disk where the zip64 end of central directory record starts
+	uint64_t cd_end_start;// 8  8 Offset of the zip64 end of central directory record
+	uint32_t num_discs;   //16  4 Total number of disks
+};
+#pragma pack()
+
+//////////////////////////////////////////////
+//record codecs
+//all values in a zip are little endian. each record type lists its fields
+// (offset and size), decoding/encoding a record copies it and swaps the
+// fields on big endian hosts. on little endian hosts it is a plain copy.
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ZIP_EXEC_BIG_ENDIAN
+#endif
+
+struct S_RecordField
+{
+	uint8_t offset;
+	uint8_t size;
+};
+#define RECORD_FIELD(T, f) { (uint8_t)offsetof(T, f), (uint8_t)sizeof(((T *)0)->f) }
+
+template<typename T> struct T_RecordLayout; //specialized for each record type
+
+template<> struct T_RecordLayout<S_LocalFileHeader>
+{
+	static constexpr S_RecordField fields[] = {
+		RECORD_FIELD(S_LocalFileHeader, sign),     RECORD_FIELD(S_LocalFileHeader, ver_needed),
+		RECORD_FIELD(S_LocalFileHeader, gp_flag),  RECORD_FIELD(S_LocalFileHeader, c_method),
+		RECORD_FIELD(S_LocalFileHeader, lm_time),  RECORD_FIELD(S_LocalFileHeader, lm_date),
+		RECORD_FIELD(S_LocalFileHeader, crc32),    RECORD_FIELD(S_LocalFileHeader, c_size),
+		RECORD_FIELD(S_LocalFileHeader, u_size),   RECORD_FIELD(S_LocalFileHeader, name_len),
+		RECORD_FIELD(S_LocalFileHeader, extra_len) };
+};
+
+template<> struct T_RecordLayout<S_CentralDirectoryEntry>
+{
+	static constexpr S_RecordField fields[] = {
+		RECORD_FIELD(S_CentralDirectoryEntry, sign),        RECORD_FIELD(S_CentralDirectoryEntry, ver),
+		RECORD_FIELD(S_CentralDirectoryEntry, ver_needed),  RECORD_FIELD(S_CentralDirectoryEntry, gp_flag),
+		RECORD_FIELD(S_CentralDirectoryEntry, c_method),    RECORD_FIELD(S_CentralDirectoryEntry, lm_time),
+		RECORD_FIELD(S_CentralDirectoryEntry, lm_date),     RECORD_FIELD(S_CentralDirectoryEntry, crc32),
+		RECORD_FIELD(S_CentralDirectoryEntry, c_size),      RECORD_FIELD(S_CentralDirectoryEntry, u_size),
+		RECORD_FIELD(S_CentralDirectoryEntry, name_len),    RECORD_FIELD(S_CentralDirectoryEntry, extra_len),
+		RECORD_FIELD(S_CentralDirectoryEntry, comment_len), RECORD_FIELD(S_CentralDirectoryEntry, dn_start),
+		RECORD_FIELD(S_CentralDirectoryEntry, int_attr),    RECORD_FIELD(S_CentralDirectoryEntry, ext_attrib),
+		RECORD_FIELD(S_CentralDirectoryEntry, offset) };
+};
+
+template<> struct T_RecordLayout<S_CentralDirectoryEnd>
+{
+	static constexpr S_RecordField fields[] = {
+		RECORD_FIELD(S_CentralDirectoryEnd, sign),       RECORD_FIELD(S_CentralDirectoryEnd, num_discs),
+		RECORD_FIELD(S_CentralDirectoryEnd, cd_disc),    RECORD_FIELD(S_CentralDirectoryEnd, cd_num),
+		RECORD_FIELD(S_CentralDirectoryEnd, cd_tot_num), RECORD_FIELD(S_CentralDirectoryEnd, cd_size),
+		RECORD_FIELD(S_CentralDirectoryEnd, cd_start),   RECORD_FIELD(S_CentralDirectoryEnd, comment_len) };
+};
+
+template<> struct T_RecordLayout<S_Zip64CentralDirectoryEnd>
+{
+	static constexpr S_RecordField fields[] = {
+		RECORD_FIELD(S_Zip64CentralDirectoryEnd, sign),       RECORD_FIELD(S_Zip64CentralDirectoryEnd, rec_size),
+		RECORD_FIELD(S_Zip64CentralDirectoryEnd, ver),        RECORD_FIELD(S_Zip64CentralDirectoryEnd, ver_needed),
+		RECORD_FIELD(S_Zip64CentralDirectoryEnd, num_discs),  RECORD_FIELD(S_Zip64CentralDirectoryEnd, cd_disc),
+		RECORD_FIELD(S_Zip64CentralDirectoryEnd, cd_num),     RECORD_FIELD(S_Zip64CentralDirectoryEnd, cd_tot_num),
+		RECORD_FIELD(S_Zip64CentralDirectoryEnd, cd_size),    RECORD_FIELD(S_Zip64CentralDirectoryEnd, cd_start) };
+};
+
+template<> struct T_RecordLayout<S_Zip64CentralDirectoryLocator>
+{
+	static constexpr S_RecordField fields[] = {
+		RECORD_FIELD(S_Zip64CentralDirectoryLocator, sign),         RECORD_FIELD(S_Zip64CentralDirectoryLocator, cd_end_disc),
+		RECORD_FIELD(S_Zip64CentralDirectoryLocator, cd_end_start), RECORD_FIELD(S_Zip64CentralDirectoryLocator, num_discs) };
+};
+
+constexpr S_RecordField T_RecordLayout<S_LocalFileHeader>::fields[];
+constexpr S_RecordField T_RecordLayout<S_CentralDirectoryEntry>::fields[];
+constexpr S_RecordField T_RecordLayout<S_CentralDirectoryEnd>::fields[];
+constexpr S_RecordField T_RecordLayout<S_Zip64CentralDirectoryEnd>::fields[];
+constexpr S_RecordField T_RecordLayout<S_Zip64CentralDirectoryLocator>::fields[];
+
+//a layout must cover its record completely, without gaps
+template<typename T, int N> constexpr bool IsLayoutComplete(const S_RecordField (&i_stFields)[N], int i_iIdx = 0, int i_iOffset = 0)
+{
+	return i_iIdx==N ? i_iOffset==(int)sizeof(T)
+		: (i_stFields[i_iIdx].offset==i_iOffset && IsLayoutComplete<T>(i_stFields, i_iIdx+1, i_iOffset+i_stFields[i_iIdx].size));
+}
+static_assert(IsLayoutComplete<S_LocalFileHeader>(T_RecordLayout<S_LocalFileHeader>::fields), "S_LocalFileHeader layout");
+static_assert(IsLayoutComplete<S_CentralDirectoryEntry>(T_RecordLayout<S_CentralDirectoryEntry>::fields), "S_CentralDirectoryEntry layout");
+static_assert(IsLayoutComplete<S_CentralDirectoryEnd>(T_RecordLayout<S_CentralDirectoryEnd>::fields), "S_CentralDirectoryEnd layout");
+static_assert(IsLayoutComplete<S_Zip64CentralDirectoryEnd>(T_RecordLayout<S_Zip64CentralDirectoryEnd>::fields), "S_Zip64CentralDirectoryEnd layout");
+static_assert(IsLayoutComplete<S_Zip64CentralDirectoryLocator>(T_RecordLayout<S_Zip64CentralDirectoryLocator>::fields), "S_Zip64CentralDirectoryLocator layout");
+
+inline void SwapBytes(uint8_t *io_pData, int i_iNumBytes)
+{
+	for(int i=0; i<i_iNumBytes/2; i++) {
+		uint8_t iTmp = io_pData[i];
+		io_pData[i] = io_pData[i_iNumBytes-1-i];
+		io_pData[i_iNumBytes-1-i] = iTmp;
+	}
+}
+
+template<typename T> inline void DecodeRecord(const uint8_t *i_pSrc, T *o_pRecord)
+{
+	memcpy(o_pRecord, i_pSrc, sizeof(T));
+#ifdef ZIP_EXEC_BIG_ENDIAN
+	for(const S_RecordField &stField : T_RecordLayout<T>::fields) SwapBytes((uint8_t *)o_pRecord+stField.offset, stField.size);
+#endif
+}
+
+template<typename T> inline void EncodeRecord(const T *i_pRecord, uint8_t *o_pDst)
+{
+	memcpy(o_pDst, i_pRecord, sizeof(T));
+#ifdef ZIP_EXEC_BIG_ENDIAN
+	for(const S_RecordField &stField : T_RecordLayout<T>::fields) SwapBytes(o_pDst+stField.offset, stField.size);
+#endif
+}
+
+//single values
+template<typename T> inline T LoadLittleEndian(const uint8_t *i_pSrc)
+{
+	T iValue;
+	memcpy(&iValue, i_pSrc, sizeof(T));
+#ifdef ZIP_EXEC_BIG_ENDIAN
+	SwapBytes((uint8_t *)&iValue, sizeof(T));
+#endif
+	return iValue;
+}
+
+template<typename T> inline void StoreLittleEndian(uint8_t *o_pDst, T i_iValue)
+{
+#ifdef ZIP_EXEC_BIG_ENDIAN
+	SwapBytes((uint8_t *)&i_iValue, sizeof(T));
+#endif
+	memcpy(o_pDst, &i_iValue, sizeof(T));
+}
+
+//entry values that may be stored in the zip64 extra field (0x0001) when they do
+// not fit in the central directory entry
+class C_ZipBuilder; //files added to a zip are written by the one used for creating
+
+struct S_Zip64Values
+{
+	uint64_t u_size;
+	uint64_t c_size;
+	uint64_t offset;
+};
+
+class C_ZipFile
+{
+public:
+	C_ZipFile();
+	~C_ZipFile();
+
+	bool Open(char *i_szZipFile);
+	//the CD and end records are within i_pData, which are the bytes of the zip from
+	// position i_iStart to the end. i_pData must be kept while the zip is open.
+	bool OpenMemory(const uint8_t *i_pData, uint64_t i_iLength, uint64_t i_iStart);
+	bool Save(char *i_szZipFile);
+	bool SaveInPlace(char *i_szZipFile); //only rewrites the CD of the (unchanged) file that was opened
+	//saving over the opened file writes nothing when it would get the bytes it
+	// already has (no CD record changed, no local header to sync, same end records)
+	bool WasSaveSkipped() { return m_bSaveSkipped; };
+	//sha-256 of the CD and end records as they are written
+	void GetCDDigest(uint8_t o_pDigest[32]);
+
+	//append-only update: added files are written when saving, where the CD was,
+	// with a new CD after them. adding a name already in the zip replaces it, its CD
+	// entry points to the new record and the old record is left in the file until
+	// compacted. the mode is that of the file (0755 or 0644) unless set.
+	bool AddFile(const char *i_szName, const char *i_szPath);
+	void SetAddOptions(int i_iLevel, int i_iNumThreads); //default 9, one thread per core
+	int GetNumAdded();
+	const char *GetAddedName(int i_iAdded);
+	int FindAdded(const char *i_szName); //-1 if not added
+	bool IsReplaced(int i_iIdx) { return m_pReplacedBy && m_pReplacedBy[i_iIdx] >= 0; };
+	void SetAddedMode(int i_iAdded, uint32_t i_iMode);
+	//when saving (not in place), leave out the local data no CD entry refers to and
+	// move the records after it forward
+	void SetCompact(bool i_bCompact) { m_bCompact = i_bCompact; };
+
+	//local data (everything before the CD) is read from the file on demand
+	bool ReadLocalData(uint64_t i_iPos, void *o_pData, uint32_t i_iLength);
+	//when saving, also set the version needed of the local headers to the one of
+	// the CD (the attribute changes only edit the CD)
+	void SetSyncLocalHeaders(bool i_bSync) { m_bSyncLocal = i_bSync; };
+
+	bool IsDirectory(char *i_szFullFileName);
+	bool IsNormal(char *i_szFullFileName);
+	bool IsExecutable(char *i_szFullFileName);
+
+	bool SetDirectory(char *i_szFullFileName);
+	bool SetNormal(char *i_szFullFileName);
+	bool SetExecutable(char *i_szFullFileName);
+
+	//same by CD entry index, without a name lookup
+	bool IsDirectory(int i_iIdx);
+	bool IsNormal(int i_iIdx);
+	bool IsExecutable(int i_iIdx);
+
+	bool SetDirectory(int i_iIdx);
+	bool SetNormal(int i_iIdx);
+	bool SetExecutable(int i_iIdx);
+	//any unix permission bits (07777), file or directory type is kept
+	bool SetUnixMode(int i_iIdx, uint32_t i_iMode);
+	static uint32_t MakeUnixAttributes(uint32_t i_iMode, bool i_bDirectory); //external attributes for a mode
+
+	int GetNumFiles() { return m_iNumFiles; };
+	//threads decoding the CD in Open, 0 means one per core. small CDs use one
+	void SetParseThreads(int i_iNumThreads) { m_iParseThreads = i_iNumThreads; };
+	int FindFileIndexInCD(const char *i_szFile);
+	//with the hash of the name, as GetNameHash of this or another zip returns it
+	int FindFileIndexInCD(const char *i_szFile, uint32_t i_iHash);
+	uint32_t GetNameHash(int i_iIdx) { return m_pNameHashes[i_iIdx]; };
+
+	//CD entry access by index
+	const char *GetFileName(int i_iIdx) { return m_pNames + m_pNameOffsets[i_iIdx]; };
+	void GetEntry(int i_iIdx, S_CentralDirectoryEntry *o_pEntry); //all fields, readable
+	const S_Zip64Values *GetEntry64(int i_iIdx) { return &m_pCDEntries64[i_iIdx]; };
+
+	//helpers
+	static bool IsSameFile(const char *i_szFile1, const char *i_szFile2);
+	static int FindSignatureReverse(const uint8_t *i_pData, int i_iFrom, int i_iTo, const uint8_t *i_pSign);
+private:
+	void Free();
+	bool Open(C_Resource *i_pclRes, const char *i_szName); //takes the resource
+	void BuildNameIndex();
+	static uint32_t HashName(const char *i_szName, int i_iLen);
+	void NormalizeAttributes();
+	bool ReadZip64Extra(int i_iIdx, S_CentralDirectoryEntry *i_pEntry, const uint8_t *i_pExtra);
+	//decodes the records of entries, their positions and name offsets are set. returns
+	// the first entry with an invalid zip64 extra field, or -1
+	enum { PARSE_CHUNK = 16384 };
+	int DecodeEntries(int i_iFirst, int i_iEnd);
+	int DecodeEntriesParallel(int i_iNumFiles);
+	static void ParseTask(void *i_pContext, int i_iWorker, int i_iTask);
+	void SetUnixAttributes(int i_iIdx, uint32_t i_iExtAttrib);
+	//local header fields to rewrite, sorted by position
+	struct S_LocalPatch
+	{
+		uint64_t iPos;
+		int iIdx;
+		uint16_t iValue;
+	};
+	static int ComparePatches(const void *i_pA, const void *i_pB);
+	bool BuildLocalPatches();
+	void ApplyLocalPatches(uint8_t *io_pData, uint64_t i_iPos, uint32_t i_iLength, int *io_iNext);
+	bool CopyLocalData(C_Resource *i_pclFile, uint64_t i_iFrom, uint64_t i_iTo, uint8_t *i_pChunk, int *io_iNextPatch);
+	//local record (header, data, descriptor) of every entry which is kept, by position
+	struct S_Extent
+	{
+		uint64_t iPos, iEnd;
+		int iIdx;
+	};
+	static int CompareExtents(const void *i_pA, const void *i_pB);
+	bool BuildExtents(S_Extent **o_pExtents, int *o_iNumExtents);
+	void SetEntryOffset(int i_iIdx, uint64_t i_iOffset);
+	bool WriteAdded(C_Resource *i_pclFile, uint64_t *io_iPos);
+	bool WriteMergedCD(C_Resource *i_pclFile, uint64_t i_iCDStart, uint64_t *o_iEnd);
+	void FreeAdded();
+	uint64_t GetCDWriteSize();
+	//the encoded end records, the buffers point into it
+	struct S_EndRecords
+	{
+		uint8_t pEnd64[sizeof(S_Zip64CentralDirectoryEnd)];
+		uint8_t pLocator[sizeof(S_Zip64CentralDirectoryLocator)];
+		uint8_t pCDEnd[sizeof(S_CentralDirectoryEnd)];
+	};
+	int BuildCDBuffers(S_WriteBuffer *o_pBuffers, S_EndRecords *o_pRecords, const uint8_t *i_pCD, uint32_t i_iCDSize, uint64_t i_iNumFiles, uint64_t i_iCDStart);
+	bool IsFileUnchanged();
+public:
+	//writes the CD and end records at the current position of the file, the CD
+	// will be at i_iCDStart of the zip
+	bool WriteCD(C_Resource *i_pclFile, uint64_t i_iCDStart);
+	uint64_t GetCDStart() { return m_iCDStart; };
+private:
+
+	bool m_bOpenOK;
+
+	C_Resource *m_pclZipRes; //kept open while the zip is open
+	char *m_szZipFileName;
+	uint64_t m_iZipSize;
+	uint64_t m_iCDEndPos;
+	//local copy of zip header data
+	S_CentralDirectoryEnd m_stCDEnd;
+	char *m_szZipComment;
+	//zip64 end record, if the zip has one
+	bool m_bZip64;
+	S_Zip64CentralDirectoryEnd m_stZip64CDEndReadable;
+	uint8_t *m_pZip64Extensible;
+	//CD position and size, from the zip64 end record if there is one
+	uint64_t m_iCDStart;
+	uint64_t m_iCDSize;
+	int m_iNumFiles;
+	//the CD as read from the file, entry records are edited directly in it, so it
+	// is always ready to be written back
+	uint8_t *m_pCDMem;   //allocation holding the CD
+	uint8_t *m_pCD;      //start of the CD within m_pCDMem
+	uint32_t m_iCDUsed;  //size of all entry records
+	//per entry, struct of arrays of the values used when classifying/setting
+	uint32_t *m_pEntryPos; //position of the record in m_pCD
+	uint16_t *m_pVer;
+	uint16_t *m_pVerNeeded;
+	uint32_t *m_pExtAttrib;
+	uint8_t *m_pAttribSet; //attributes set explicitly, not touched when normalizing
+	S_Zip64Values *m_pCDEntries64;
+	//all names, null terminated, in one block
+	char *m_pNames;
+	uint32_t *m_pNameOffsets;
+	uint16_t *m_pNameLens;
+	//open addressing hash table of entry index+1 (0 is empty) by name
+	int *m_pNameIndex;
+	uint32_t *m_pNameHashes;
+	uint32_t m_iNameIndexMask;
+	bool m_bSyncLocal;
+	S_LocalPatch *m_pLocalPatches;
+	int m_iNumLocalPatches;
+	int m_iNumCDChanges; //CD records with a value changed since opening
+	bool m_bSaveSkipped;
+	//append-only update
+	C_ZipBuilder *m_pclAdded; //NULL until a file is added
+	int *m_pReplacedBy;       //per entry, the added file replacing it or -1
+	int m_iAddLevel, m_iAddThreads;
+	int m_iParseThreads;
+	bool m_bCompact;
+};
+
+//crc-32 as used in zip, i_iCrc is the crc of the data before (0 to start)
+uint32_t Crc32Update(uint32_t i_iCrc, const uint8_t *i_pData, size_t i_iLength);
+//crc of two parts joined, from the crcs of the parts and the length of the second
+uint32_t Crc32Combine(uint32_t i_iCrc1, uint32_t i_iCrc2, uint64_t i_iLength2);
+//sha-256 of the buffers one after the other
+void Sha256(const S_WriteBuffer *i_pBuffers, int i_iNumBuffers, uint8_t o_pDigest[32]);